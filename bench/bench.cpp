@@ -0,0 +1,167 @@
+#include "bench.h"
+
+#include "tmrl/utils/logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// count every heap allocation of the process
+
+static std::atomic<std::size_t> g_alloc_count{0};
+static std::atomic<std::size_t> g_alloc_bytes{0};
+
+void *operator new(std::size_t size)
+{
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  void *p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace tmrl
+{
+namespace bench
+{
+
+std::vector<Case> &registry()
+{
+  static std::vector<Case> cases;
+  return cases;
+}
+
+static std::vector<std::pair<std::string, double>> g_counters;
+
+void counter(const std::string &name, double value)
+{
+  for (auto &c : g_counters) {
+    if (c.first == name) {
+      c.second = value;
+      return;
+    }
+  }
+  g_counters.emplace_back(name, value);
+}
+
+std::size_t alloc_count() { return g_alloc_count.load(std::memory_order_relaxed); }
+std::size_t alloc_bytes() { return g_alloc_bytes.load(std::memory_order_relaxed); }
+
+Result run(const Case &c, double min_time)
+{
+  using clock = std::chrono::steady_clock;
+  Result rv;
+  rv.name = c.name;
+
+  // warm up, then grow the count until a run is long enough
+  g_counters.clear();
+  c.body(1);
+  std::size_t iters = 1;
+  double elapsed = 0.0;
+  std::size_t allocs = 0, abytes = 0;
+  while (true) {
+    std::size_t a0 = alloc_count(), b0 = alloc_bytes();
+    auto t0 = clock::now();
+    c.body(iters);
+    elapsed = std::chrono::duration<double>(clock::now() - t0).count();
+    allocs = alloc_count() - a0;
+    abytes = alloc_bytes() - b0;
+    if (elapsed >= min_time || iters >= ((std::size_t)(1) << 40)) break;
+
+    double scale = (elapsed > 0.0) ? 1.4 * min_time / elapsed : 100.0;
+    if (scale > 100.0) scale = 100.0;
+    if (scale < 2.0) scale = 2.0;
+    iters = (std::size_t)((double)(iters) * scale);
+  }
+  rv.iters = iters;
+  rv.ns_per_op = 1.0e9 * elapsed / (double)(iters);
+  rv.bytes_per_sec = (c.bytes_per_op && elapsed > 0.0) ? (double)(c.bytes_per_op) * (double)(iters) / elapsed : 0.0;
+  rv.allocs_per_op = (double)(allocs) / (double)(iters);
+  rv.alloc_bytes_per_op = (double)(abytes) / (double)(iters);
+  rv.counters = g_counters;
+  return rv;
+}
+
+static void print(const Result &r, const std::string &format, bool first)
+{
+  if (format == "json") {
+    std::printf("%s  {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.3f, "
+      "\"bytes_per_sec\": %.1f, \"allocs_per_op\": %.3f, \"alloc_bytes_per_op\": %.1f",
+      first ? "" : ",\n", r.name.c_str(), r.iters, r.ns_per_op,
+      r.bytes_per_sec, r.allocs_per_op, r.alloc_bytes_per_op);
+    for (auto &c : r.counters) { std::printf(", \"%s\": %.6g", c.first.c_str(), c.second); }
+    std::printf("}");
+  }
+  else if (format == "csv") {
+    // counters in one last column, name=value;name=value
+    std::printf("%s,%zu,%.3f,%.1f,%.3f,%.1f,", r.name.c_str(), r.iters, r.ns_per_op,
+      r.bytes_per_sec, r.allocs_per_op, r.alloc_bytes_per_op);
+    for (std::size_t i = 0; i < r.counters.size(); ++i) {
+      std::printf("%s%s=%.6g", i ? ";" : "", r.counters[i].first.c_str(), r.counters[i].second);
+    }
+    std::printf("\n");
+  }
+  else {
+    char rate[32] = "";
+    if (r.bytes_per_sec > 0.0) std::snprintf(rate, sizeof(rate), "%10.1f MB/s", 1.0e-6 * r.bytes_per_sec);
+    std::printf("%-40s %14.1f ns/op %15s %10.2f allocs/op %12zu iters",
+      r.name.c_str(), r.ns_per_op, rate, r.allocs_per_op, r.iters);
+    for (auto &c : r.counters) { std::printf("  %s=%.4g", c.first.c_str(), c.second); }
+    std::printf("\n");
+  }
+  std::fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  std::string filter;
+  std::string format = "text";
+  double min_time = 0.5;
+  bool list = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string val = (i + 1 < argc) ? argv[i + 1] : "";
+    if (arg == "--filter") { filter = val; ++i; }
+    else if (arg == "--min-time") { min_time = std::atof(val.c_str()); ++i; }
+    else if (arg == "--format") { format = val; ++i; }
+    else if (arg == "--list") { list = true; }
+    else {
+      std::printf("usage: %s [--filter substr] [--min-time sec] [--format text|json|csv] [--list]\n", argv[0]);
+      return 1;
+    }
+  }
+  // library logs would break the machine readable output
+  utils::get_logger().set_level(utils::logger::ERROR);
+
+  if (list) format = "text";
+  else if (format == "json") std::printf("[\n");
+  else if (format == "csv") std::printf("name,iterations,ns_per_op,bytes_per_sec,allocs_per_op,alloc_bytes_per_op,counters\n");
+
+  bool first = true;
+  for (auto &c : registry()) {
+    if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+    if (list) {
+      std::printf("%s\n", c.name.c_str());
+      continue;
+    }
+    print(run(c, min_time), format, first);
+    first = false;
+  }
+  if (!list && format == "json") std::printf("\n]\n");
+  return 0;
+}
+
+}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+#include <cstddef>
+
+namespace tmrl
+{
+namespace bench
+{
+
+/*
+ * Minimal benchmark harness, no dependencies.
+ *
+ * A case runs its body for a requested number of iterations. The runner grows
+ * the count until a run takes min_time, then reports ns/op, bytes/s (from the
+ * bytes one op processes) and heap allocations per op (global operator new).
+ */
+struct Case {
+  std::string name;
+  // bytes processed by one op, 0 if not meaningful
+  std::size_t bytes_per_op;
+  std::function<void(std::size_t iters)> body;
+};
+
+struct Result {
+  std::string name;
+  std::size_t iters = 0;
+  double ns_per_op = 0.0;
+  double bytes_per_sec = 0.0;
+  double allocs_per_op = 0.0;
+  double alloc_bytes_per_op = 0.0;
+  // set by the case with counter()
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+std::vector<Case> &registry();
+
+inline void add(const std::string &name, std::size_t bytes_per_op, std::function<void(std::size_t)> body)
+{
+  registry().push_back(Case{ name, bytes_per_op, body });
+}
+
+// allocations since start
+std::size_t alloc_count();
+std::size_t alloc_bytes();
+
+/*
+ * Report a value next to the timings of the running case (a quality figure
+ * rather than a time), the last value of each name wins
+ */
+void counter(const std::string &name, double value);
+
+Result run(const Case &c, double min_time);
+
+/*
+ * Command line: [--filter substr] [--min-time sec] [--format text|json|csv] [--list]
+ * Runs the registered cases, returns the exit code.
+ */
+int main(int argc, char **argv);
+
+// keep a value alive so the work producing it is not optimized out
+template<typename T>
+inline void keep(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+}
+}
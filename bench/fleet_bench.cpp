@@ -0,0 +1,236 @@
+#include "tmrl/driver/fleet.h"
+#include "tmrl/mock/mock_tmsvr.h"
+#include "tmrl/mock/mock_tmsct.h"
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+/*
+ * Fleet start and synchronized motion start against n loopback mock
+ * controllers (MockTmsct + MockTmsvr each, robot i on 127.0.0.(10 + i)).
+ *
+ * tmr_fleet_bench [--robots n] [--io-threads k] [--syncs n] [--step rad]
+ *   [--feedback-rate hz] [--timeout sec] [--format text|json]
+ *
+ * Stages:
+ *   start    Fleet::start, connect time of the slowest robot
+ *   send     Fleet::release, first to last Resume() sent
+ *   latency  Resume() sent to the first feedback that moved, per robot
+ *   skew     first to last of those feedbacks, bounded by the feedback period
+ *
+ * Each sync stages PTP("JPP") of joint 0 by --step, back and forth, on all
+ * robots, releases it and waits until every robot settled.
+ */
+
+using namespace tmrl;
+using namespace tmrl::driver;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  std::size_t robots = 4;
+  std::size_t io_threads = 1;
+  std::size_t syncs = 50;
+  double step = 0.02;
+  double feedback_rate = 1000.0;
+  double timeout = 1.0;
+  std::string format = "text";
+};
+
+struct Percentiles {
+  std::size_t count = 0;
+  std::size_t missed = 0;
+  double p50 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+// nearest rank, in ms
+Percentiles percentiles(std::vector<double> v, std::size_t missed)
+{
+  Percentiles rv;
+  rv.count = v.size();
+  rv.missed = missed;
+  if (v.empty()) return rv;
+  std::sort(v.begin(), v.end());
+  auto at = [&v](double q)
+  {
+    std::size_t k = (std::size_t)(std::ceil(q * (double)(v.size())));
+    return 1.0e3 * v[(k > 0) ? k - 1 : 0];
+  };
+  rv.p50 = at(0.5);
+  rv.p99 = at(0.99);
+  rv.max = 1.0e3 * v.back();
+  return rv;
+}
+
+void print(const Options &opt, const char *stage, const Percentiles &p, bool &first)
+{
+  if (opt.format == "json") {
+    std::printf("%s  {\"robots\": %zu, \"io_threads\": %zu, \"stage\": \"%s\", \"count\": %zu, \"missed\": %zu, "
+      "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}",
+      first ? "" : ",\n", opt.robots, opt.io_threads, stage, p.count, p.missed, p.p50, p.p99, p.max);
+  }
+  else {
+    std::printf("%-8s %8zu %7zu %10.3f %10.3f %10.3f\n",
+      stage, p.count, p.missed, p.p50, p.p99, p.max);
+  }
+  first = false;
+  std::fflush(stdout);
+}
+
+// threads of this process, 0: unknown
+std::size_t thread_count()
+{
+  std::ifstream ifs("/proc/self/status");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 8, "Threads:") == 0) return (std::size_t)(std::atol(line.c_str() + 8));
+  }
+  return 0;
+}
+
+// one mock controller
+struct Controller {
+  Controller(const mock::MockTmsvr::Config &svr_config, const mock::MockTmsct::Config &sct_config)
+    : svr(svr_config), sct(sct_config, &svr) {}
+
+  // holds 64 byte aligned members, plain new aligns less before C++17
+  static void *operator new(std::size_t size)
+  {
+    void *p = nullptr;
+    if (posix_memalign(&p, alignof(Controller), size) != 0) throw std::bad_alloc();
+    return p;
+  }
+  static void operator delete(void *p) { free(p); }
+
+  mock::MockTmsvr svr;
+  mock::MockTmsct sct;
+};
+
+// every robot at its joint 0 target, standing
+bool wait_settled(Fleet &fleet, double target, double timeout)
+{
+  const auto t0 = clock_type::now();
+  while (clock_type::now() - t0 < std::chrono::duration<double>(timeout)) {
+    bool all = true;
+    for (std::size_t i = 0; i < fleet.size() && all; ++i) {
+      Fleet::Snapshot snap = fleet.snapshot(i);
+      all = std::fabs(snap.joint_angle[0] - target) < 1.0e-4 && std::fabs(snap.joint_speed[0]) < 1.0e-4;
+    }
+    if (all) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string val = (i + 1 < argc) ? argv[i + 1] : "";
+    if (arg == "--robots") { opt.robots = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--io-threads") { opt.io_threads = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--syncs") { opt.syncs = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--step") { opt.step = std::atof(val.c_str()); ++i; }
+    else if (arg == "--feedback-rate") { opt.feedback_rate = std::atof(val.c_str()); ++i; }
+    else if (arg == "--timeout") { opt.timeout = std::atof(val.c_str()); ++i; }
+    else if (arg == "--format") { opt.format = val; ++i; }
+    else {
+      std::printf("usage: %s [--robots n] [--io-threads k] [--syncs n] [--step rad]"
+        " [--feedback-rate hz] [--timeout sec] [--format text|json]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (opt.robots == 0 || opt.robots > 200) opt.robots = 4;
+  if (opt.io_threads == 0) opt.io_threads = 1;
+  utils::get_logger().set_level(utils::logger::ERROR);
+
+  std::vector<std::unique_ptr<Controller>> ctrls;
+  for (std::size_t i = 0; i < opt.robots; ++i) {
+    const std::string ip = "127.0.0." + std::to_string(10 + i);
+    mock::MockTmsvr::Config svr_config;
+    svr_config.ip = ip;
+    svr_config.rate = opt.feedback_rate;
+    mock::MockTmsct::Config sct_config;
+    sct_config.ip = ip;
+    ctrls.emplace_back(new Controller(svr_config, sct_config));
+    if (!ctrls.back()->svr.start() || !ctrls.back()->sct.start()) {
+      std::printf("can not start the mock controller on %s\n", ip.c_str());
+      return 1;
+    }
+  }
+
+  Fleet fleet(opt.io_threads);
+  for (std::size_t i = 0; i < opt.robots; ++i) {
+    if (!fleet.add("127.0.0." + std::to_string(10 + i))) return 1;
+  }
+  // the drivers have their own, count from here
+  const std::size_t threads_before = thread_count();
+
+  std::vector<StartTiming> timings;
+  const int timeout_ms = (int)(1000.0 * opt.timeout);
+  if (!fleet.start(timeout_ms, &timings)) {
+    std::printf("can not connect to the mock controllers\n");
+    return 1;
+  }
+  const std::size_t threads_after = thread_count();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  if (opt.format == "json") std::printf("[\n");
+  else {
+    std::printf("robots %zu, io threads %zu, client threads %zu (own threads: %zu)\n",
+      opt.robots, opt.io_threads, threads_after - threads_before, 2 * opt.robots);
+    std::printf("%-8s %8s %7s %10s %10s %10s\n", "stage", "count", "missed", "p50 ms", "p99 ms", "max ms");
+  }
+  bool first = true;
+
+  std::vector<double> start;
+  for (const StartTiming &t : timings) { start.push_back(t.total); }
+  print(opt, "start", percentiles(start, 0), first);
+
+  std::vector<double> send, latency, skew;
+  std::size_t send_missed = 0, latency_missed = 0, skew_missed = 0;
+  bool ok = true;
+  for (std::size_t k = 0; k < opt.syncs; ++k) {
+    vector6d angs{};
+    angs[0] = (k % 2 == 0) ? opt.step : 0.0;
+    std::vector<std::string> scripts(opt.robots, cmd::PTP_J(angs, 100, 0.02, 0, false));
+    if (!fleet.stage(scripts, timeout_ms)) {
+      tmrl_ERROR_STREAM("FLEET: stage failed");
+      ok = false;
+      break;
+    }
+    Fleet::SyncReport rep = fleet.release(timeout_ms);
+    if (rep.released == opt.robots) send.push_back(rep.send_skew); else ++send_missed;
+    for (double t : rep.start_latency) {
+      if (t >= 0.0) latency.push_back(t); else ++latency_missed;
+    }
+    if (rep.motion_skew >= 0.0) skew.push_back(rep.motion_skew); else ++skew_missed;
+
+    if (!wait_settled(fleet, angs[0], opt.timeout + 5.0)) {
+      tmrl_ERROR_STREAM("FLEET: motion did not settle");
+      ok = false;
+      break;
+    }
+  }
+  print(opt, "send", percentiles(send, send_missed), first);
+  print(opt, "latency", percentiles(latency, latency_missed), first);
+  print(opt, "skew", percentiles(skew, skew_missed), first);
+  if (opt.format == "json") std::printf("\n]\n");
+
+  fleet.halt();
+  for (auto &pc : ctrls) {
+    pc->sct.stop();
+    pc->svr.stop();
+  }
+  return ok ? 0 : 1;
+}
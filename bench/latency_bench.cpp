@@ -0,0 +1,524 @@
+#include "tmrl/driver/driver.h"
+#include "tmrl/mock/mock_tmsvr.h"
+#include "tmrl/mock/mock_tmsct.h"
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+/*
+ * Command round-trip latency against the loopback mock controller
+ * (MockTmsct + MockTmsvr in this process).
+ *
+ * tmr_latency_bench [--mode vel|ptp|restart|all] [--path driver|packed|all] [--count n]
+ *   [--warmup n] [--rate hz] [--inflight n] [--feedback-rate hz] [--vjog-step sec]
+ *   [--reflect frac] [--timeout sec] [--restarts n] [--ip ip] [--format text|json]
+ *
+ * Stages, from the call that sends the command:
+ *   send     the call returns (format, pack and the blocking send)
+ *   ack      the $TMSCT OK reaches the tmsct callback
+ *   reflect  the first feedback callback whose joint 0 moved frac of the step
+ *            from the previous target toward the new one
+ *
+ * vel: SetContinueVJog targets on a triangle wave, --rate of them per second,
+ *   at most --inflight without an ack.
+ * ptp: PTP("JPP") steps back and forth, one at a time, the next one after the
+ *   motion settled.
+ * path driver: Driver::set_vel_mode_target / set_joint_pos_PTP, as an application
+ *   calls them. path packed: packet rendered before the call, only
+ *   TmsctClient::send_packed is timed. Both send on the calling thread.
+ *
+ * restart: --restarts times Driver::halt, Driver::start and the first feedback
+ *   after it, then TmsvrClient::set_reconnet until the first feedback on the
+ *   new connection (within one feedback period).
+ */
+
+using namespace tmrl;
+using namespace tmrl::driver;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  std::string mode = "all";
+  std::string path = "all";
+  std::size_t count = 2000;
+  std::size_t warmup = 50;
+  double rate = 200.0;
+  std::size_t inflight = 4;
+  double feedback_rate = 1000.0;
+  double vjog_step = 0.004;
+  double reflect = 0.1;
+  double timeout = 1.0;
+  std::size_t restarts = 20;
+  std::string ip = "127.0.0.1";
+  std::string format = "text";
+};
+
+// times in s from the start of the run, < 0: did not happen
+struct Sample {
+  double call = -1.0;
+  double sent = -1.0;
+  double ack = -1.0;
+  double reflect = -1.0;
+  bool error = false;
+  // joint 0 value before and after the command (rad or rad/s)
+  double base = 0.0;
+  double target = 0.0;
+};
+
+struct Run {
+  std::mutex mtx;
+  std::condition_variable cv;
+  clock_type::time_point t0;
+  bool active = false;
+  bool vel = true;
+  double reflect = 0.1;
+
+  std::vector<Sample> samples;
+  std::size_t sent = 0;
+  std::size_t acked = 0;
+  std::size_t other_acks = 0;
+  // first sample that may still be reflected
+  std::size_t pending = 0;
+  std::size_t feedbacks = 0;
+  double angle = 0.0;
+  double speed = 0.0;
+
+  double now() const { return std::chrono::duration<double>(clock_type::now() - t0).count(); }
+};
+
+void on_ack(Run &run, const comm::TmsctPacket &pack)
+{
+  std::unique_lock<std::mutex> lck(run.mtx);
+  // $TMSCT replies come back in send order
+  if (run.active && run.acked < run.sent) {
+    Sample &s = run.samples[run.acked++];
+    s.ack = run.now();
+    s.error = pack.has_error();
+  }
+  else {
+    ++run.other_acks;
+  }
+  run.cv.notify_all();
+}
+
+void on_feedback(Run &run, const RobotState &rs)
+{
+  const double angle = rs.joint_angle()[0];
+  const double speed = rs.joint_speed()[0];
+  std::unique_lock<std::mutex> lck(run.mtx);
+  run.angle = angle;
+  run.speed = speed;
+  ++run.feedbacks;
+  run.cv.notify_all();
+  if (!run.active) return;
+
+  const double t = run.now();
+  const double value = run.vel ? speed : angle;
+  for (std::size_t i = run.pending; i < run.sent; ++i) {
+    Sample &s = run.samples[i];
+    if (s.reflect >= 0.0) continue;
+    const double step = s.target - s.base;
+    if ((value - s.base) * (step > 0.0 ? 1.0 : -1.0) >= run.reflect * std::fabs(step)) s.reflect = t;
+  }
+  while (run.pending < run.sent && run.samples[run.pending].reflect >= 0.0) { ++run.pending; }
+  run.cv.notify_all();
+}
+
+struct Percentiles {
+  std::size_t count = 0;
+  std::size_t missed = 0;
+  double p50 = 0.0, p99 = 0.0, p999 = 0.0, max = 0.0;
+};
+
+// nearest rank, in ms
+Percentiles percentiles(std::vector<double> v, std::size_t missed)
+{
+  Percentiles rv;
+  rv.count = v.size();
+  rv.missed = missed;
+  if (v.empty()) return rv;
+  std::sort(v.begin(), v.end());
+  auto at = [&v](double q)
+  {
+    std::size_t k = (std::size_t)(std::ceil(q * (double)(v.size())));
+    return 1.0e3 * v[(k > 0) ? k - 1 : 0];
+  };
+  rv.p50 = at(0.5);
+  rv.p99 = at(0.99);
+  rv.p999 = at(0.999);
+  rv.max = 1.0e3 * v.back();
+  return rv;
+}
+
+class LatencyBench
+{
+public:
+  LatencyBench(const Options &opt, Driver &drv, Run &run, mock::MockTmsvr &svr)
+    : _opt(opt), _drv(drv), _run(run), _svr(svr) {}
+
+  bool run_vel(bool packed);
+  bool run_ptp(bool packed);
+  void report(const std::string &mode, const std::string &path, bool &first);
+  bool run_restart(bool &first);
+
+private:
+  // wait for n acks that are not samples, counted from reset_other_acks()
+  void reset_other_acks();
+  bool wait_other_acks(std::size_t n);
+  // time until a feedback callback after the call, < 0: none in timeout
+  double wait_feedback(std::size_t after);
+  void print(const std::string &mode, const std::string &path, const char *stage,
+    const Percentiles &p, bool &first);
+
+  // start a run of count samples
+  void begin(bool vel);
+  // a sample and its call time, then its send time (false: send failed, run ended)
+  std::size_t record(double base, double target);
+  bool sent(std::size_t idx, bool ok);
+  void end();
+
+  const Options &_opt;
+  Driver &_drv;
+  Run &_run;
+  mock::MockTmsvr &_svr;
+};
+
+void LatencyBench::reset_other_acks()
+{
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  _run.other_acks = 0;
+}
+bool LatencyBench::wait_other_acks(std::size_t n)
+{
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  return _run.cv.wait_for(lck, std::chrono::duration<double>(_opt.timeout),
+    [this, n] { return _run.other_acks >= n; });
+}
+
+void LatencyBench::begin(bool vel)
+{
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  _run.samples.assign(_opt.warmup + _opt.count, Sample());
+  _run.sent = 0;
+  _run.acked = 0;
+  _run.pending = 0;
+  _run.vel = vel;
+  _run.reflect = _opt.reflect;
+  _run.t0 = clock_type::now();
+  _run.active = true;
+}
+
+std::size_t LatencyBench::record(double base, double target)
+{
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  Sample &s = _run.samples[_run.sent];
+  s.base = base;
+  s.target = target;
+  s.call = _run.now();
+  return _run.sent++;
+}
+bool LatencyBench::sent(std::size_t idx, bool ok)
+{
+  const double t = _run.now();
+  if (!ok) {
+    tmrl_ERROR_STREAM("LATENCY: send failed");
+    end();
+    return false;
+  }
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  _run.samples[idx].sent = t;
+  return true;
+}
+
+void LatencyBench::end()
+{
+  // let the last acks and frames come in
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  _run.cv.wait_for(lck, std::chrono::duration<double>(_opt.timeout),
+    [this] { return _run.acked == _run.sent && _run.pending == _run.sent; });
+  _run.active = false;
+}
+
+bool LatencyBench::run_vel(bool packed)
+{
+  const VelMode mode = VelMode::Joint;
+  reset_other_acks();
+  if (!_drv.set_vel_mode_start(mode, 0.5, 1.0) || !wait_other_acks(1)) return false;
+
+  CommandTemplate tpl = cmd::vel_mode_target_template(mode, "VModeTrgt");
+  const std::size_t n = _opt.warmup + _opt.count;
+  const double amp = 0.5, step = 0.02;
+  const int half = (int)(amp / step);
+  double prev = 0.0;
+
+  begin(true);
+  for (std::size_t k = 0; k < n; ++k) {
+    // triangle wave 0 .. amp .. -amp .. 0
+    int i = (int)((k + 1) % (std::size_t)(4 * half));
+    int j = (i <= half) ? i : (i <= 3 * half) ? 2 * half - i : i - 4 * half;
+    vector6d vel{};
+    vel[0] = step * (double)(j);
+
+    if (_opt.rate > 0.0) {
+      std::this_thread::sleep_until(_run.t0 + std::chrono::duration<double>((double)(k) / _opt.rate));
+    }
+    {
+      std::unique_lock<std::mutex> lck(_run.mtx);
+      _run.cv.wait_for(lck, std::chrono::duration<double>(_opt.timeout),
+        [this] { return _run.sent - _run.acked < _opt.inflight; });
+    }
+    if (packed) tpl.render(vel);
+
+    // recorded first, the ack can be back before the send returns
+    std::size_t idx = record(prev, vel[0]);
+    bool ok = packed ? _drv.tmsct.send_packed(tpl.packet()) : _drv.set_vel_mode_target(mode, vel);
+    if (!sent(idx, ok)) return false;
+    prev = vel[0];
+  }
+  end();
+
+  reset_other_acks();
+  _drv.set_vel_mode_target(mode, vector6d{});
+  _drv.set_vel_mode_stop();
+  wait_other_acks(2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  return true;
+}
+
+bool LatencyBench::run_ptp(bool packed)
+{
+  const std::size_t n = _opt.warmup + _opt.count;
+  const double step = 0.02;
+  double home = 0.0;
+  {
+    std::unique_lock<std::mutex> lck(_run.mtx);
+    home = _run.angle;
+  }
+  double prev = home;
+
+  begin(false);
+  for (std::size_t k = 0; k < n; ++k) {
+    vector6d angs{};
+    angs[0] = (k % 2 == 0) ? home + step : home;
+
+    if (_opt.rate > 0.0) {
+      std::this_thread::sleep_until(_run.t0 + std::chrono::duration<double>((double)(k) / _opt.rate));
+    }
+    comm::vectorXbyte bytes;
+    if (packed) {
+      comm::TmsctPacket pack;
+      pack.set_script("PTPJ", cmd::PTP_J(angs, 100, 0.02, 0, false)).pack(bytes);
+    }
+
+    std::size_t idx = record(prev, angs[0]);
+    bool ok = packed ? _drv.tmsct.send_packed(bytes.data(), bytes.size()) :
+      _drv.set_joint_pos_PTP(angs, 100, 0.02, 0, false);
+    if (!sent(idx, ok)) return false;
+
+    // one motion at a time, wait until it settled
+    std::unique_lock<std::mutex> lck(_run.mtx);
+    const double target = angs[0];
+    _run.cv.wait_for(lck, std::chrono::duration<double>(_opt.timeout), [this, target]
+    {
+      return _run.acked == _run.sent && std::fabs(_run.angle - target) < 1.0e-4 && std::fabs(_run.speed) < 1.0e-4;
+    });
+    prev = target;
+  }
+  end();
+  return true;
+}
+
+void LatencyBench::report(const std::string &mode, const std::string &path, bool &first)
+{
+  std::vector<double> send, ack, reflect;
+  std::size_t send_missed = 0, ack_missed = 0, reflect_missed = 0, errors = 0;
+  for (std::size_t i = _opt.warmup; i < _run.samples.size(); ++i) {
+    const Sample &s = _run.samples[i];
+    if (s.call < 0.0) {
+      ++send_missed;
+      ++ack_missed;
+      ++reflect_missed;
+      continue;
+    }
+    if (s.sent >= 0.0) send.push_back(s.sent - s.call); else ++send_missed;
+    if (s.ack >= 0.0) ack.push_back(s.ack - s.call); else ++ack_missed;
+    if (s.reflect >= 0.0) reflect.push_back(s.reflect - s.call); else ++reflect_missed;
+    if (s.error) ++errors;
+  }
+  if (errors) tmrl_ERROR_STREAM("LATENCY: " << mode << "/" << path << ", " << errors << " commands answered ERROR");
+
+  const char *stages[3] = { "send", "ack", "reflect" };
+  Percentiles ps[3] = {
+    percentiles(send, send_missed), percentiles(ack, ack_missed), percentiles(reflect, reflect_missed)
+  };
+  for (int k = 0; k < 3; ++k) { print(mode, path, stages[k], ps[k], first); }
+}
+
+void LatencyBench::print(const std::string &mode, const std::string &path, const char *stage,
+  const Percentiles &p, bool &first)
+{
+  if (_opt.format == "json") {
+    std::printf("%s  {\"mode\": \"%s\", \"path\": \"%s\", \"stage\": \"%s\", \"count\": %zu, \"missed\": %zu, "
+      "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"p999_ms\": %.4f, \"max_ms\": %.4f}",
+      first ? "" : ",\n", mode.c_str(), path.c_str(), stage, p.count, p.missed, p.p50, p.p99, p.p999, p.max);
+  }
+  else {
+    std::printf("%-7s %-7s %-9s %8zu %7zu %10.3f %10.3f %10.3f %10.3f\n",
+      mode.c_str(), path.c_str(), stage, p.count, p.missed, p.p50, p.p99, p.p999, p.max);
+  }
+  first = false;
+  std::fflush(stdout);
+}
+
+double LatencyBench::wait_feedback(std::size_t after)
+{
+  const auto t0 = clock_type::now();
+  std::unique_lock<std::mutex> lck(_run.mtx);
+  if (!_run.cv.wait_for(lck, std::chrono::duration<double>(_opt.timeout + 5.0),
+    [this, after] { return _run.feedbacks > after; })) {
+    return -1.0;
+  }
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+bool LatencyBench::run_restart(bool &first)
+{
+  std::vector<double> halt, start, feedback, reconnect;
+  std::size_t start_missed = 0, feedback_missed = 0, reconnect_missed = 0;
+
+  for (std::size_t k = 0; k < _opt.restarts; ++k) {
+    auto t0 = clock_type::now();
+    _drv.halt();
+    auto t1 = clock_type::now();
+    bool ok = _drv.start();
+    auto t2 = clock_type::now();
+    halt.push_back(std::chrono::duration<double>(t1 - t0).count());
+    if (ok) start.push_back(std::chrono::duration<double>(t2 - t1).count()); else ++start_missed;
+
+    std::size_t n = 0;
+    {
+      std::unique_lock<std::mutex> lck(_run.mtx);
+      n = _run.feedbacks;
+    }
+    double t = wait_feedback(n);
+    if (t >= 0.0) feedback.push_back(std::chrono::duration<double>(t2 - t1).count() + t); else ++feedback_missed;
+
+    // client side reconnect, done when the mock accepted the new connection
+    // and a frame came after that
+    const std::size_t clients = _svr.stats().clients;
+    t0 = clock_type::now();
+    _drv.tmsvr.set_reconnet();
+    while (_svr.stats().clients == clients &&
+      clock_type::now() - t0 < std::chrono::duration<double>(_opt.timeout + 5.0)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    {
+      std::unique_lock<std::mutex> lck(_run.mtx);
+      n = _run.feedbacks;
+    }
+    if (wait_feedback(n) >= 0.0 && _svr.stats().clients > clients) {
+      reconnect.push_back(std::chrono::duration<double>(clock_type::now() - t0).count());
+    }
+    else {
+      ++reconnect_missed;
+    }
+  }
+  print("restart", "-", "halt", percentiles(halt, 0), first);
+  print("restart", "-", "start", percentiles(start, start_missed), first);
+  print("restart", "-", "feedback", percentiles(feedback, feedback_missed), first);
+  print("restart", "-", "reconnect", percentiles(reconnect, reconnect_missed), first);
+  return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string val = (i + 1 < argc) ? argv[i + 1] : "";
+    if (arg == "--mode") { opt.mode = val; ++i; }
+    else if (arg == "--path") { opt.path = val; ++i; }
+    else if (arg == "--count") { opt.count = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--warmup") { opt.warmup = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--rate") { opt.rate = std::atof(val.c_str()); ++i; }
+    else if (arg == "--inflight") { opt.inflight = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--feedback-rate") { opt.feedback_rate = std::atof(val.c_str()); ++i; }
+    else if (arg == "--vjog-step") { opt.vjog_step = std::atof(val.c_str()); ++i; }
+    else if (arg == "--reflect") { opt.reflect = std::atof(val.c_str()); ++i; }
+    else if (arg == "--timeout") { opt.timeout = std::atof(val.c_str()); ++i; }
+    else if (arg == "--restarts") { opt.restarts = (std::size_t)(std::atol(val.c_str())); ++i; }
+    else if (arg == "--ip") { opt.ip = val; ++i; }
+    else if (arg == "--format") { opt.format = val; ++i; }
+    else {
+      std::printf("usage: %s [--mode vel|ptp|restart|all] [--path driver|packed|all] [--count n] [--warmup n]"
+        " [--rate hz] [--inflight n] [--feedback-rate hz] [--vjog-step sec] [--reflect frac]"
+        " [--timeout sec] [--restarts n] [--ip ip] [--format text|json]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (opt.inflight == 0) opt.inflight = 1;
+  utils::get_logger().set_level(utils::logger::ERROR);
+
+  mock::MockTmsvr::Config svr_config;
+  svr_config.ip = opt.ip;
+  svr_config.rate = opt.feedback_rate;
+  mock::MockTmsvr svr(svr_config);
+  mock::MockTmsct::Config sct_config;
+  sct_config.ip = opt.ip;
+  sct_config.vjog_step = opt.vjog_step;
+  mock::MockTmsct sct(sct_config, &svr);
+  if (!svr.start() || !sct.start()) return 1;
+
+  Run run;
+  TmsvrClient svr_client(opt.ip);
+  TmsctClient sct_client(opt.ip);
+  svr_client.set_feedback_callback([&run](const RobotState &rs) { on_feedback(run, rs); });
+  sct_client.set_tmsct_callback([&run](const comm::TmsctPacket &pack) { on_ack(run, pack); });
+  Driver drv(svr_client, sct_client);
+  if (!svr_client.start(1000) || !sct_client.start(1000)) {
+    std::printf("can not connect to the mock controller on %s\n", opt.ip.c_str());
+    return 1;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  if (opt.format == "json") std::printf("[\n");
+  else std::printf("%-7s %-7s %-9s %8s %7s %10s %10s %10s %10s\n",
+    "mode", "path", "stage", "count", "missed", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+
+  LatencyBench bench(opt, drv, run, svr);
+  bool first = true;
+  bool ok = true;
+  for (const char *mode : { "vel", "ptp" }) {
+    if (opt.mode != "all" && opt.mode != mode) continue;
+    for (const char *path : { "driver", "packed" }) {
+      if (opt.path != "all" && opt.path != path) continue;
+      bool packed = (std::string(path) == "packed");
+      bool rb = (std::string(mode) == "vel") ? bench.run_vel(packed) : bench.run_ptp(packed);
+      if (!rb) {
+        tmrl_ERROR_STREAM("LATENCY: " << mode << "/" << path << " failed");
+        ok = false;
+        continue;
+      }
+      bench.report(mode, path, first);
+    }
+  }
+  if ((opt.mode == "all" || opt.mode == "restart") && !bench.run_restart(first)) ok = false;
+  if (opt.format == "json") std::printf("\n]\n");
+
+  sct_client.stop();
+  svr_client.stop();
+  // the stream reads the joint states of sct
+  svr.stop();
+  sct.stop();
+  return ok ? 0 : 1;
+}
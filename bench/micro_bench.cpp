@@ -0,0 +1,437 @@
+#include "bench.h"
+
+#include "tmrl/comm/packet.h"
+#include "tmrl/comm/capture.h"
+#include "tmrl/driver/driver.h"
+#include "tmrl/driver/pvt_point.h"
+#include "tmrl/driver/pvt_retime.h"
+#include "tmrl/driver/pvt_simplify.h"
+#include "tmrl/driver/sim_fleet.h"
+#include "tmrl/mock/mock_tmsvr.h"
+#include "tmrl/utils/spsc_queue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Microbenchmarks of the packet codecs, state decoding, command formatting
+ * and trajectory code, on a real data-table layout and 10k-point trajectories.
+ *
+ * tmr_micro_bench [--filter substr] [--min-time sec] [--format text|json|csv]
+ */
+
+using namespace tmrl;
+using namespace tmrl::driver;
+
+namespace
+{
+
+// smooth joint motion, 4 ms per point
+PvtTraj make_traj(std::size_t n)
+{
+  PvtTraj pvts;
+  pvts.mode = PvtMode::Joint;
+  pvts.total_time = 0.0;
+  for (std::size_t k = 1; k <= n; ++k) {
+    PvtPoint p;
+    p.time = 0.004;
+    p.positions.resize(6);
+    p.velocities.resize(6);
+    double t = 0.004 * (double)(k);
+    for (std::size_t i = 0; i < 6; ++i) {
+      double w = 0.3 + 0.1 * (double)(i);
+      p.positions[i] = 0.8 * std::sin(w * t + (double)(i));
+      p.velocities[i] = 0.8 * w * std::cos(w * t + (double)(i));
+    }
+    if (k == n) std::fill(p.velocities.begin(), p.velocities.end(), 0.0);
+    pvts.points.push_back(p);
+    pvts.total_time += p.time;
+  }
+  return pvts;
+}
+
+// a TmsctClient writing into a socketpair, drained by a reader thread
+struct SinkClient {
+  SinkClient() : sct("127.0.0.1")
+  {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) return;
+    sct.client().socket_fd(fds[1]);
+    reader = std::thread([this]
+    {
+      char buf[0x10000];
+      while (::read(fds[0], buf, sizeof(buf)) > 0) {}
+    });
+  }
+  ~SinkClient()
+  {
+    sct.client().socket_fd(-1);
+    ::close(fds[1]);
+    if (reader.joinable()) reader.join();
+    ::close(fds[0]);
+  }
+
+  TmsctClient sct;
+  int fds[2] = { -1, -1 };
+  std::thread reader;
+};
+
+std::string frame_content()
+{
+  mock::MockTmsvr svr;
+  vector6d pos{ 0.1, -0.2, 1.3, 0.4, -1.5, 0.6 }, vel{ 0.01, 0.02, 0.03, 0.04, 0.05, 0.06 };
+  svr.set_joint_states(pos, vel);
+  return svr.content();
+}
+
+void add_packet_cases()
+{
+  const std::string script = cmd::pvt_point(PvtMode::Joint, make_traj(1).points[0]);
+  const std::string content = frame_content();
+
+  comm::vectorXbyte sct_bytes;
+  comm::TmsctPacket sct;
+  sct.set_script("bench", script).pack(sct_bytes);
+  comm::vectorXbyte svr_bytes;
+  comm::TmsvrPacket svr;
+  svr.set_content("bench", comm::TmsvrPacket::Mode::BINARY, content).pack(svr_bytes);
+
+  bench::add("packet/pack_tmsct_pvt_point", sct_bytes.size(), [script](std::size_t n)
+  {
+    comm::TmsctPacket pack;
+    comm::vectorXbyte bytes;
+    for (std::size_t i = 0; i < n; ++i) {
+      pack.set_script("bench", script);
+      pack.pack(bytes);
+      bench::keep(bytes.data());
+    }
+  });
+  bench::add("packet/unpack_tmsct", sct_bytes.size(), [sct_bytes](std::size_t n)
+  {
+    comm::TmsctPacket pack;
+    for (std::size_t i = 0; i < n; ++i) {
+      pack.unpack(sct_bytes.data(), sct_bytes.size());
+      bench::keep(pack.script().data());
+    }
+  });
+  bench::add("packet/pack_tmsvr_frame", svr_bytes.size(), [content](std::size_t n)
+  {
+    comm::TmsvrPacket pack;
+    comm::vectorXbyte bytes;
+    for (std::size_t i = 0; i < n; ++i) {
+      pack.set_content("bench", comm::TmsvrPacket::Mode::BINARY, content);
+      pack.pack(bytes);
+      bench::keep(bytes.data());
+    }
+  });
+  bench::add("packet/unpack_tmsvr_frame", svr_bytes.size(), [svr_bytes](std::size_t n)
+  {
+    comm::Packet pack;
+    for (std::size_t i = 0; i < n; ++i) {
+      pack.unpack(svr_bytes.data(), svr_bytes.size());
+      bench::keep(pack.data().data());
+    }
+  });
+  bench::add("tmsvr/unpack_content", svr.data().size(), [svr](std::size_t n)
+  {
+    comm::TmsvrPacket pack;
+    for (std::size_t i = 0; i < n; ++i) {
+      pack.unpack_content(svr.data().data(), svr.data().size());
+      bench::keep(pack.content().data());
+    }
+  });
+  bench::add("robot_state/deserialize", content.size(), [content](std::size_t n)
+  {
+    RobotState rs;
+    rs.deserialize(content.data(), content.size());
+    for (std::size_t i = 0; i < n; ++i) {
+      bench::keep(rs.deserialize(content.data(), content.size()));
+    }
+  });
+}
+
+void add_format_cases()
+{
+  auto traj = std::make_shared<PvtTraj>(make_traj(10000));
+  const std::size_t traj_bytes = cmd::pvt_traj(*traj).size();
+  auto pool = std::make_shared<utils::ThreadPool>();
+
+  bench::add("cmd/pvt_traj_10k", traj_bytes, [traj](std::size_t n)
+  {
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::pvt_traj(*traj)); }
+  });
+  bench::add("cmd/pvt_traj_10k_tolerance", cmd::pvt_traj(*traj, Tolerance()).size(), [traj](std::size_t n)
+  {
+    Tolerance tol;
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::pvt_traj(*traj, tol)); }
+  });
+  bench::add("cmd/pvt_traj_10k_pool", traj_bytes, [traj, pool](std::size_t n)
+  {
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::pvt_traj(*traj, *pool)); }
+  });
+
+  // scaling of the pool formatter on a long trajectory, pools of 1, 2, 4 ...
+  // hardware threads (the calling thread works as well)
+  auto long_traj = std::make_shared<PvtTraj>(make_traj(50000));
+  const std::size_t long_bytes = cmd::pvt_traj(*long_traj).size();
+  bench::add("cmd/pvt_traj_50k", long_bytes, [long_traj](std::size_t n)
+  {
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::pvt_traj(*long_traj)); }
+  });
+  const std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t k = 1; ; k *= 2) {
+    const std::size_t threads = std::min(k, hw);
+    auto pool_k = std::make_shared<utils::ThreadPool>(threads);
+    bench::add("cmd/pvt_traj_50k_pool_" + std::to_string(threads), long_bytes, [long_traj, pool_k](std::size_t n)
+    {
+      for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::pvt_traj(*long_traj, *pool_k)); }
+    });
+    if (threads == hw) break;
+  }
+  bench::add("cmd/ptp_j", 0, [](std::size_t n)
+  {
+    vector6d q{ 0.1, -0.2, 1.3, 0.4, -1.5, 0.6 };
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::PTP_J(q, 50, 0.2, 0, false)); }
+  });
+  bench::add("cmd/vel_mode_target", 0, [](std::size_t n)
+  {
+    vector6d v{ 0.1, -0.2, 0.3, 0.4, -0.5, 0.6 };
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cmd::vel_mode_target(VelMode::Joint, v)); }
+  });
+  bench::add("template/vel_mode_target", 0, [](std::size_t n)
+  {
+    CommandTemplate tpl = cmd::vel_mode_target_template(VelMode::Joint, "vjog");
+    std::array<double, 6> v{ { 0.1, -0.2, 0.3, 0.4, -0.5, 0.6 } };
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(tpl.render(v).data()); }
+  });
+  bench::add("template/pvt_point", 0, [](std::size_t n)
+  {
+    CommandTemplate tpl = cmd::pvt_point_template(PvtMode::Joint, "pvt");
+    std::array<double, 13> v{ { 0.1, -0.2, 0.3, 0.4, -0.5, 0.6, 0.01, 0.02, 0.03, 0.04, 0.05, 0.06, 0.004 } };
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(tpl.render(v).data()); }
+  });
+  bench::add("cache/pvt_traj_10k_hit", traj_bytes, [traj](std::size_t n)
+  {
+    ScriptCache cache;
+    cache.pvt_traj_packet(*traj, "pvt");
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(cache.pvt_traj_packet(*traj, "pvt")); }
+  });
+  // Driver::set_pvt_traj send path, format and pack on a miss vs the cached packet
+  bench::add("cache/pvt_traj_10k_send_miss", traj_bytes, [traj](std::size_t n)
+  {
+    SinkClient sink;
+    ScriptCache cache;
+    for (std::size_t i = 0; i < n; ++i) {
+      cache.clear();
+      bench::keep(sink.sct.send_packed(*cache.pvt_traj_packet(*traj, "pvt")));
+    }
+  });
+  bench::add("cache/pvt_traj_10k_send_hit", traj_bytes, [traj](std::size_t n)
+  {
+    SinkClient sink;
+    ScriptCache cache;
+    cache.pvt_traj_packet(*traj, "pvt");
+    for (std::size_t i = 0; i < n; ++i) {
+      bench::keep(sink.sct.send_packed(*cache.pvt_traj_packet(*traj, "pvt")));
+    }
+  });
+}
+
+void add_traj_cases()
+{
+  auto traj = std::make_shared<PvtTraj>(make_traj(10000));
+
+  bench::add("driver/cubic_interp", 0, [traj](std::size_t n)
+  {
+    TmsvrClient svr("127.0.0.1");
+    TmsctClient sct("127.0.0.1");
+    Driver drv(svr, sct);
+    PvtPoint p;
+    const PvtPoint &p0 = traj->points[0], &p1 = traj->points[1];
+    for (std::size_t i = 0; i < n; ++i) {
+      drv.cubic_interp(p, p0, p1, 0.001 * (double)(i & 3));
+      bench::keep(p.positions.data());
+    }
+  });
+  bench::add("pvt_point/cubic_interp6", 0, [traj](std::size_t n)
+  {
+    PvtPoint6 p0 = to_pvt_point<6>(traj->points[0]), p1 = to_pvt_point<6>(traj->points[1]);
+    vector6d pos, vel;
+    for (std::size_t i = 0; i < n; ++i) {
+      cubic_interp(pos, vel, p0, p1, 0.001 * (double)(i & 3));
+      bench::keep(pos);
+    }
+  });
+  bench::add("spline/build_10k", 0, [traj](std::size_t n)
+  {
+    PvtSpline spline;
+    for (std::size_t i = 0; i < n; ++i) {
+      spline.build(*traj);
+      bench::keep(spline.duration());
+    }
+  });
+  bench::add("spline/evaluate_sorted", 0, [traj](std::size_t n)
+  {
+    PvtSpline spline(*traj);
+    const double dt = spline.duration() / 1.0e5;
+    double pos[6], vel[6];
+    std::size_t hint = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      spline.evaluate(dt * (double)(i % 100000), pos, vel, hint);
+      bench::keep(pos);
+    }
+  });
+  bench::add("spline/evaluate_batch_sorted", 0, [traj](std::size_t n)
+  {
+    // 1000 samples per call, the same times as evaluate_sorted, per sample
+    PvtSpline spline(*traj);
+    const double dt = spline.duration() / 1.0e5;
+    std::vector<double> times(1000), pos(6 * 1000), vel(6 * 1000);
+    for (std::size_t i = 0; i < n; i += times.size()) {
+      for (std::size_t s = 0; s < times.size(); ++s) { times[s] = dt * (double)((i + s) % 100000); }
+      spline.evaluate(times.data(), std::min(times.size(), n - i), pos.data(), vel.data());
+      bench::keep(pos.data());
+    }
+  });
+  bench::add("simplify/10k", 0, [traj](std::size_t n)
+  {
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(simplify_pvt_traj(*traj, 1.0e-4)); }
+  });
+  bench::add("retime/path_50", 0, [](std::size_t n)
+  {
+    JointPath<6> path;
+    for (int k = 0; k < 50; ++k) {
+      std::array<double, 6> q;
+      for (std::size_t i = 0; i < 6; ++i) { q[i] = 0.5 * std::sin(0.2 * k + (double)(i)); }
+      path.push_back(q);
+    }
+    JointLimits<6> lim;
+    lim.vel.fill(3.0);
+    lim.acc.fill(10.0);
+    lim.jerk.fill(100.0);
+    RetimeStats st;
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(retime_pvt_traj<6>(path, lim, &st)); }
+    bench::counter("gained_pct", 100.0 * st.time_gained() / st.uniform_time);
+  });
+
+  // 64 random walks of 50 waypoints, steps up to 0.3 rad per joint, the
+  // counters are the time gained over uniform segment times, in % of it
+  auto paths = std::make_shared<std::vector<JointPath<6>>>(64);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> step(-0.3, 0.3);
+  for (auto &path : *paths) {
+    std::array<double, 6> q{};
+    for (int k = 0; k < 50; ++k) {
+      for (auto &value : q) { value += step(rng); }
+      path.push_back(q);
+    }
+  }
+  auto retime_counters = [](const std::vector<RetimeStats> &stats)
+  {
+    double sum = 0.0, lo = 100.0, hi = 0.0;
+    for (const RetimeStats &st : stats) {
+      double gained = 100.0 * st.time_gained() / st.uniform_time;
+      sum += gained;
+      lo = std::min(lo, gained);
+      hi = std::max(hi, gained);
+    }
+    bench::counter("gained_mean_pct", sum / (double)(stats.size()));
+    bench::counter("gained_min_pct", lo);
+    bench::counter("gained_max_pct", hi);
+  };
+  bench::add("retime/random_paths_64", 0, [paths, retime_counters](std::size_t n)
+  {
+    JointLimits<6> lim;
+    lim.vel.fill(3.0);
+    lim.acc.fill(10.0);
+    lim.jerk.fill(100.0);
+    std::vector<RetimeStats> stats(paths->size());
+    for (std::size_t i = 0; i < n; ++i) {
+      for (std::size_t k = 0; k < paths->size(); ++k) {
+        bench::keep(retime_pvt_traj<6>((*paths)[k], lim, &stats[k]));
+      }
+    }
+    retime_counters(stats);
+  });
+  auto pool = std::make_shared<utils::ThreadPool>();
+  bench::add("retime/random_paths_64_pool", 0, [paths, retime_counters, pool](std::size_t n)
+  {
+    JointLimits<6> lim;
+    lim.vel.fill(3.0);
+    lim.acc.fill(10.0);
+    lim.jerk.fill(100.0);
+    std::vector<RetimeStats> stats;
+    for (std::size_t i = 0; i < n; ++i) { bench::keep(retime_pvt_trajs<6>(*paths, lim, *pool, &stats)); }
+    retime_counters(stats);
+  });
+}
+
+void add_runtime_cases()
+{
+  bench::add("spsc/push_pop", 0, [](std::size_t n)
+  {
+    utils::SpscQueue<PvtPoint6> q(1024);
+    PvtPoint6 p{}, out;
+    for (std::size_t i = 0; i < n; ++i) {
+      q.push(p);
+      q.pop(out);
+      bench::keep(out);
+    }
+  });
+  bench::add("sim/tick_streaming", 0, [](std::size_t n)
+  {
+    RobotState rs;
+    utils::VirtualClock clock;
+    SimPvtMotion sim(rs, clock);
+    sim.enter(vectorXd(6, 0.0));
+    PvtPoint p{ 0.004, vectorXd(6, 0.0), vectorXd(6, 0.0) };
+    for (std::size_t i = 0; i < n; ++i) {
+      if (sim.point_count() < 4) {
+        p.positions[0] = 0.001 * (double)(i);
+        sim.add_point(p);
+      }
+      sim.step(1);
+    }
+  });
+  bench::add("fleet/tick_20_robots", 0, [](std::size_t n)
+  {
+    SimFleet fleet(20);
+    PvtTraj pvts = make_traj(2000);
+    for (std::size_t r = 0; r < fleet.size(); ++r) { fleet.add_traj(r, pvts); }
+    for (std::size_t i = 0; i < n; ++i) {
+      if (fleet.moving_count() == 0) {
+        for (std::size_t r = 0; r < fleet.size(); ++r) { fleet.add_traj(r, pvts); }
+      }
+      fleet.step(1);
+      bench::keep(fleet.positions(0)[0]);
+    }
+  });
+  const std::string chunk = frame_content();
+  bench::add("capture/write_frame", chunk.size(), [chunk](std::size_t n)
+  {
+    // reopened every 16k frames so the pending buffer never fills up and drops,
+    // the writer thread's time is included
+    comm::Capture capture;
+    capture.open("/dev/null");
+    for (std::size_t i = 0; i < n; ++i) {
+      capture.write(chunk.data(), chunk.size());
+      if ((i & 0x3fff) == 0x3fff) capture.open("/dev/null");
+    }
+    capture.close();
+  });
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  add_packet_cases();
+  add_format_cases();
+  add_traj_cases();
+  add_runtime_cases();
+  return bench::main(argc, argv);
+}
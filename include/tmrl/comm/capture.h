@@ -0,0 +1,133 @@
+#pragma once
+
+#include "tmrl/comm/client.h"
+
+#include <string>
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+namespace tmrl
+{
+namespace comm
+{
+
+/*
+ * Capture file of received byte chunks, for replaying a connection.
+ *
+ * header: "TMRLCAP1", u32 flags
+ * record: u64 time (ns from open), u32 len, u8 kind, u32 stored len, stored bytes
+ *
+ * kind 0 stores the chunk as is. With DELTA a chunk as long as the one before
+ * is stored as its xor with that chunk, zero runs skipped (kind 1):
+ * repeated (varint zeros, varint n, n bytes) up to len.
+ * Streamed feedback frames differ in a few values, so this is compact.
+ */
+class Capture
+{
+public:
+  enum Flags { DELTA = 1 };
+
+  struct Stats {
+    std::size_t chunks = 0;
+    std::size_t bytes = 0;
+    std::size_t file_bytes = 0;
+    std::size_t dropped = 0;
+  };
+
+  Capture() {}
+  ~Capture() { close(); }
+
+  Capture(const Capture &) = delete;
+  Capture & operator=(const Capture &) = delete;
+
+  // start a writer thread, max_pending: bytes queued before chunks are dropped
+  bool open(const std::string &path, bool delta = true, std::size_t max_pending = 0x4000000);
+  void close();
+  bool is_open() const { return _keep_alive; }
+
+  /*
+   * From the receive thread: copies the chunk and its time to the pending
+   * buffer, the file is written by the writer thread.
+   */
+  void write(const char *bytes, std::size_t len);
+
+  Stats stats() const;
+
+private:
+  void run();
+  void write_record(const char *rec, std::size_t len);
+
+  std::FILE *_fp = nullptr;
+  unsigned _flags = 0;
+  std::size_t _max_pending = 0;
+  std::chrono::steady_clock::time_point _t0;
+
+  std::thread _thd;
+  std::atomic<bool> _keep_alive{false};
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  // records of write(), swapped out by the writer thread
+  std::string _pending;
+
+  // writer thread
+  std::string _prev;
+  std::string _enc;
+
+  std::atomic<std::size_t> _chunks{0};
+  std::atomic<std::size_t> _bytes{0};
+  std::atomic<std::size_t> _file_bytes{0};
+  std::atomic<std::size_t> _dropped{0};
+};
+
+class CaptureReader
+{
+public:
+  struct Chunk {
+    long long time_ns = 0;
+    std::string bytes;
+  };
+
+  CaptureReader() {}
+  ~CaptureReader() { close(); }
+
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader & operator=(const CaptureReader &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+
+  // false at the end of the file or on a broken record
+  bool next(Chunk &chunk);
+
+private:
+  std::FILE *_fp = nullptr;
+  unsigned _flags = 0;
+  std::string _prev;
+  std::string _stored;
+};
+
+struct ReplayStats {
+  std::size_t chunks = 0;
+  std::size_t bytes = 0;
+  std::size_t packets = 0;
+  // spins that ended without a complete packet
+  std::size_t partial = 0;
+  // time span of the capture and of the replay (s)
+  double duration = 0.0;
+  double elapsed = 0.0;
+};
+
+/*
+ * Push a capture through client: every chunk goes into a local socket read by
+ * Client::receiver_spin_once, the packets go to receive() as in the client thread.
+ * paced: each chunk at its capture time, else as fast as possible.
+ * The client must not be started.
+ */
+bool replay_capture(const std::string &path, ClientThread &client, bool paced, ReplayStats *stats = nullptr);
+
+}
+}
@@ -2,7 +2,10 @@
 
 #include "tmrl/comm/packet.h"
 
+#include <atomic>
+#include <mutex>
 #include <thread>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 
@@ -24,6 +27,34 @@ enum class RetCode
 };
 
 class RecvBuf;
+class Capture;
+class IoLoop;
+
+/*
+ * Wakes a select from any thread: an eventfd (self-pipe off linux), none on
+ * windows (fd() < 0, wait() sleeps in 10 ms steps)
+ */
+class WakeFd
+{
+public:
+  WakeFd();
+  ~WakeFd();
+
+  WakeFd(const WakeFd &) = delete;
+  WakeFd & operator=(const WakeFd &) = delete;
+
+  int fd() const { return _rfd; }
+  void wake();
+  // true if woken since the last drain
+  bool drain();
+  // wait up to timeout_ms, true if woken; the wake is consumed
+  bool wait(int timeout_ms);
+
+private:
+  // eventfd: both the same, pipe: read and write end
+  int _rfd = -1;
+  int _wfd = -1;
+};
 
 class Client
 {
@@ -31,9 +62,31 @@ public:
   explicit Client(const std::string &ip, unsigned short port, size_t buffer_size);
   /*virtual*/ ~Client();
 
+  // gives up after timeout_ms (<= 0: waits as long as the system does) or on wake()
   bool Connect(int timeout_ms = 0);
   void Close();
 
+  /*
+   * Interrupt receiver_spin_once (returns NOTREADY), Connect and wait_wake
+   * from any thread, see WakeFd. On windows the waits run out their timeout.
+   */
+  void wake() { _wake.wake(); }
+  // wait up to timeout_ms, true if woken; the wake is consumed
+  bool wait_wake(int timeout_ms) { return _wake.wait(timeout_ms); }
+  // drop a pending wake
+  void clear_wake() { _wake.drain(); }
+  // to select on next to the socket, < 0: none
+  int wake_fd() const { return _wake.fd(); }
+
+  /*
+   * TCP keepalive (idle_ms <= 0: off) and TCP_USER_TIMEOUT, the longest time
+   * sent bytes may stay unacknowledged (<= 0: system default). Applied on
+   * Connect and right away when connected; the times are rounded to what
+   * the system supports (keepalive in s, none but SO_KEEPALIVE on windows).
+   */
+  void set_keepalive(int idle_ms, int interval_ms, int count);
+  void set_user_timeout(int timeout_ms);
+
   const std::string & ip_address() const { return _ip; }
 
   bool is_connected() const { return (_sockfd > 0); }
@@ -58,12 +111,16 @@ public:
 
   RetCode receiver_spin_once(int timeval_ms, int *n = NULL);
 
+  // copy every received chunk to capture, NULL to stop
+  void set_capture(Capture *capture);
+
   std::vector<Packet> &packet_vector() { return _packet_vec; }
 
   Packet & last_packet() { return _packet_vec.back(); }
 
 private:
   int _connect(int sockfd, const char *ip, unsigned short port, int timeout_ms);
+  void _set_link_opts();
 
   RecvBuf       *_recv;
   std::string    _ip;
@@ -74,6 +131,11 @@ private:
   bool           _recv_ready;
   bool           _ok_last;
   int            _incomplete_cnt;
+  WakeFd         _wake;
+  int            _keepalive_idle_ms = 0;
+  int            _keepalive_interval_ms = 0;
+  int            _keepalive_count = 0;
+  int            _user_timeout_ms = 0;
 
   std::vector<Packet> _packet_vec;
 };
@@ -82,39 +144,117 @@ class ClientThread
 {
 public:
   using IsOkPredicate = std::function<bool()>;
+  using StallCallback = std::function<void(double gap)>;
 
   explicit ClientThread(const std::string &ip, unsigned short port, size_t buffer_size, bool cyclic = false);
   virtual ~ClientThread();
 
   const Client & client() const { return _client; }
+  Client & client() { return _client; }
 
   bool start(int timeout_ms);
   bool start();
   void stop();
 
+  /*
+   * Wait up to timeout_ms until the thread receives on a connection (after
+   * start or a reconnect), true if it does
+   */
+  bool wait_connected(int timeout_ms);
+
   void set_is_ok_predicate(IsOkPredicate is_ok_pred) { _isOk = is_ok_pred; }
 
+  /*
+   * Reconnect: the first retry right away, then after 50 ms doubling up to
+   * the timeval (< 0: no reconnect). The delay starts over once a connection
+   * got a packet. timeout: of each connect attempt.
+   */
   void set_reconnect_timeval(double sec) { _reconnect_timeval_ms = (int)(1000.0 * sec); }
   void set_reconnect_timeout(double sec) { _reconnect_timeout_ms = (int)(1000.0 * sec); }
+  double reconnect_timeout() const { return 0.001 * _reconnect_timeout_ms; }
 
-  void set_reconnet() { _reconnect = true; }
+  // close the connection and reconnect now, from any thread
+  void set_reconnet() { _reconnect = true; _client.wake(); }
+
+  /*
+   * Watchdog of a cyclic stream, set before start. It learns the period of
+   * the packets passed to watchdog_kick() (kept over reconnects) and is
+   * armed by the first packet of a connection. After `periods` periods
+   * without a packet (at least min_sec) it calls the stall callback with
+   * the gap (s) from the client thread, closes the connection and
+   * reconnects at once. Also turns on TCP keepalive and a matching
+   * TCP_USER_TIMEOUT. periods <= 0: off.
+   */
+  void set_stall_periods(double periods, double min_sec = 0.02);
+  void set_stall_callback(StallCallback cb) { _stallCallback = cb; }
+  // learned period (s), 0 until known
+  double stream_period() const { return _wd_period_pub; }
+
+  /*
+   * Hand the packets of the last _client.receiver_spin_once to receive(),
+   * to drive the client without its thread (capture replay)
+   */
+  bool dispatch() { return receive(_client.packet_vector()); }
 
 protected:
+  friend class IoLoop;
+
   virtual bool receive(const std::vector<Packet> &pack_vec) = 0;
 
+  // n cyclic packets arrived, from receive()
+  void watchdog_kick(int n = 1);
+
   void run();
   void reconnect();
+  // delay before the next connect (ms) and backoff, < 0: no reconnect
+  int reconnect_delay();
   bool isOk() { return (_keep_alive && _isOk()); }
 
+  // one connection, driven by run() or an IoLoop
+  void session_open();
+  // receive once, false: close the connection
+  bool session_spin(int timeout_ms);
+  // without receiving: false on a stall or a silent cyclic stream
+  bool session_check(std::chrono::steady_clock::time_point now);
+  // until session_check may close the connection (ms)
+  int session_timeout_ms(std::chrono::steady_clock::time_point now) const;
+  void session_close();
+  void set_connected(bool connected);
+
   Client _client;
   std::string _hdr;
   std::thread _thd;
-  bool _keep_alive = false;
+  std::atomic<bool> _keep_alive{false};
   IsOkPredicate _isOk;
   int _reconnect_timeval_ms = 3000;
   int _reconnect_timeout_ms = 1000;
-  bool _reconnect = false;
+  // delay before the next reconnect
+  int _reconnect_delay_ms = 0;
+  std::atomic<bool> _reconnect{false};
+  std::mutex _conn_mtx;
+  std::condition_variable _conn_cv;
+  bool _connected = false;
+
+  // watchdog, the state is of the client thread
+  void watchdog_reset();
+  // ms to the stall, < 0: not armed
+  int watchdog_left_ms(std::chrono::steady_clock::time_point now) const;
+
+  double _stall_periods = 0.0;
+  double _stall_min = 0.02;
+  StallCallback _stallCallback;
+  std::chrono::steady_clock::time_point _wd_last;
+  double _wd_period = 0.0;
+  int _wd_samples = 0;
+  // a packet on this connection
+  bool _wd_started = false;
+  bool _wd_armed = false;
+  std::atomic<double> _wd_period_pub{0.0};
   const bool _is_cyclic;
+  // last bytes received
+  std::chrono::steady_clock::time_point _rx_last;
+  // serving loop, no thread of its own
+  IoLoop *_loop = nullptr;
 };
 
 }
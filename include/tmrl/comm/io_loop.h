@@ -0,0 +1,72 @@
+#pragma once
+
+#include "tmrl/comm/client.h"
+
+#include <memory>
+
+namespace tmrl
+{
+namespace comm
+{
+
+/*
+ * One thread that receives for several ClientThreads in place of a thread
+ * each. The callbacks of all its clients run on it, one after another.
+ *
+ * Connects, and reconnects with the backoff and timeout of each client, run
+ * on a short lived helper thread each, so a slow connect does not hold the
+ * others. stop() on a client closes it for good, set_reconnet() works as
+ * with its own thread. Stop the loop before its clients go.
+ */
+class IoLoop
+{
+public:
+  IoLoop();
+  ~IoLoop();
+
+  IoLoop(const IoLoop &) = delete;
+  IoLoop & operator=(const IoLoop &) = delete;
+
+  // before start, the client must not be started itself
+  bool add(ClientThread &client);
+  // before start, undo add
+  bool remove(ClientThread &client);
+  std::size_t size() const { return _entries.size(); }
+
+  /*
+   * Connect all clients at once, each within timeout_ms, then serve them.
+   * times (if any) gets the connect time (s) per client in add order,
+   * < 0: not connected (reconnects in the background). false if one failed.
+   */
+  bool start(int timeout_ms, std::vector<double> *times = nullptr);
+  void stop();
+  bool is_running() const { return _keep_alive; }
+
+private:
+  enum class State { IDLE, WAIT, CONNECTING, OPEN };
+
+  struct Entry {
+    ClientThread *ct;
+    State state = State::IDLE;
+    // WAIT: connect not before
+    std::chrono::steady_clock::time_point next;
+    std::thread connector;
+    std::atomic<bool> done{false};
+    bool connected = false;
+    std::chrono::steady_clock::time_point done_at;
+  };
+
+  void run();
+  void connect(Entry &e, int timeout_ms);
+  // join a done connector and open the connection or schedule the next try
+  void finish_connect(Entry &e, std::chrono::steady_clock::time_point now);
+  void schedule(Entry &e, std::chrono::steady_clock::time_point now);
+
+  std::vector<std::unique_ptr<Entry>> _entries;
+  WakeFd _wake;
+  std::thread _thd;
+  std::atomic<bool> _keep_alive{false};
+};
+
+}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "tmrl/comm/client.h"
+
+#include <string>
+
+namespace tmrl
+{
+namespace comm
+{
+
+/*
+ * Listening TCP socket for local test servers (mock controller).
+ * Accepted sockets are plain fds, use the static helpers on them.
+ */
+class Server
+{
+public:
+  explicit Server(unsigned short port);
+  ~Server();
+
+  Server(const Server &) = delete;
+  Server & operator=(const Server &) = delete;
+
+  bool listen(const std::string &ip = "127.0.0.1", int backlog = 4);
+  void close();
+
+  bool is_listening() const { return (_sockfd > 0); }
+  unsigned short port() const { return _port; }
+
+  // fd of a new connection, -1 on timeout or error
+  int accept(int timeout_ms);
+
+  // wait until fd is readable, 1: readable, 0: timeout, -1: error
+  static int wait_readable(int fd, int timeout_ms);
+
+  static RetCode send_all(int fd, const char *bytes, size_t len);
+  static int recv_some(int fd, char *buf, size_t len);
+  static void close_fd(int fd);
+
+private:
+  unsigned short _port;
+  int _sockfd = -1;
+};
+
+}
+}
@@ -4,12 +4,25 @@
 #include "tmrl/driver/tmsct_client.h"
 #include "tmrl/driver/script_commands.h"
 #include "tmrl/driver/sim_pvt_motion.h"
+#include "tmrl/driver/pvt_spline.h"
+#include "tmrl/driver/pvt_stream.h"
+#include "tmrl/driver/pvt_session.h"
+#include "tmrl/driver/script_cache.h"
 
 namespace tmrl
 {
 namespace driver
 {
 
+// time from start to each connection (s), < 0: not connected
+struct StartTiming
+{
+  double tmsvr = -1.0;
+  double tmsct = -1.0;
+  // the whole start, stick play included
+  double total = 0.0;
+};
+
 class Driver
 {
 public:
@@ -20,6 +33,16 @@ public:
   explicit Driver(TmsvrClient &svr, TmsctClient &sct);
 
   bool start(bool stick_play = false);
+  /*
+   * Connect tmsvr and tmsct at the same time, each within timeout_ms (< 0:
+   * the reconnect timeout of the client). Feedback flows as soon as tmsvr is
+   * up. With stick_play the tmsct listen node comes up with the project, so
+   * start waits for it until the timeout.
+   */
+  bool start(bool stick_play, int timeout_ms, StartTiming *timing = nullptr);
+  // start all drivers at the same time, timings (if any) gets one per driver
+  static bool start_all(const std::vector<Driver *> &drivers, bool stick_play, int timeout_ms,
+    std::vector<StartTiming> *timings = nullptr);
 
   void halt();
 
@@ -56,10 +79,18 @@ public:
   bool set_pvt_point(PvtMode mode, const PvtPoint &point, const std::string &id = "PvtPt");
 
   bool set_pvt_traj(const PvtTraj &pvts, const std::string &id = "PvtTraj");
+  // shortest text within tol per value, see Tolerance
+  bool set_pvt_traj(const PvtTraj &pvts, const Tolerance &tol, const std::string &id = "PvtTraj");
+
+  // format long trajectories on pool in set_pvt_traj (nullptr: sequential)
+  void set_format_pool(utils::ThreadPool *pool) { _format_pool = pool; }
+  // reuse packed trajectories in set_pvt_traj (nullptr: no cache)
+  void set_script_cache(ScriptCache *cache) { _script_cache = cache; }
 
 
   bool set_vel_mode_start(VelMode mode, double timeout_zero_vel, double timeout_stop, const std::string &id = "VModeStart");
   bool set_vel_mode_stop(const std::string &id = "VModeStop");
+  // patches a cached packet, callers on other threads wait for the send
   bool set_vel_mode_target(VelMode mode, const vector6d &vel, const std::string &id = "VModeTrgt");
 
   //
@@ -69,8 +100,26 @@ public:
   bool run_pvt_traj(const PvtTraj &pvts);
   void stop_pvt_traj();
 
+  // send pvts in chunks, see PvtStream
+  bool stream_pvt_traj(const PvtTraj &pvts, const std::string &id = "PvtStream");
+  PvtStream & pvt_stream() { return _pvt_stream; }
+
+  // keep PVT mode open across trajectories, see PvtSession
+  bool open_pvt_session(PvtMode mode, const std::string &id = "PvtSession");
+  bool append_pvt_session(const PvtTraj &pvts) { return _pvt_session.append(pvts); }
+  void close_pvt_session() { _pvt_session.close(); }
+  PvtSession & pvt_session() { return _pvt_session; }
+
   void cubic_interp(PvtPoint &p, const PvtPoint &p0, const PvtPoint &p1, double t);
-  bool fake_run_pvt_traj(const PvtTraj &pvts);
+  /*
+   * Play pvts on the robot state at 1 ms ticks, without a robot.
+   * samples (if any) gets the joint state of every tick.
+   * With a virtual sim clock it runs as fast as possible and is deterministic.
+   */
+  bool fake_run_pvt_traj(const PvtTraj &pvts, std::vector<SimSample> *samples = nullptr);
+
+  // clock of fake_run_pvt_traj, nullptr: steady clock
+  void set_sim_clock(utils::Clock *clock) { _sim_clock = clock ? clock : &utils::SteadyClock::instance(); }
 
   void sim_pvt_stop();
   bool sim_pvt_enter();
@@ -81,7 +130,19 @@ public:
 private:
   bool _keep_pvt_running = false;
 
+  utils::ThreadPool *_format_pool = nullptr;
+  ScriptCache *_script_cache = nullptr;
+
   SimPvtMotion _sim_pvt;
+  utils::Clock *_sim_clock = &utils::SteadyClock::instance();
+
+  // SetContinueVJog/VLine is sent at a high rate, render and send under _vel_mtx
+  std::mutex _vel_mtx;
+  CommandTemplate _vel_tpl;
+  VelMode _vel_tpl_mode = VelMode::Joint;
+
+  PvtStream _pvt_stream;
+  PvtSession _pvt_session;
 };
 
 inline bool Driver::send_stick_play()
@@ -151,8 +212,18 @@ inline bool Driver::set_pvt_point(PvtMode mode, const PvtPoint &point, const std
 }
 inline bool Driver::set_pvt_traj(const PvtTraj &pvts, const std::string &id)
 {
+  if (_script_cache) {
+    return tmsct.send_packed(*_script_cache->pvt_traj_packet(pvts, id, _format_pool));
+  }
+  if (_format_pool) {
+    return tmsct.send_script(id, cmd::pvt_traj(pvts, *_format_pool), comm::Client::LOG_NOTHING);
+  }
   return tmsct.send_script(id, cmd::pvt_traj(pvts));//, comm::Client::LOG_NOTHING);
 }
+inline bool Driver::set_pvt_traj(const PvtTraj &pvts, const Tolerance &tol, const std::string &id)
+{
+  return tmsct.send_script(id, cmd::pvt_traj(pvts, tol), comm::Client::LOG_NOTHING);
+}
 
 inline bool Driver::set_vel_mode_start(VelMode mode, double timeout_zero_vel, double timeout_stop, const std::string &id)
 {
@@ -162,10 +233,6 @@ inline bool Driver::set_vel_mode_stop(const std::string &id)
 {
   return tmsct.send_script(id, cmd::vel_mode_stop());
 }
-inline bool Driver::set_vel_mode_target(VelMode mode, const vector6d &vel, const std::string &id)
-{
-  return tmsct.send_script(id, cmd::vel_mode_target(mode, vel), comm::Client::LOG_NOTHING);
-}
 
 }
 }
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "tmrl/driver/driver.h"
+#include "tmrl/comm/io_loop.h"
+
+#include <memory>
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * Several robots driven from one host. The connections of all robots share
+ * io_threads IoLoops (robot i on loop i % io_threads) in place of two
+ * threads per robot; the callbacks of the robots of a loop run on its thread.
+ *
+ * Robots are added before start, each is a Driver with its own TmsvrClient
+ * and TmsctClient. Fleet sets their feedback and tmsct callbacks, use the
+ * fleet callbacks instead. Start and stop the fleet, not the drivers.
+ */
+class Fleet
+{
+public:
+  using FeedbackCallback = std::function<void(std::size_t robot, const RobotState &rs)>;
+  using TmsctCallback = std::function<void(std::size_t robot, const comm::TmsctPacket &pack)>;
+
+  // copy of a robot state, taken under its lock
+  struct Snapshot {
+    std::size_t feedbacks = 0;
+    // arrival of the last feedback, steady clock
+    std::chrono::steady_clock::time_point stamp;
+    bool connected = false;
+    bool linked = false;
+    bool error = false;
+    bool project_running = false;
+    vector6d joint_angle{};
+    vector6d joint_speed{};
+    PoseEular tool_pose{};
+  };
+
+  struct SyncReport {
+    // robots the release was sent to
+    std::size_t released = 0;
+    // first to last release sent (s)
+    double send_skew = 0.0;
+    // release sent to the first feedback that moved, per robot (s), < 0: no motion
+    std::vector<double> start_latency;
+    // first to last of those feedbacks (s), < 0: not all moved
+    double motion_skew = -1.0;
+  };
+
+  explicit Fleet(std::size_t io_threads = 1);
+  ~Fleet();
+
+  Fleet(const Fleet &) = delete;
+  Fleet & operator=(const Fleet &) = delete;
+
+  // not while started (false, nothing is added), the robot gets index size() - 1
+  bool add(const std::string &ip);
+  std::size_t size() const { return _robots.size(); }
+  std::size_t io_threads() const { return _loops.size(); }
+
+  Driver & driver(std::size_t robot) { return _robots[robot]->drv; }
+
+  void set_feedback_callback(FeedbackCallback cb) { _feedbackCallback = cb; }
+  void set_tmsct_callback(TmsctCallback cb) { _tmsctCallback = cb; }
+
+  /*
+   * Connect all robots at once, each connection within timeout_ms, then
+   * serve them. timings (if any) gets one per robot. false if one failed,
+   * it keeps reconnecting.
+   */
+  bool start(int timeout_ms = 1000, std::vector<StartTiming> *timings = nullptr);
+  // exit the scripts and close all connections
+  void halt();
+
+  Snapshot snapshot(std::size_t robot) const;
+
+  /*
+   * Synchronized motion start in two steps. Verified on MockTmsct only, not
+   * yet on a controller: it relies on Pause() holding the motions queued
+   * after it until Resume().
+   * stage: send Pause() and scripts[i] as one script to robot i, wait up to
+   * timeout_ms for every robot to accept it and pack the Resume() of each.
+   * release: send the packed Resume() back to back from the calling thread,
+   * then wait up to timeout_ms for every robot to move (a joint more than
+   * eps rad off its angle at stage). The motion start is the arrival of the
+   * feedback, its period bounds the resolution.
+   */
+  bool stage(const std::vector<std::string> &scripts, int timeout_ms = 1000);
+  SyncReport release(int timeout_ms = 1000, double eps = 1.0e-4);
+
+private:
+  struct Robot {
+    explicit Robot(const std::string &ip);
+
+    // holds 64 byte aligned queues, plain new aligns less before C++17
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
+
+    TmsvrClient svr;
+    TmsctClient sct;
+    Driver drv;
+
+    // loop and the index of svr on it, sct is the next
+    std::size_t loop = 0;
+    std::size_t slot = 0;
+
+    // under Fleet::_mtx
+    std::size_t feedbacks = 0;
+    std::chrono::steady_clock::time_point stamp;
+    // stage reply
+    bool replied = false;
+    bool accepted = false;
+    // release
+    std::string release;
+    vector6d staged{};
+    bool watching = false;
+    bool moved = false;
+    std::chrono::steady_clock::time_point moved_at;
+  };
+
+  void on_feedback(std::size_t robot, const RobotState &rs);
+  void on_tmsct(std::size_t robot, const comm::TmsctPacket &pack);
+
+  std::vector<std::unique_ptr<Robot>> _robots;
+  // after the robots, goes first
+  std::vector<std::unique_ptr<comm::IoLoop>> _loops;
+
+  FeedbackCallback _feedbackCallback;
+  TmsctCallback _tmsctCallback;
+
+  mutable std::mutex _mtx;
+  std::condition_variable _cv;
+  double _eps = 1.0e-4;
+  bool _staged = false;
+};
+
+}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "tmrl/driver/script_commands.h"
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * PvtPoint with fixed size storage, no heap allocation per point.
+ *
+ * PvtPoint and PvtTraj themselves stay dynamic: they are the DOF-erased form
+ * the public API, cmd::pvt_traj, ScriptCache, PvtSession/PvtStream and the mock
+ * parser take, with the DOF only known at run time. The per-tick paths
+ * (SimPvtMotion, SimFleet, SpscQueue) run on PvtPointN, and to_pvt_point /
+ * to_pvt_traj below convert once at that boundary.
+ */
+template<std::size_t N>
+struct PvtPointN {
+  double time;
+  std::array<double, N> positions;
+  std::array<double, N> velocities;
+};
+template<std::size_t N>
+struct PvtTrajN {
+  PvtMode mode;
+  std::vector<PvtPointN<N>> points;
+  double total_time;
+};
+
+using PvtPoint6 = PvtPointN<6>;
+using PvtPoint7 = PvtPointN<7>;
+using PvtTraj6 = PvtTrajN<6>;
+using PvtTraj7 = PvtTrajN<7>;
+
+// adapters from and to the dynamic size types, missing values are zero
+
+template<std::size_t N>
+inline PvtPointN<N> to_pvt_point(const PvtPoint &point)
+{
+  PvtPointN<N> rv;
+  rv.time = point.time;
+  rv.positions.fill(0.0);
+  rv.velocities.fill(0.0);
+  for (size_t i = 0; i < N && i < point.positions.size(); ++i) { rv.positions[i] = point.positions[i]; }
+  for (size_t i = 0; i < N && i < point.velocities.size(); ++i) { rv.velocities[i] = point.velocities[i]; }
+  return rv;
+}
+template<std::size_t N>
+inline PvtPoint to_pvt_point(const PvtPointN<N> &point)
+{
+  return PvtPoint{ point.time, to_vectorXd(point.positions), to_vectorXd(point.velocities) };
+}
+
+template<std::size_t N>
+inline PvtTrajN<N> to_pvt_traj(const PvtTraj &pvts)
+{
+  PvtTrajN<N> rv;
+  rv.mode = pvts.mode;
+  rv.total_time = pvts.total_time;
+  rv.points.reserve(pvts.points.size());
+  for (auto &point : pvts.points) { rv.points.push_back(to_pvt_point<N>(point)); }
+  return rv;
+}
+template<std::size_t N>
+inline PvtTraj to_pvt_traj(const PvtTrajN<N> &pvts)
+{
+  PvtTraj rv;
+  rv.mode = pvts.mode;
+  rv.total_time = pvts.total_time;
+  rv.points.reserve(pvts.points.size());
+  for (auto &point : pvts.points) { rv.points.push_back(to_pvt_point(point)); }
+  return rv;
+}
+
+/*
+ * Cubic Hermite interpolation from p0 to p1 at t in [0, p1.time],
+ * the same polynomial as Driver::cubic_interp.
+ * Writes straight into pos and vel, no branch in the joint loop.
+ */
+template<std::size_t N>
+inline void cubic_interp(std::array<double, N> &pos, std::array<double, N> &vel,
+  const PvtPointN<N> &p0, const PvtPointN<N> &p1, double t)
+{
+  const double T = p1.time;
+  if (t < 0.0) t = 0.0;
+  else if (t > T) t = T;
+
+  const double iT = 1.0 / T;
+  const double iT2 = iT * iT;
+  const double t2 = t * t;
+  const double t3 = t2 * t;
+
+  for (std::size_t i = 0; i < N; ++i) {
+    const double dp = p1.positions[i] - p0.positions[i];
+    const double v0 = p0.velocities[i];
+    const double v1 = p1.velocities[i];
+    const double c = (3.0 * dp * iT - 2.0 * v0 - v1) * iT;
+    const double d = (-2.0 * dp * iT + v0 + v1) * iT2;
+    pos[i] = p0.positions[i] + v0 * t + c * t2 + d * t3;
+    vel[i] = v0 + 2.0 * c * t + 3.0 * d * t2;
+  }
+}
+template<std::size_t N>
+inline void cubic_interp(PvtPointN<N> &p, const PvtPointN<N> &p0, const PvtPointN<N> &p1, double t)
+{
+  const double T = p1.time;
+  p.time = (t < 0.0) ? 0.0 : ((t > T) ? T : t);
+  cubic_interp<N>(p.positions, p.velocities, p0, p1, t);
+}
+
+}
+}
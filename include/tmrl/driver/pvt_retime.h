@@ -0,0 +1,60 @@
+#pragma once
+
+#include "tmrl/driver/script_commands.h"
+
+namespace tmrl
+{
+namespace driver
+{
+
+template<std::size_t N>
+struct JointLimits {
+  std::array<double, N> vel;  // rad/s
+  std::array<double, N> acc;  // rad/s^2
+  std::array<double, N> jerk; // rad/s^3
+};
+
+template<std::size_t N>
+using JointPath = std::vector<std::array<double, N>>;
+
+struct RetimeStats {
+  std::size_t iterations = 0;
+  // total time of the retimed trajectory
+  double retimed_time = 0.0;
+  // total time of the fastest feasible trajectory with equal segment times
+  double uniform_time = 0.0;
+
+  double time_gained() const { return uniform_time - retimed_time; }
+};
+
+/*
+ * Time parameterization of joint waypoints into a PvtTraj.
+ *
+ * waypoints[0] is the start (not sent), the trajectory starts and ends at rest.
+ * Segment times are shrunk and grown per segment until every joint stays within
+ * its velocity, acceleration and jerk limits along the cubic Hermite segments
+ * (the polynomial Driver::cubic_interp plays back). Waypoint velocities are the
+ * time-weighted slopes of the neighbouring segments, zero at a direction change.
+ *
+ * Instantiated for N = 6 and N = 7.
+ */
+template<std::size_t N>
+PvtTraj retime_pvt_traj(const JointPath<N> &waypoints, const JointLimits<N> &limits,
+  RetimeStats *stats = nullptr);
+
+/*
+ * Retime many paths on pool, stats (if any) is resized to paths.size()
+ */
+template<std::size_t N>
+std::vector<PvtTraj> retime_pvt_trajs(const std::vector<JointPath<N>> &paths,
+  const JointLimits<N> &limits, utils::ThreadPool &pool, std::vector<RetimeStats> *stats = nullptr);
+
+extern template PvtTraj retime_pvt_traj<6>(const JointPath<6> &, const JointLimits<6> &, RetimeStats *);
+extern template PvtTraj retime_pvt_traj<7>(const JointPath<7> &, const JointLimits<7> &, RetimeStats *);
+extern template std::vector<PvtTraj> retime_pvt_trajs<6>(const std::vector<JointPath<6>> &,
+  const JointLimits<6> &, utils::ThreadPool &, std::vector<RetimeStats> *);
+extern template std::vector<PvtTraj> retime_pvt_trajs<7>(const std::vector<JointPath<7>> &,
+  const JointLimits<7> &, utils::ThreadPool &, std::vector<RetimeStats> *);
+
+}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "tmrl/driver/tmsct_client.h"
+#include "tmrl/driver/script_commands.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * Keeps PVT mode open across consecutive trajectories.
+ *
+ * append(...) queues a trajectory that continues from the end of the previous one,
+ * the queue is streamed to the listen node in chunks (like PvtStream) and
+ * PVTExit is sent only on close() or, with auto exit, when the queue runs dry.
+ */
+class PvtSession
+{
+public:
+  struct Stats {
+    std::size_t traj_count = 0;
+    std::size_t enter_count = 0;
+    std::size_t rejected_count = 0;
+    double motion_time = 0.0;
+    // nominal, not measured: stop_restart_time per PVTEnter/PVTExit avoided
+    double nominal_saved_time = 0.0;
+  };
+
+  explicit PvtSession(TmsctClient &sct);
+  ~PvtSession() { stop(); }
+
+  // boundary tolerance (rad or m, rad/s or m/s)
+  void set_tolerance(double pos_tol, double vel_tol) { _pos_tol = pos_tol; _vel_tol = vel_tol; }
+  void set_lookahead(double sec) { _lookahead = sec; }
+  void set_chunk_time(double sec) { _chunk_time = sec; }
+  // send PVTExit when the queue is drained and its motion is done
+  void set_auto_exit(bool auto_exit) { _auto_exit = auto_exit; }
+  // assumed time lost by stopping at a boundary, PVTExit and PVTEnter again
+  // (for Stats::nominal_saved_time only)
+  void set_stop_restart_time(double sec) { _stop_restart_time = sec; }
+
+  bool open(PvtMode mode, const vectorXd &start_positions, const std::string &id = "PvtSession");
+
+  /*
+   * The first point of pvts is its start state, with (nearly) zero time: it
+   * must match the end of the queue within tolerance and is not sent.
+   * false (rejected) without it or on a mismatch.
+   */
+  bool append(const PvtTraj &pvts);
+
+  // send PVTExit after the queued points, wait until it is sent
+  void close();
+  // StopAndClearBuffer, drop the queue
+  void stop();
+
+  bool is_open() const { return _keep_alive; }
+  bool is_entered() const { return _entered; }
+
+  Stats stats() const;
+
+private:
+  bool check_boundary(const PvtPoint &point) const;
+  PvtTraj take_chunk(double queued_time);
+
+  void run();
+
+  TmsctClient &_sct;
+  std::string _id;
+  PvtMode _mode = PvtMode::Joint;
+
+  double _pos_tol = 1.0e-4;
+  double _vel_tol = 1.0e-3;
+  double _lookahead = 0.5;
+  double _chunk_time = 0.1;
+  bool _auto_exit = true;
+  double _stop_restart_time = 0.2;
+
+  // written by the session thread, read by is_open() / is_entered()
+  std::atomic<bool> _keep_alive{false};
+  bool _exit_requested = false;
+  std::atomic<bool> _entered{false};
+
+  // end of the queue
+  PvtPoint _end;
+  std::deque<PvtPoint> _queue;
+  double _sent_time = 0.0;
+  std::chrono::steady_clock::time_point _time_enter;
+
+  Stats _stats;
+
+  mutable std::mutex _mtx;
+  std::condition_variable _cv;
+  std::thread _thd;
+};
+
+}
+}
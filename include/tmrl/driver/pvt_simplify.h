@@ -0,0 +1,41 @@
+#pragma once
+
+#include "tmrl/driver/script_commands.h"
+
+namespace tmrl
+{
+namespace driver
+{
+
+struct PvtSimplifyStats {
+  std::size_t input_points = 0;
+  std::size_t output_points = 0;
+  // largest position deviation of a dropped point (rad or m)
+  double max_error = 0.0;
+
+  double reduction_ratio() const
+  {
+    return (output_points == 0) ? 0.0 : (double)(input_points) / (double)(output_points);
+  }
+};
+
+/*
+ * Fill in velocities of points that have none (empty or size mismatch)
+ * by finite differences over the point times, one-sided at both ends
+ */
+void estimate_pvt_velocities(PvtTraj &pvts);
+
+/*
+ * Drop points while the cubic Hermite segment between the kept neighbours
+ * (the same polynomial as Driver::cubic_interp) passes every dropped point
+ * within tol (rad for joints, the same tol for every component in tool mode).
+ *
+ * Kept points keep their position and velocity, times are merged so the
+ * total time is unchanged. A segment spans at most max_span input points,
+ * which keeps the cost linear in the number of points.
+ */
+PvtTraj simplify_pvt_traj(const PvtTraj &pvts, double tol,
+  PvtSimplifyStats *stats = nullptr, std::size_t max_span = 256);
+
+}
+}
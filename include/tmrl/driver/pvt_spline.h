@@ -0,0 +1,83 @@
+#pragma once
+
+#include "tmrl/driver/script_commands.h"
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * Cubic Hermite spline of a PvtTraj, built once and evaluated many times.
+ *
+ * Segment k runs from point k to point k + 1 (or from start to point 0)
+ * and stores x(t) = a + b t + c t^2 + d t^3 per joint, the same polynomial
+ * as Driver::cubic_interp, so evaluation is multiply-add only.
+ */
+class PvtSpline
+{
+public:
+  PvtSpline() {}
+
+  // points[0] is the start, its time is not used.
+  // A single point (or a start without points) holds still there for zero time.
+  explicit PvtSpline(const PvtTraj &pvts) { build(pvts); }
+
+  // start at time 0, then every point of pvts
+  PvtSpline(const PvtPoint &start, const PvtTraj &pvts) { build(start, pvts); }
+
+  void build(const PvtTraj &pvts);
+  void build(const PvtPoint &start, const PvtTraj &pvts);
+
+  // no points, evaluate() writes nothing
+  bool empty() const { return _ends.empty(); }
+  std::size_t dof() const { return _dof; }
+  std::size_t segment_count() const { return _ends.size(); }
+  double duration() const { return _ends.empty() ? 0.0 : _ends.back(); }
+
+  // end time of each segment from the start
+  const std::vector<double> &end_times() const { return _ends; }
+
+  /*
+   * Segment containing t, O(log n).
+   * With a hint (the last segment found) it is O(1) while t moves forward.
+   */
+  std::size_t find_segment(double t) const;
+  std::size_t find_segment(double t, std::size_t hint) const;
+
+  /*
+   * Positions (and velocities, if vel is not null) at t, clamped to [0, duration].
+   * pos and vel hold dof() values. hint is updated to the segment used.
+   */
+  void evaluate(double t, double *pos, double *vel = nullptr) const
+  {
+    std::size_t hint = 0;
+    evaluate(t, pos, vel, hint);
+  }
+  void evaluate(double t, double *pos, double *vel, std::size_t &hint) const;
+
+  /*
+   * Batched evaluation of count samples, pos (and vel) hold count * dof() values,
+   * sample after sample. Sorted times cost O(1) per lookup, and a run of
+   * samples in one segment is evaluated with its coefficients loaded once.
+   */
+  void evaluate(const double *times, std::size_t count, double *pos, double *vel = nullptr) const;
+
+private:
+  void add_segment(const PvtPoint &p0, const PvtPoint &p1, std::size_t k);
+  void hold(const PvtPoint &p);
+
+  const double *coef(std::size_t k) const { return _coef.data() + 4 * _dof * k; }
+
+  inline void eval_segment(std::size_t k, double t, double *pos, double *vel) const;
+
+private:
+  std::size_t _dof = 0;
+  // start + end time of each segment
+  std::vector<double> _ends;
+  // per segment: a[dof], b[dof], c[dof], d[dof]
+  std::vector<double> _coef;
+};
+
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "tmrl/driver/tmsct_client.h"
+#include "tmrl/driver/script_commands.h"
+#include "tmrl/driver/robot_state.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * Streams a PvtTraj to the listen node in chunks instead of one TMSCT packet.
+ *
+ * The first chunk (PVTEnter + first_chunk_time of points) is sent immediately,
+ * then the controller buffer is topped up so that about lookahead seconds of
+ * motion stay queued ahead of the playback position.
+ *
+ * The playback clock starts with the first joint motion seen in feedback
+ * (or start_timeout after the first send, if none). In joint mode the point
+ * closest to the fed back joint angles moves it forward when the robot is
+ * ahead of it.
+ */
+class PvtStream
+{
+public:
+  explicit PvtStream(TmsctClient &sct, RobotState &state);
+
+  // motion time sent with PVTEnter before anything else
+  void set_first_chunk_time(double sec) { _first_chunk_time = sec; }
+  // motion time kept queued ahead of the controller
+  void set_lookahead(double sec) { _lookahead = sec; }
+  // minimum motion time per top-up chunk
+  void set_chunk_time(double sec) { _chunk_time = sec; }
+  // playback is assumed to start this long after the first send without motion
+  void set_start_timeout(double sec) { _start_timeout = sec; }
+
+  double first_chunk_time() const { return _first_chunk_time; }
+  double lookahead() const { return _lookahead; }
+  double chunk_time() const { return _chunk_time; }
+  double start_timeout() const { return _start_timeout; }
+
+  /*
+   * Blocks until the whole trajectory is sent and its motion time is elapsed,
+   * or stop() is called (StopAndClearBuffer is sent then)
+   */
+  bool run(const PvtTraj &pvts, const std::string &id = "PvtStream");
+  void stop() { _keep_running = false; }
+  bool is_running() const { return _keep_running; }
+
+  // time from run(...) to the first chunk being sent (sec)
+  double time_to_first_send() const { return _time_to_first_send; }
+  // time from run(...) to the first joint motion seen in feedback (sec), -1 if none
+  double time_to_first_motion() const { return _time_to_first_motion; }
+  std::size_t chunk_count() const { return _chunk_count; }
+
+private:
+  // index past the last point to send so that the chunk covers at least sec
+  std::size_t chunk_end(const PvtTraj &pvts, std::size_t begin, double sec, double &chunk_time) const;
+
+  bool has_moved(const vector6d &angle_start);
+
+  // motion time played (sec), from the playback clock and the feedback
+  double played_time(const PvtTraj &pvts, std::size_t sent_end, const vector6d &angle_start);
+
+  TmsctClient &_sct;
+  RobotState &_rs;
+
+  double _first_chunk_time = 0.3;
+  double _lookahead = 0.5;
+  double _chunk_time = 0.1;
+  double _start_timeout = 1.0;
+
+  std::atomic<bool> _keep_running{false};
+
+  // playback state of run(...)
+  std::chrono::steady_clock::time_point _time_send;
+  std::chrono::steady_clock::time_point _time_motion;
+  std::chrono::steady_clock::time_point _time_init;
+  // motion time at the end of each point
+  std::vector<double> _point_end;
+  // point closest to the last feedback
+  std::size_t _fb_idx = 0;
+
+  double _time_to_first_send = 0.0;
+  double _time_to_first_motion = -1.0;
+  std::size_t _chunk_count = 0;
+};
+
+}
+}
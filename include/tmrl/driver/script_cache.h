@@ -0,0 +1,78 @@
+#pragma once
+
+#include "tmrl/driver/script_commands.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * LRU cache of fully framed TMSCT packets of PVT trajectories,
+ * keyed by the trajectory contents (mode, times, positions, velocities),
+ * precision and script id.
+ *
+ * A hit is verified against a copy of the trajectory, so a hash collision
+ * can only cost a miss.
+ */
+class ScriptCache
+{
+public:
+  using PacketPtr = std::shared_ptr<const std::string>;
+
+  explicit ScriptCache(std::size_t capacity_bytes = 0x1000000);
+
+  // the packet of cmd::pvt_traj(pvts, precision), formatted (on pool if any) on a miss
+  PacketPtr pvt_traj_packet(const PvtTraj &pvts, const std::string &id,
+    utils::ThreadPool *pool = nullptr, int precision = 5);
+
+  void set_capacity(std::size_t capacity_bytes);
+  void clear();
+
+  std::size_t capacity() const;
+  std::size_t size_bytes() const;
+  std::size_t entry_count() const;
+  std::size_t hits() const;
+  std::size_t misses() const;
+  std::size_t evictions() const;
+
+  static std::uint64_t hash(const PvtTraj &pvts, int precision);
+
+private:
+  struct Entry {
+    std::uint64_t key;
+    std::string id;
+    int precision;
+    PvtTraj pvts;
+    PacketPtr packet;
+    std::size_t bytes;
+  };
+  using EntryList = std::list<Entry>;
+
+  static bool same_traj(const PvtTraj &a, const PvtTraj &b);
+  static std::size_t traj_bytes(const PvtTraj &pvts);
+
+  // under _mtx, _lru.end() if not cached
+  EntryList::iterator find(std::uint64_t key, const PvtTraj &pvts, const std::string &id, int precision);
+  void evict(std::size_t capacity);
+
+  std::size_t _capacity;
+  std::size_t _bytes = 0;
+  std::size_t _hits = 0;
+  std::size_t _misses = 0;
+  std::size_t _evictions = 0;
+
+  // front is the most recently used
+  EntryList _lru;
+  std::unordered_multimap<std::uint64_t, EntryList::iterator> _map;
+  mutable std::mutex _mtx;
+};
+
+}
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "tmrl/types.h"
+#include "tmrl/utils/str_builder.h"
+#include "tmrl/utils/thread_pool.h"
 
 namespace tmrl
 {
@@ -24,6 +26,71 @@ struct PvtTraj {
 
 enum class VelMode { Joint, Tool };
 
+/*
+ * Largest text error allowed per unit of a script value,
+ * deg for angles (and deg/s), mm for lengths (and mm/s), s for time.
+ * The default is what precision = 5 guarantees
+ */
+struct Tolerance {
+  double deg = 0.000005;
+  double mm = 0.000005;
+  double sec = 0.000005;
+};
+
+/*
+ * Pre-rendered TMSCT packet ($TMSCT,len,id,script,*cs\r\n) for a script
+ * whose text is constant except for its numeric fields.
+ *
+ * render(...) writes only the numbers and recomputes length and checksum
+ * into a buffer that is reused between calls.
+ */
+class CommandTemplate
+{
+public:
+  enum class Field {
+    FIXED,   // value * scale, fixed-point
+    INT,     // value truncated to an integer
+    DIGITAL  // 0 if value is zero, else 1
+  };
+
+  explicit CommandTemplate(const std::string &id = "");
+
+  CommandTemplate & text(const std::string &s);
+  CommandTemplate & fixed(int precision, double scale = 1.0);
+  CommandTemplate & integer();
+  CommandTemplate & digital();
+
+  const std::string & id() const { return _id; }
+  std::size_t field_count() const { return _fields.size(); }
+
+  // values must hold field_count() numbers
+  const std::string & render(const double *values);
+  template<std::size_t N>
+  const std::string & render(const std::array<double, N> &values) { return render(values.data()); }
+  const std::string & render(const std::vector<double> &values) { return render(values.data()); }
+
+  // last rendered packet and its script
+  const std::string & packet() const { return _packet; }
+  std::string script() const { return _body; }
+
+private:
+  CommandTemplate & field(Field kind, int precision, double scale);
+
+  struct FieldSpec {
+    std::string prefix; // constant text before the field
+    Field kind;
+    int precision;
+    double scale;
+  };
+  std::string _id;
+  std::vector<FieldSpec> _fields;
+  std::string _suffix; // constant text after the last field
+  char _const_cs = 0;  // xor of every constant byte of the packet
+
+  std::string _body;
+  std::string _packet;
+};
+
 namespace cmd
 {
 
@@ -64,11 +131,72 @@ inline std::string pvt_point(PvtMode mode, const PvtPoint &point, int precision
 
 std::string pvt_traj(const PvtTraj &pvts, int precision = 5);
 
+/*
+ * PVTPoint lines of pvts.points[begin, end), each terminated with "\r\n"
+ */
+std::string pvt_points(const PvtTraj &pvts, size_t begin, size_t end, int precision = 5);
+
+// append to sb, the same text as above without the temporary strings
+
+void append_pvt_point(utils::StrBuilder &sb, PvtMode mode,
+  double t, const vectorXd &pos, const vectorXd &vel, int precision = 5);
+
+inline void append_pvt_point(utils::StrBuilder &sb, PvtMode mode, const PvtPoint &point, int precision = 5)
+{
+  append_pvt_point(sb, mode, point.time, point.positions, point.velocities, precision);
+}
+
+void append_pvt_points(utils::StrBuilder &sb,
+  const PvtTraj &pvts, size_t begin, size_t end, int precision = 5);
+
+// shortest text within tol per value instead of a fixed precision
+
+std::string pvt_point(PvtMode mode, const PvtPoint &point, const Tolerance &tol);
+
+std::string pvt_traj(const PvtTraj &pvts, const Tolerance &tol);
+
+std::string pvt_points(const PvtTraj &pvts, size_t begin, size_t end, const Tolerance &tol);
+
+void append_pvt_point(utils::StrBuilder &sb, PvtMode mode,
+  double t, const vectorXd &pos, const vectorXd &vel, const Tolerance &tol);
+
+inline void append_pvt_point(utils::StrBuilder &sb, PvtMode mode, const PvtPoint &point, const Tolerance &tol)
+{
+  append_pvt_point(sb, mode, point.time, point.positions, point.velocities, tol);
+}
+
+void append_pvt_points(utils::StrBuilder &sb,
+  const PvtTraj &pvts, size_t begin, size_t end, const Tolerance &tol);
+
+// formatted on the pool in chunks and joined in order, the same text as above
+
+std::string pvt_traj(const PvtTraj &pvts, utils::ThreadPool &pool, int precision = 5);
+
+/*
+ * PVTPoint lines of pvts.points split every chunk_size points,
+ * e.g. for sending as consecutive scripts
+ */
+std::vector<std::string> pvt_point_chunks(const PvtTraj &pvts,
+  std::size_t chunk_size, utils::ThreadPool &pool, int precision = 5);
+
 
 std::string vel_mode_start(VelMode mode, double timeout_zero_vel, double timeout_stop);
 inline std::string vel_mode_stop() { return "StopContinueVmode()"; }
 std::string vel_mode_target(VelMode mode, const vector6d &vel, int precision = 5);
 
+//
+// templates, same script text as the functions above
+//
+
+// fields: vel[0..5] (rad/s or m/s, rad/s)
+CommandTemplate vel_mode_target_template(VelMode mode, const std::string &id, int precision = 5);
+
+// fields: positions[0..dof), velocities[0..dof), time
+CommandTemplate pvt_point_template(PvtMode mode, const std::string &id, int precision = 5, std::size_t dof = 6);
+
+// field: state
+CommandTemplate IO_template(IOModule module, IOType type, int pin, const std::string &id);
+
 }
 }
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "tmrl/driver/pvt_point.h"
+#include "tmrl/driver/sim_pvt_motion.h"
+#include "tmrl/utils/clock.h"
+#include "tmrl/utils/work_stealing_pool.h"
+
+namespace tmrl
+{
+namespace driver
+{
+
+/*
+ * Many simulated robots stepped together on one virtual clock.
+ *
+ * Joint states are kept as struct of arrays, positions(j)[r] is joint j of
+ * robot r, so a tick writes each joint of every robot contiguously.
+ * Robots are stepped on the pool (if any) in blocks of grain robots.
+ * Not thread safe: queue points and step from one thread.
+ */
+class SimFleet
+{
+public:
+  enum { DOF = RobotState::DOF };
+  using Point = PvtPointN<DOF>;
+
+  explicit SimFleet(std::size_t robots, utils::WorkStealingPool *pool = nullptr);
+
+  std::size_t size() const { return _tracks.size(); }
+
+  // tick period (s), default 1 ms
+  void set_period(double period) { if (period > 0.0) _period = period; }
+  double period() const { return _period; }
+
+  // robots per pool task, default 8
+  void set_grain(std::size_t grain) { _grain = grain ? grain : 1; }
+
+  utils::VirtualClock &clock() { return _clock; }
+  double time() const { return _clock.seconds(_clock.now()); }
+
+  // stop and place robot at positions
+  void set_joint_angle(std::size_t robot, const vector6d &positions);
+
+  // queue points of robot, they start on the next tick when it is idle
+  bool add_point(std::size_t robot, const PvtPoint &point);
+  bool add_traj(std::size_t robot, const PvtTraj &pvts);
+
+  void step(std::size_t ticks = 1);
+
+  const double *positions(std::size_t joint) const { return _pos[joint].data(); }
+  const double *velocities(std::size_t joint) const { return _vel[joint].data(); }
+
+  vector6d joint_angle(std::size_t robot) const;
+  vector6d joint_speed(std::size_t robot) const;
+
+  bool is_moving(std::size_t robot) const { return _tracks[robot].moving; }
+  std::size_t moving_count() const;
+
+private:
+  struct Track {
+    std::vector<Point> points;
+    std::size_t next = 0;
+    // time into the segment towards points[next]
+    double seg_time = 0.0;
+    Point curr;
+    bool moving = false;
+  };
+  void tick(std::size_t begin, std::size_t end);
+
+  std::vector<Track> _tracks;
+  std::array<std::vector<double>, DOF> _pos;
+  std::array<std::vector<double>, DOF> _vel;
+
+  utils::VirtualClock _clock;
+  utils::WorkStealingPool *_pool = nullptr;
+  double _period = 0.001;
+  std::size_t _grain = 8;
+};
+
+}
+}
@@ -1,8 +1,13 @@
-#include "tmrl/driver/script_commands.h"
+#pragma once
+
+#include "tmrl/driver/pvt_point.h"
 #include "tmrl/driver/robot_state.h"
+#include "tmrl/utils/clock.h"
+#include "tmrl/utils/spsc_queue.h"
 
-#include <deque>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <thread>
 #include <chrono>
 #include <functional>
@@ -12,10 +17,22 @@ namespace tmrl
 namespace driver
 {
 
+// joint state after one simulation tick
+struct SimSample {
+  double time;
+  vector6d positions;
+  vector6d velocities;
+};
+
 class SimPvtMotion
 {
 public:
-  SimPvtMotion(RobotState &state);
+  /*
+   * With a real clock a thread ticks every period,
+   * with a virtual clock nothing runs until step() is called
+   */
+  SimPvtMotion(RobotState &state, utils::Clock &clock = utils::SteadyClock::instance(),
+    std::size_t capacity = 0x4000);
   ~SimPvtMotion() { stop(); }
 
   void stop();
@@ -23,25 +40,49 @@ public:
   void enter(const vectorXd &init_joint_states);
   void exit();
 
-  void add_point(const PvtPoint &p);
+  /*
+   * Queue a point, from one producer thread at a time.
+   * false if not entered or the buffer (capacity points) is full.
+   */
+  bool add_point(const PvtPoint &p);
+
+  /*
+   * Drop the queued points and hold the current position (StopAndClearBuffer).
+   * Done by the next tick, add points again once clear_pending() is false.
+   */
+  void clear();
+  bool clear_pending() const { return clear_req_; }
+
+  std::size_t point_count() const { return pvt_buffer_.size(); }
+  double remaining_time() const { return 1.0e-9 * (double)(remaining_ns_.load()); }
+
+  struct Timing {
+    std::size_t ticks = 0;
+    // deadlines missed by a whole period or more
+    std::size_t overruns = 0;
+    double period = 0.0;
+    // wake up after the deadline (s), over the last ticks
+    double jitter_p50 = 0.0;
+    double jitter_p99 = 0.0;
+    double jitter_p999 = 0.0;
+    double jitter_max = 0.0;
+  };
 
-private:
-  void interp(PvtPoint &p, const PvtPoint &p0, const PvtPoint &p1, double t)
-  {
-    double c, d, T = p1.time;
+  // tick period (s), default 1 ms
+  void set_period(double period);
+  double period() const { return 1.0e-9 * (double)(period_ns_); }
 
-    if (t < 0.0) t = 0.0;
-    else if (t > T) t = T;
+  Timing timing() const;
+  void reset_timing();
 
-    p.time = t;
+  /*
+   * Virtual clock only: run ticks on the calling thread, one period apart,
+   * and append the joint state of each tick to samples. Returns the ticks run.
+   */
+  std::size_t step(std::size_t ticks, std::vector<SimSample> *samples = nullptr);
 
-    for (size_t i = 0; i < p.positions.size(); ++i) {
-      c = ((3.0 * (p1.positions[i] - p0.positions[i]) / T) - 2.0 * p0.velocities[i] - p1.velocities[i]) / T;
-      d = ((2.0 * (p0.positions[i] - p1.positions[i]) / T) + p0.velocities[i] + p1.velocities[i]) / (T*T);
-      p.positions[i] = p0.positions[i] + p0.velocities[i] * t + c * t*t + d * t*t*t;
-      p.velocities[i] = p0.velocities[i] + 2.0 * c * t + 3.0 * d * t*t;
-    }
-  }
+private:
+  using Point = PvtPointN<RobotState::DOF>;
 
   enum State {
     IDLE,
@@ -50,11 +91,15 @@ private:
   };
   State idle();
   State moving();
+  void clear_buffer();
 
   void run();
+  State tick();
 
 private:
   RobotState &rs_;
+  utils::Clock &clock_;
+  State state_ = IDLE;
 
   bool keep_alive_ = false;
 
@@ -62,16 +107,28 @@ private:
   //std::mutex enable_mtx_;
 
   //vectorXd joint_angle_;
-  double remaining_time_ = 0.0;
-  std::size_t pvt_count_ = 0;
-  std::deque<PvtPoint> pvt_buffer_;
+  // add_point -> tick, the tick never locks
+  utils::SpscQueue<Point> pvt_buffer_;
+  std::atomic<long long> remaining_ns_{0};
+  std::atomic<bool> clear_req_{false};
+  // only to sleep while idle
   std::mutex pvt_mtx_;
+  std::condition_variable pvt_cv_;
+
+  std::atomic<long long> period_ns_{1000000};
+
+  enum { JITTER_SAMPLES = 8192 };
+  std::atomic<std::size_t> ticks_{0};
+  std::atomic<std::size_t> overruns_{0};
+  // lateness of the last ticks (ns), ring
+  std::array<std::atomic<long long>, JITTER_SAMPLES> jitter_ns_;
+  std::atomic<std::size_t> jitter_count_{0};
 
-  PvtPoint pvt_curr_;
-  PvtPoint pvt_trgt_;
+  Point pvt_curr_;
+  Point pvt_trgt_;
 
-  std::chrono::steady_clock::time_point t_start_;
-  std::chrono::steady_clock::time_point t_last_;
+  utils::Clock::time_point t_start_;
+  utils::Clock::time_point t_last_;
 
   std::function<State()> state_func[COUNT] = {
     std::bind(&SimPvtMotion::idle, this),
@@ -24,6 +24,10 @@ public:
   bool send_script(const std::string &id, const std::string script, bool info = true);
   bool send_sta_request(const std::string &subcmd, const std::string &subdata);
 
+  // send an already packed packet, e.g. CommandTemplate::packet()
+  bool send_packed(const char *bytes, std::size_t len);
+  bool send_packed(const std::string &bytes) { return send_packed(bytes.data(), bytes.size()); }
+
 private:
   bool receive(const std::vector<comm::Packet> &pack_vec) override;
 
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "tmrl/comm/server.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <chrono>
+
+namespace tmrl
+{
+namespace mock
+{
+
+// what the proxy does to the bytes of one direction
+struct Impairment {
+  // added to every received chunk (s)
+  double latency = 0.0;
+  // extra latency, uniform in [0, jitter] (s), byte order is kept
+  double jitter = 0.0;
+  // bytes per second, 0: no cap
+  double bandwidth = 0.0;
+  // max bytes per send(), 0: as received
+  std::size_t segment = 0;
+};
+
+/*
+ * TCP proxy between a client (the driver) and a controller, mock or real,
+ * that impairs the connection: latency, jitter, a bandwidth cap, small
+ * segments, stalls, resets and refused connections.
+ *
+ * One connection at a time, a new client replaces the open connection.
+ * The settings can change at any time, e.g. from a script.
+ */
+class ImpairProxy
+{
+public:
+  // UP: client to controller, DOWN: controller to client (feedback)
+  enum class Direction { UP, DOWN, BOTH };
+
+  struct Config {
+    std::string listen_ip = "127.0.0.2";
+    unsigned short listen_port = 5891;
+    std::string target_ip = "127.0.0.1";
+    unsigned short target_port = 5891;
+    unsigned seed = 1;
+  };
+  struct Stats {
+    std::size_t connections = 0;
+    std::size_t drops = 0;
+    std::size_t refused = 0;
+    std::size_t bytes_up = 0;
+    std::size_t bytes_down = 0;
+    // longest time without a byte to the client on an open connection (s)
+    double max_gap = 0.0;
+    // from the last drop() to the first byte to the client after it (s), < 0: none
+    double recover = -1.0;
+  };
+
+  ImpairProxy() : ImpairProxy(Config()) {}
+  explicit ImpairProxy(const Config &config);
+  ~ImpairProxy();
+
+  ImpairProxy(const ImpairProxy &) = delete;
+  ImpairProxy & operator=(const ImpairProxy &) = delete;
+
+  bool start();
+  void stop();
+  bool is_running() const { return _keep_alive; }
+
+  void set_impairment(Direction dir, const Impairment &imp);
+  Impairment impairment(Direction dir) const;
+  // no impairments, no stall, no refuse
+  void clear();
+
+  // hold the bytes of both directions (connections stay open)
+  void stall(bool on);
+  // reset the open connection (RST)
+  void drop();
+  // reset new connections right after accept
+  void refuse(bool on);
+
+  Stats stats() const;
+  // counters and max_gap to 0, keeps recover
+  void reset_stats();
+
+private:
+  struct Chunk {
+    double due;
+    std::string bytes;
+  };
+  struct Pipe {
+    Direction dir;
+    int src;
+    int dst;
+    std::deque<Chunk> queue;
+    double last_due = 0.0;
+    // bandwidth cap, next send not before
+    double next_send = 0.0;
+  };
+
+  double now() const;
+  void run();
+  // returns the fd of a client that replaced the connection, or -1
+  int serve(int client_fd, int target_fd);
+  bool receive(Pipe &pipe, double t);
+  bool forward(Pipe &pipe, double t, double &wake);
+  void on_down_send(double t);
+
+  static int connect_to(const std::string &ip, unsigned short port, int timeout_ms);
+  static void reset_fd(int fd);
+
+  Config _config;
+  comm::Server _server;
+  std::thread _thd;
+  std::atomic<bool> _keep_alive{false};
+  std::chrono::steady_clock::time_point _t0;
+
+  mutable std::mutex _mtx;
+  Impairment _up;
+  Impairment _down;
+  std::mt19937 _rng;
+
+  std::atomic<bool> _stall{false};
+  std::atomic<bool> _refuse{false};
+  std::atomic<bool> _drop_req{false};
+
+  // stats
+  std::atomic<std::size_t> _connections{0};
+  std::atomic<std::size_t> _drops{0};
+  std::atomic<std::size_t> _refused{0};
+  std::atomic<std::size_t> _bytes_up{0};
+  std::atomic<std::size_t> _bytes_down{0};
+  double _max_gap = 0.0;
+  double _last_down = -1.0;
+  double _drop_time = -1.0;
+  double _recover = -1.0;
+};
+
+}
+}
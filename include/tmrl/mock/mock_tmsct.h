@@ -0,0 +1,127 @@
+#pragma once
+
+#include "tmrl/mock/mock_tmsvr.h"
+#include "tmrl/comm/packet.h"
+#include "tmrl/driver/sim_pvt_motion.h"
+
+#include <deque>
+
+namespace tmrl
+{
+namespace mock
+{
+
+/*
+ * Stand-in for the listen node (port 5890) of a TM controller.
+ *
+ * Runs the scripts the cmd:: functions emit on a SimPvtMotion and answers
+ * $TMSCT with OK or ERROR, $TMSTA 00 and 01 (queue tag status).
+ * Joint motions only: PTP("JPP"), PVTEnter(0)/PVTPoint/PVTExit,
+ * ContinueVJog/SetContinueVJog/StopContinueVmode, QueueTag,
+ * StopAndClearBuffer and Pause/Resume: the motions queued after Pause()
+ * start with Resume(), a running one goes on.
+ * A script is checked as a whole before any line runs.
+ *
+ * With a MockTmsvr the simulated joint states go out in its frames,
+ * stop it before this is destroyed.
+ */
+class MockTmsct
+{
+public:
+  struct Config {
+    std::string ip = "127.0.0.1";
+    unsigned short port = 5890;
+    // initial joint angles (rad)
+    vector6d joint_angle{};
+    // joint speed of PTP at 100% (deg/s)
+    double joint_speed = 180.0;
+    // vjog: segment time (s), zero velocity after no target for timeout (s)
+    double vjog_step = 0.01;
+    double vjog_timeout = 0.5;
+  };
+  struct Stats {
+    std::size_t clients = 0;
+    std::size_t scripts = 0;
+    std::size_t errors = 0;
+    std::size_t points = 0;
+  };
+
+  MockTmsct() : MockTmsct(Config()) {}
+  explicit MockTmsct(const Config &config, MockTmsvr *feedback = nullptr);
+  ~MockTmsct();
+
+  MockTmsct(const MockTmsct &) = delete;
+  MockTmsct & operator=(const MockTmsct &) = delete;
+
+  bool start();
+  void stop();
+  bool is_running() const { return _keep_alive; }
+
+  const driver::RobotState &robot_state() const { return _rs; }
+  driver::SimPvtMotion &sim() { return _sim; }
+
+  Stats stats() const;
+
+private:
+  // one script line, name(arg,arg,...)
+  struct Call {
+    std::string name;
+    std::vector<std::string> args;
+    std::vector<double> values;
+  };
+  static bool parse_line(const std::string &line, Call &call);
+  bool check(const Call &call, bool &pvt, bool &vjog) const;
+  void apply(const Call &call, const std::string &id, bool &reply);
+
+  void run();
+  void serve(int fd);
+  void handle(int fd, const comm::Packet &pack);
+  void execute(int fd, const std::string &id, const std::string &script);
+  void update(int fd);
+
+  bool push(const vector6d &pos, const vector6d &vel, double t);
+  void clear();
+  void stop_vjog();
+
+  void reply_tmsct(int fd, const std::string &id, const std::string &script);
+  void reply_tmsta(int fd, const std::string &subcmd, const std::string &subdata);
+
+  Config _config;
+  MockTmsvr *_feedback;
+  comm::Server _server;
+  std::thread _thd;
+  std::atomic<bool> _keep_alive{false};
+
+  driver::RobotState _rs;
+  driver::SimPvtMotion _sim;
+
+  // end of the queued motion
+  vector6d _end_pos;
+  vector6d _end_vel;
+  std::size_t _pushed = 0;
+
+  bool _pvt = false;
+  bool _vjog = false;
+  // motion queued after Pause()
+  bool _paused = false;
+  std::vector<driver::PvtPoint> _held;
+  vector6d _vjog_vel;
+  std::chrono::steady_clock::time_point _vjog_stamp;
+
+  // tag, points pushed before it, reply id if QueueTag waits
+  struct Tag {
+    int tag;
+    std::size_t pushed;
+    std::string wait_id;
+  };
+  std::deque<Tag> _tags;
+  std::map<int, bool> _tag_done;
+
+  std::atomic<std::size_t> _clients{0};
+  std::atomic<std::size_t> _scripts{0};
+  std::atomic<std::size_t> _errors{0};
+  std::atomic<std::size_t> _points{0};
+};
+
+}
+}
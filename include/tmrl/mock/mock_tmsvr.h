@@ -0,0 +1,109 @@
+#pragma once
+
+#include "tmrl/comm/server.h"
+#include "tmrl/types.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+namespace tmrl
+{
+namespace mock
+{
+
+// data table item and its value size (bytes)
+struct TmsvrItem {
+  std::string name;
+  std::size_t size;
+};
+
+/*
+ * Stand-in for the TMSVR (port 5891) side of a TM controller.
+ *
+ * Streams binary data-table frames (TmsvrPacket, Mode::BINARY) to one client
+ * at a time at a fixed rate. The byte stream can be cut into a repeating
+ * pattern of send() sizes and several frames can go in one send, so the
+ * receiver sees split and coalesced packets.
+ */
+class MockTmsvr
+{
+public:
+  struct Config {
+    std::string ip = "127.0.0.1";
+    unsigned short port = 5891;
+    // frames per second
+    double rate = 100.0;
+    // items in the frame, empty: every item RobotState knows; size 0: known size
+    std::vector<TmsvrItem> items;
+    // send() sizes (bytes), repeated over the stream; empty: whole sends
+    std::vector<std::size_t> segments;
+    // frames per send
+    std::size_t coalesce = 1;
+  };
+  struct Stats {
+    std::size_t clients = 0;
+    std::size_t frames = 0;
+    std::size_t bytes = 0;
+    std::size_t send_errors = 0;
+    std::size_t frame_size = 0;
+  };
+
+  MockTmsvr() : MockTmsvr(Config()) {}
+  explicit MockTmsvr(const Config &config);
+  ~MockTmsvr();
+
+  MockTmsvr(const MockTmsvr &) = delete;
+  MockTmsvr & operator=(const MockTmsvr &) = delete;
+
+  bool start();
+  void stop();
+  bool is_running() const { return _keep_alive; }
+
+  // joint state of the next frames (rad, rad/s)
+  void set_joint_states(const vector6d &pos, const vector6d &vel);
+
+  // called on the stream thread before each frame is packed, set before start()
+  void set_frame_callback(std::function<void()> cb) { _frame_cb = cb; }
+
+  // raw value of an item in the frame, size must match
+  bool set_item(const std::string &name, const void *data, std::size_t size);
+
+  // binary data-table content of the next frame
+  std::string content();
+
+  Stats stats() const;
+  void reset_stats();
+
+  // items RobotState parses and their sizes
+  static const std::vector<TmsvrItem> &data_table();
+
+private:
+  void run();
+  bool send_segmented(int fd, const char *bytes, std::size_t len);
+
+  Config _config;
+  comm::Server _server;
+  std::thread _thd;
+  std::function<void()> _frame_cb;
+  std::atomic<bool> _keep_alive{false};
+
+  // frame content, item values are patched in place
+  std::string _content;
+  std::map<std::string, std::pair<std::size_t, std::size_t>> _values;
+  std::mutex _mtx;
+
+  std::size_t _seg_idx = 0;
+  std::size_t _seg_left = 0;
+
+  std::atomic<std::size_t> _clients{0};
+  std::atomic<std::size_t> _frames{0};
+  std::atomic<std::size_t> _bytes{0};
+  std::atomic<std::size_t> _send_errors{0};
+  std::atomic<std::size_t> _frame_size{0};
+};
+
+}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <atomic>
+
+namespace tmrl
+{
+namespace utils
+{
+
+/*
+ * Time source for simulation loops, real (steady) or virtual
+ */
+class Clock
+{
+public:
+  using time_point = std::chrono::steady_clock::time_point;
+  using duration = std::chrono::steady_clock::duration;
+
+  virtual ~Clock() {}
+
+  virtual time_point now() const = 0;
+
+  // block until t (real), or move time to t (virtual)
+  virtual void sleep_until(const time_point &t) = 0;
+
+  virtual bool is_virtual() const = 0;
+
+  double seconds(const time_point &t) const
+  {
+    return std::chrono::duration_cast<std::chrono::duration<double>>(t.time_since_epoch()).count();
+  }
+};
+
+/*
+ * std::chrono::steady_clock, sleeps to absolute deadlines
+ * (clock_nanosleep TIMER_ABSTIME on CLOCK_MONOTONIC)
+ */
+class SteadyClock : public Clock
+{
+public:
+  time_point now() const override { return std::chrono::steady_clock::now(); }
+  void sleep_until(const time_point &t) override;
+  bool is_virtual() const override { return false; }
+
+  // shared instance
+  static SteadyClock &instance();
+};
+
+/*
+ * Time that only moves when told to: sleep_until returns at once,
+ * so a loop runs as fast as the CPU allows and always sees the same times.
+ * Starts at 0.
+ */
+class VirtualClock : public Clock
+{
+public:
+  time_point now() const override { return time_point(duration(_now.load())); }
+  void sleep_until(const time_point &t) override;
+  bool is_virtual() const override { return true; }
+
+  void advance(const duration &d) { _now += d.count(); }
+  void reset() { _now = 0; }
+
+private:
+  std::atomic<duration::rep> _now{0};
+};
+
+}
+}
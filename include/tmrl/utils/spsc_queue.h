@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+namespace tmrl
+{
+namespace utils
+{
+
+/*
+ * Bounded lock-free queue for one producer thread and one consumer thread.
+ * Entries are preallocated, capacity is rounded up to a power of two.
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+  explicit SpscQueue(std::size_t capacity)
+  {
+    std::size_t n = 2;
+    while (n < capacity) n <<= 1;
+    _buf.resize(n);
+    _mask = n - 1;
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue & operator=(const SpscQueue &) = delete;
+
+  std::size_t capacity() const { return _buf.size(); }
+
+  // producer
+
+  bool push(const T &item)
+  {
+    const std::size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head_cache == _buf.size()) {
+      _head_cache = _head.load(std::memory_order_acquire);
+      if (tail - _head_cache == _buf.size()) return false;
+    }
+    _buf[tail & _mask] = item;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer
+
+  // oldest entry or nullptr, valid until pop()
+  const T *front()
+  {
+    const std::size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail_cache) {
+      _tail_cache = _tail.load(std::memory_order_acquire);
+      if (head == _tail_cache) return nullptr;
+    }
+    return &_buf[head & _mask];
+  }
+  void pop()
+  {
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+  bool pop(T &item)
+  {
+    const T *p = front();
+    if (!p) return false;
+    item = *p;
+    pop();
+    return true;
+  }
+
+  // either side, a snapshot
+  std::size_t size() const
+  {
+    // head first, tail only grows past it then and the difference can not wrap
+    const std::size_t head = _head.load(std::memory_order_acquire);
+    const std::size_t tail = _tail.load(std::memory_order_acquire);
+    return tail - head;
+  }
+  bool empty() const { return size() == 0; }
+
+private:
+  std::vector<T> _buf;
+  std::size_t _mask = 0;
+
+  // head and tail on their own cache lines
+  alignas(64) std::atomic<std::size_t> _head{0};
+  std::size_t _tail_cache = 0; // consumer
+  alignas(64) std::atomic<std::size_t> _tail{0};
+  std::size_t _head_cache = 0; // producer
+};
+
+}
+}
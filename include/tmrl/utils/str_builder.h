@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+
+namespace tmrl
+{
+namespace utils
+{
+
+/*
+ * Fixed-point decimal of v, same text as printf("%.*f") and
+ * std::stringstream with std::fixed and std::setprecision(precision).
+ * Returns the length of the text like snprintf, nothing is written
+ * (and no terminator at all) if it does not fit in size bytes
+ */
+std::size_t format_fixed(char *buf, std::size_t size, double v, int precision);
+
+/*
+ * Shortest fixed-point decimal (at most max_precision digits, no trailing zeros)
+ * that reads back within tol of v. Returns the length like format_fixed
+ */
+std::size_t format_shortest(char *buf, std::size_t size, double v, double tol, int max_precision = 9);
+
+// decimal of v, returns the length written (buf needs at least 21 bytes)
+std::size_t format_int(char *buf, long long v);
+
+/*
+ * Append-only string builder for script commands
+ */
+class StrBuilder
+{
+public:
+  explicit StrBuilder(std::size_t capacity = 0) { _str.reserve(capacity); }
+
+  StrBuilder & append(char c) { _str.push_back(c); return *this; }
+  StrBuilder & append(const char *s) { _str.append(s); return *this; }
+  StrBuilder & append(const char *s, std::size_t n) { _str.append(s, n); return *this; }
+  StrBuilder & append(const std::string &s) { _str.append(s); return *this; }
+
+  StrBuilder & append_int(long long v)
+  {
+    char buf[24];
+    _str.append(buf, format_int(buf, v));
+    return *this;
+  }
+  StrBuilder & append_fixed(double v, int precision)
+  {
+    char buf[64];
+    std::size_t len = format_fixed(buf, sizeof(buf), v, precision);
+    if (len >= sizeof(buf)) return append_fixed_long(v, precision);
+    _str.append(buf, len);
+    return *this;
+  }
+  StrBuilder & append_shortest(double v, double tol, int max_precision = 9)
+  {
+    char buf[64];
+    std::size_t len = format_shortest(buf, sizeof(buf), v, tol, max_precision);
+    if (len >= sizeof(buf)) return append_fixed_long(v, max_precision);
+    _str.append(buf, len);
+    return *this;
+  }
+  StrBuilder & append_bool(bool b)
+  {
+    if (b) _str.append("true", 4);
+    else _str.append("false", 5);
+    return *this;
+  }
+
+  void reserve(std::size_t capacity) { _str.reserve(capacity); }
+  void clear() { _str.clear(); }
+  std::size_t size() const { return _str.size(); }
+  const char *data() const { return _str.data(); }
+  const std::string & str() const { return _str; }
+  std::string release() { std::string s; s.swap(_str); return s; }
+
+private:
+  StrBuilder & append_fixed_long(double v, int precision);
+
+  std::string _str;
+};
+
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace tmrl
+{
+namespace utils
+{
+
+/*
+ * Small fixed-size worker pool
+ */
+class ThreadPool
+{
+public:
+  using Task = std::function<void()>;
+
+  // threads == 0: one per hardware thread
+  explicit ThreadPool(std::size_t threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  std::size_t size() const { return _workers.size(); }
+
+  void post(Task task);
+
+  /*
+   * Run f(i) for every i in [0, count) on the workers and the calling thread,
+   * returns when all are done
+   */
+  void parallel_for(std::size_t count, const std::function<void(std::size_t)> &f);
+
+private:
+  void run();
+
+  std::vector<std::thread> _workers;
+  std::deque<Task> _tasks;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  bool _keep_alive = true;
+};
+
+}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace tmrl
+{
+namespace utils
+{
+
+/*
+ * Worker pool for repeated parallel loops (one per simulation tick).
+ *
+ * Each participant starts with its own contiguous block of the index range
+ * and takes grain sized pieces from the front; when its block is empty it
+ * steals the back half of another block, so uneven items even out without
+ * a shared queue.
+ */
+class WorkStealingPool
+{
+public:
+  using RangeFunc = std::function<void(std::size_t begin, std::size_t end)>;
+
+  // threads == 0: one per hardware thread, the caller of parallel_for is one of them
+  explicit WorkStealingPool(std::size_t threads = 0);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool & operator=(const WorkStealingPool &) = delete;
+
+  // participants, workers + the caller
+  std::size_t size() const { return _workers.size() + 1; }
+
+  /*
+   * Run f on pieces of [0, count) of at most grain items,
+   * returns when all are done. One caller at a time.
+   */
+  void parallel_for(std::size_t count, std::size_t grain, const RangeFunc &f);
+
+  std::size_t steals() const { return _steals; }
+
+private:
+  struct Slot {
+    std::mutex mtx;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    // keep neighbouring slots off one cache line
+    char pad[64];
+  };
+  bool take(std::size_t self, std::size_t &begin, std::size_t &end);
+  bool steal(std::size_t self);
+  void work(std::size_t self);
+  void run(std::size_t self);
+
+  std::vector<std::thread> _workers;
+  std::unique_ptr<Slot[]> _slots;
+
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::condition_variable _done_cv;
+  std::size_t _generation = 0;
+  std::size_t _busy = 0;
+  bool _keep_alive = true;
+
+  const RangeFunc *_func = nullptr;
+  std::size_t _grain = 1;
+  std::size_t _steals = 0;
+};
+
+}
+}
@@ -0,0 +1,102 @@
+#include "tmrl/comm/capture.h"
+#include "tmrl/driver/tmsvr_client.h"
+#include "tmrl/utils/logger.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <csignal>
+
+/*
+ * Capture and replay of the TMSVR stream
+ *
+ * tmr_capture record <file> [--ip 127.0.0.1] [--duration sec] [--raw]
+ * tmr_capture replay <file> [--paced] [--repeat n]
+ *
+ * replay runs the bytes through Client, TmsvrClient and RobotState without a
+ * controller, as fast as possible unless --paced.
+ */
+
+static volatile std::sig_atomic_t g_quit = 0;
+static void on_signal(int) { g_quit = 1; }
+
+static int record(const std::string &path, const std::string &ip, double duration, bool delta)
+{
+  tmrl::comm::Capture capture;
+  if (!capture.open(path, delta)) return 1;
+
+  tmrl::driver::TmsvrClient client(ip);
+  client.client().set_capture(&capture);
+  client.start(1000);
+
+  auto t0 = std::chrono::steady_clock::now();
+  while (!g_quit) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    auto st = capture.stats();
+    std::cout << "t: " << t << " s, chunks: " << st.chunks << ", bytes: " << st.bytes
+      << ", file: " << st.file_bytes << ", dropped: " << st.dropped << std::endl;
+    if (duration > 0.0 && t >= duration) break;
+  }
+  client.stop();
+  client.client().set_capture(NULL);
+  capture.close();
+  return 0;
+}
+
+static int replay(const std::string &path, bool paced, int repeat)
+{
+  tmrl::driver::TmsvrClient client("127.0.0.1");
+  std::size_t feedback = 0;
+  client.set_feedback_callback([&feedback](const tmrl::driver::RobotState &) { ++feedback; });
+
+  for (int i = 0; i < repeat; ++i) {
+    tmrl::comm::ReplayStats st;
+    feedback = 0;
+    bool ok = tmrl::comm::replay_capture(path, client, paced, &st);
+    const double el = (st.elapsed > 0.0) ? st.elapsed : 1.0e-9;
+
+    std::cout << (ok ? "" : "(stopped) ")
+      << "chunks: " << st.chunks << ", bytes: " << st.bytes
+      << ", packets: " << st.packets << ", partial: " << st.partial
+      << ", feedback: " << feedback
+      << ", capture: " << st.duration << " s, replay: " << st.elapsed << " s, "
+      << 1.0e-6 * st.bytes / el << " MB/s, "
+      << st.packets / el << " packets/s, "
+      << (st.packets ? 1.0e9 * el / st.packets : 0.0) << " ns/packet" << std::endl;
+    if (!ok) return 1;
+  }
+  client.robot_state.print();
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0] << " record <file> [--ip ip] [--duration sec] [--raw]\n"
+      "       " << argv[0] << " replay <file> [--paced] [--repeat n]\n";
+    return 1;
+  }
+  std::string mode = argv[1];
+  std::string path = argv[2];
+  std::string ip = "127.0.0.1";
+  double duration = 0.0;
+  bool delta = true;
+  bool paced = false;
+  int repeat = 1;
+
+  for (int i = 3; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string val = (i + 1 < argc) ? argv[i + 1] : "";
+    if (arg == "--ip") { ip = val; ++i; }
+    else if (arg == "--duration") { duration = atof(val.c_str()); ++i; }
+    else if (arg == "--repeat") { repeat = atoi(val.c_str()); ++i; }
+    else if (arg == "--raw") { delta = false; }
+    else if (arg == "--paced") { paced = true; }
+  }
+  std::signal(SIGINT, on_signal);
+
+  if (mode == "record") return record(path, ip, duration, delta);
+  if (mode == "replay") return replay(path, paced, repeat);
+  std::cout << "unknown mode: " << mode << "\n";
+  return 1;
+}
@@ -0,0 +1,342 @@
+#include "tmrl/comm/capture.h"
+#include "tmrl/utils/clock.h"
+#include "tmrl/utils/logger.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+namespace tmrl
+{
+namespace comm
+{
+
+static const char CAP_MAGIC[8] = { 'T', 'M', 'R', 'L', 'C', 'A', 'P', '1' };
+
+static void put_varint(std::string &s, std::size_t v)
+{
+  while (v >= 0x80) {
+    s.push_back((char)(0x80 | (v & 0x7f)));
+    v >>= 7;
+  }
+  s.push_back((char)(v));
+}
+static bool get_varint(const std::string &s, std::size_t &i, std::size_t &v)
+{
+  v = 0;
+  for (int shift = 0; i < s.size() && shift < 64; shift += 7) {
+    unsigned char c = (unsigned char)(s[i++]);
+    v |= (std::size_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+//
+// Capture
+//
+
+bool Capture::open(const std::string &path, bool delta, std::size_t max_pending)
+{
+  close();
+
+  _fp = std::fopen(path.c_str(), "wb");
+  if (!_fp) {
+    tmrl_ERROR_STREAM("TM_COM: capture, can not open " << path);
+    return false;
+  }
+  _flags = delta ? DELTA : 0;
+  std::fwrite(CAP_MAGIC, 1, sizeof(CAP_MAGIC), _fp);
+  std::fwrite(&_flags, 4, 1, _fp);
+
+  _max_pending = max_pending;
+  _pending.clear();
+  _prev.clear();
+  _chunks = 0;
+  _bytes = 0;
+  _file_bytes = sizeof(CAP_MAGIC) + 4;
+  _dropped = 0;
+  _t0 = std::chrono::steady_clock::now();
+
+  _keep_alive = true;
+  _thd = std::thread(std::bind(&Capture::run, this));
+  tmrl_INFO_STREAM("TM_COM: capture to " << path);
+  return true;
+}
+void Capture::close()
+{
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    _keep_alive = false;
+  }
+  _cv.notify_all();
+  if (_thd.joinable()) _thd.join();
+  if (_fp) {
+    std::fclose(_fp);
+    _fp = nullptr;
+  }
+}
+
+Capture::Stats Capture::stats() const
+{
+  Stats rv;
+  rv.chunks = _chunks;
+  rv.bytes = _bytes;
+  rv.file_bytes = _file_bytes;
+  rv.dropped = _dropped;
+  return rv;
+}
+
+void Capture::write(const char *bytes, std::size_t len)
+{
+  if (!_keep_alive || len == 0) return;
+
+  unsigned long long t = (unsigned long long)(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - _t0).count());
+  unsigned len32 = (unsigned)(len);
+
+  // no notify, the writer wakes up by itself
+  std::unique_lock<std::mutex> lck(_mtx);
+  if (_pending.size() + 12 + len > _max_pending) {
+    ++_dropped;
+    return;
+  }
+  _pending.append((const char *)&t, 8);
+  _pending.append((const char *)&len32, 4);
+  _pending.append(bytes, len);
+}
+
+void Capture::write_record(const char *rec, std::size_t len)
+{
+  const char *bytes = rec + 12;
+  unsigned char kind = 0;
+
+  if ((_flags & DELTA) && _prev.size() == len) {
+    _enc.clear();
+    std::size_t i = 0;
+    while (i < len && _enc.size() < len) {
+      std::size_t z = i;
+      while (z < len && bytes[z] == _prev[z]) { ++z; }
+      // literal run, until 4 equal bytes in a row
+      std::size_t e = z, same = 0;
+      while (e < len && same < 4) {
+        same = (bytes[e] == _prev[e]) ? same + 1 : 0;
+        ++e;
+      }
+      e -= same;
+      put_varint(_enc, z - i);
+      put_varint(_enc, e - z);
+      for (std::size_t k = z; k < e; ++k) { _enc.push_back((char)(bytes[k] ^ _prev[k])); }
+      i = e;
+    }
+    if (_enc.size() < len) kind = 1;
+  }
+  const std::string *stored = nullptr;
+  unsigned stored_len = (unsigned)(len);
+  if (kind == 1) {
+    stored = &_enc;
+    stored_len = (unsigned)(_enc.size());
+  }
+
+  std::fwrite(rec, 1, 12, _fp);
+  std::fwrite(&kind, 1, 1, _fp);
+  std::fwrite(&stored_len, 4, 1, _fp);
+  std::fwrite(stored ? stored->data() : bytes, 1, stored_len, _fp);
+
+  _prev.assign(bytes, len);
+  ++_chunks;
+  _bytes += len;
+  _file_bytes += 17 + stored_len;
+}
+
+void Capture::run()
+{
+  std::string batch;
+  bool alive = true;
+
+  while (alive) {
+    {
+      std::unique_lock<std::mutex> lck(_mtx);
+      _cv.wait_for(lck, std::chrono::milliseconds(20), [this] { return !_keep_alive; });
+      alive = _keep_alive;
+      batch.swap(_pending);
+    }
+    std::size_t i = 0;
+    while (i + 12 <= batch.size()) {
+      unsigned len32 = 0;
+      memcpy(&len32, batch.data() + i + 8, 4);
+      write_record(batch.data() + i, len32);
+      i += 12 + len32;
+    }
+    batch.clear();
+    std::fflush(_fp);
+  }
+}
+
+//
+// CaptureReader
+//
+
+bool CaptureReader::open(const std::string &path)
+{
+  close();
+
+  _fp = std::fopen(path.c_str(), "rb");
+  if (!_fp) {
+    tmrl_ERROR_STREAM("TM_COM: capture, can not open " << path);
+    return false;
+  }
+  char magic[8];
+  if (std::fread(magic, 1, 8, _fp) != 8 || memcmp(magic, CAP_MAGIC, 8) != 0 ||
+    std::fread(&_flags, 4, 1, _fp) != 1) {
+    tmrl_ERROR_STREAM("TM_COM: capture, " << path << " is not a capture file");
+    close();
+    return false;
+  }
+  _prev.clear();
+  return true;
+}
+void CaptureReader::close()
+{
+  if (_fp) {
+    std::fclose(_fp);
+    _fp = nullptr;
+  }
+}
+
+bool CaptureReader::next(Chunk &chunk)
+{
+  if (!_fp) return false;
+
+  unsigned long long t = 0;
+  unsigned len = 0, stored_len = 0;
+  unsigned char kind = 0;
+  if (std::fread(&t, 8, 1, _fp) != 1 ||
+    std::fread(&len, 4, 1, _fp) != 1 ||
+    std::fread(&kind, 1, 1, _fp) != 1 ||
+    std::fread(&stored_len, 4, 1, _fp) != 1) {
+    return false;
+  }
+  _stored.resize(stored_len);
+  if (stored_len && std::fread(&_stored[0], 1, stored_len, _fp) != stored_len) return false;
+
+  chunk.time_ns = (long long)(t);
+  if (kind == 0) {
+    if (stored_len != len) return false;
+    chunk.bytes = _stored;
+  }
+  else if (kind == 1) {
+    if (_prev.size() != len) return false;
+    chunk.bytes = _prev;
+    std::size_t i = 0, pos = 0;
+    while (i < _stored.size()) {
+      std::size_t z = 0, n = 0;
+      if (!get_varint(_stored, i, z) || !get_varint(_stored, i, n)) return false;
+      pos += z;
+      if (pos + n > len || i + n > _stored.size()) return false;
+      for (std::size_t k = 0; k < n; ++k) { chunk.bytes[pos + k] ^= _stored[i + k]; }
+      pos += n;
+      i += n;
+    }
+  }
+  else {
+    tmrl_ERROR_STREAM("TM_COM: capture, unknown record kind " << (int)(kind));
+    return false;
+  }
+  _prev = chunk.bytes;
+  return true;
+}
+
+//
+// replay
+//
+
+#ifndef _WIN32
+static bool send_all(int fd, const char *bytes, std::size_t len)
+{
+  std::size_t ntotal = 0;
+  while (ntotal < len) {
+    ssize_t nb = send(fd, bytes + ntotal, len - ntotal, MSG_NOSIGNAL);
+    if (nb < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    ntotal += (std::size_t)(nb);
+  }
+  return true;
+}
+#endif
+
+bool replay_capture(const std::string &path, ClientThread &client, bool paced, ReplayStats *stats)
+{
+#ifdef _WIN32
+  tmrl_ERROR_STREAM("TM_COM: capture replay is not supported on windows");
+  return false;
+#else
+  CaptureReader reader;
+  if (!reader.open(path)) return false;
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    tmrl_ERROR_STREAM("TM_COM: capture replay, socketpair failed");
+    return false;
+  }
+  Client &c = client.client();
+  const int sockfd = c.socket_fd();
+  c.socket_fd(fds[1]);
+  c.init_receiver();
+
+  ReplayStats st;
+  CaptureReader::Chunk chunk;
+  utils::SteadyClock &clock = utils::SteadyClock::instance();
+  const auto t0 = clock.now();
+  bool ok = true;
+
+  while (ok && reader.next(chunk)) {
+    if (paced) clock.sleep_until(t0 + std::chrono::nanoseconds(chunk.time_ns));
+
+    if (!send_all(fds[0], chunk.bytes.data(), chunk.bytes.size())) {
+      ok = false;
+      break;
+    }
+    // spin until the chunk is read, as the client thread would
+    std::size_t left = chunk.bytes.size();
+    while (left > 0) {
+      int n = 0;
+      RetCode rc = c.receiver_spin_once(0, &n);
+      if (rc == RetCode::OK) {
+        st.packets += c.packet_vector().size();
+        client.dispatch();
+      }
+      else if (rc == RetCode::NOVALIDPACK) {
+        ++st.partial;
+      }
+      else {
+        ok = false;
+        break;
+      }
+      left -= ((std::size_t)(n) < left) ? (std::size_t)(n) : left;
+    }
+    ++st.chunks;
+    st.bytes += chunk.bytes.size();
+    st.duration = 1.0e-9 * (double)(chunk.time_ns);
+  }
+  st.elapsed = std::chrono::duration<double>(clock.now() - t0).count();
+
+  c.socket_fd(sockfd);
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  if (!ok) tmrl_ERROR_STREAM("TM_COM: capture replay, stopped at chunk " << st.chunks);
+  if (stats) *stats = st;
+  return ok;
+#endif
+}
+
+}
+}
@@ -1,4 +1,5 @@
 #include "tmrl/comm/client.h"
+#include "tmrl/comm/capture.h"
 #include "tmrl/comm/sbuffer.h"
 #include "tmrl/utils/logger.h"
 
@@ -22,7 +23,13 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
 #endif
+#endif
+
+#include <algorithm>
+#include <cstdint>
 
 namespace tmrl
 {
@@ -44,10 +51,12 @@ public:
   explicit RecvBuf(int recv_buf_len);
   ~RecvBuf();
 
-  bool init(int sockfd);
+  // wake_fd (or -1) readable: spin_once returns NOTREADY
+  bool init(int sockfd, int wake_fd = -1);
   RetCode spin_once(int timeval_ms, int *n = NULL);
   void commit_spin_once();
   SBuffer & buffer() { return _sbuf; }
+  void set_capture(Capture *capture) { _capture = capture; }
 
 private:
 
@@ -57,12 +66,16 @@ private:
   int   _recv_buf_len = 0;
 
   int    _sockfd = -1;
+  int    _wake_fd = -1;
   fd_set _masterfs;
   fd_set _readfs;
 
   int     _rn = 0;
   RetCode _rc = RetCode::OK;
 
+  // set from any thread
+  std::atomic<Capture *> _capture{NULL};
+
 };
 
 // RecvBuf
@@ -85,16 +98,18 @@ RecvBuf::~RecvBuf()
 
   delete _recv_buf;
 }
-bool RecvBuf::init(int sockfd)
+bool RecvBuf::init(int sockfd, int wake_fd)
 {
   if (sockfd <= 0) return false;
 
   _sbuf.clear();
   _sockfd = sockfd;
+  _wake_fd = wake_fd;
 
   FD_ZERO(&_masterfs);
 
   FD_SET(sockfd, &_masterfs);
+  if (wake_fd >= 0) FD_SET(wake_fd, &_masterfs);
 
   _rc = RetCode::OK;
   return true;
@@ -116,7 +131,7 @@ RetCode RecvBuf::spin_once(int timeval_ms, int *n)
 
   _readfs = _masterfs; // re-init
 
-  rv = select(_sockfd + 1, &_readfs, NULL, NULL, &tv);
+  rv = select(std::max(_sockfd, _wake_fd) + 1, &_readfs, NULL, NULL, &tv);
 
   if (n) *n = 0;
 
@@ -126,6 +141,10 @@ RetCode RecvBuf::spin_once(int timeval_ms, int *n)
   else if (rv == 0) {
     rc = RetCode::TIMEOUT;
   }
+  else if (_wake_fd >= 0 && FD_ISSET(_wake_fd, &_readfs)) {
+    // woken up, the client drains it
+    rc = RetCode::NOTREADY;
+  }
   else if (FD_ISSET(_sockfd, &_readfs)) {
     nb = recv(_sockfd, _recv_buf, _recv_buf_len, 0);
 
@@ -140,6 +159,8 @@ RetCode RecvBuf::spin_once(int timeval_ms, int *n)
     else {
       // recv n bytes
       _sbuf.append(_recv_buf, nb);
+      Capture *capture = _capture.load(std::memory_order_acquire);
+      if (capture) capture->write(_recv_buf, nb);
 
       if (n) *n = nb;
     }
@@ -156,6 +177,70 @@ void RecvBuf::commit_spin_once()
   _sbuf.pop_front(_rn);
 }
 
+// WakeFd
+
+WakeFd::WakeFd()
+{
+#if defined(__linux__)
+  _rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _wfd = _rfd;
+#elif !defined(_WIN32)
+  int fds[2];
+  if (pipe(fds) == 0) {
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+    _rfd = fds[0];
+    _wfd = fds[1];
+  }
+#endif
+}
+WakeFd::~WakeFd()
+{
+#ifndef _WIN32
+  if (_wfd >= 0 && _wfd != _rfd) close(_wfd);
+  if (_rfd >= 0) close(_rfd);
+#endif
+}
+void WakeFd::wake()
+{
+#ifndef _WIN32
+  if (_wfd < 0) return;
+  // eventfd takes 8 bytes, a pipe 1 (a full pipe is woken already)
+  uint64_t one = 1;
+  ssize_t rv = write(_wfd, &one, (_wfd == _rfd) ? sizeof(one) : 1);
+  (void)(rv);
+#endif
+}
+bool WakeFd::drain()
+{
+#ifndef _WIN32
+  if (_rfd < 0) return false;
+  uint64_t buf[8];
+  bool woken = false;
+  while (read(_rfd, buf, sizeof(buf)) > 0) { woken = true; }
+  return woken;
+#else
+  return false;
+#endif
+}
+bool WakeFd::wait(int timeout_ms)
+{
+  if (timeout_ms < 0) timeout_ms = 0;
+  if (_rfd < 0) {
+    // nothing to wait on, short steps so the caller checks its flags
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::min(timeout_ms, 10)));
+    return false;
+  }
+  fd_set rset;
+  timeval tv;
+  FD_ZERO(&rset);
+  FD_SET(_rfd, &rset);
+  tv.tv_sec = (timeout_ms / 1000);
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  if (select(_rfd + 1, &rset, NULL, NULL, &tv) <= 0) return false;
+  return drain();
+}
+
 // Client
 
 Client::Client(const std::string &ip, unsigned short port, size_t buffer_size)
@@ -185,15 +270,61 @@ Client::~Client()
   tmrl_DEBUG_STREAM("tmrl::comm::Client::~Client");
   delete _recv;
 }
+void Client::set_keepalive(int idle_ms, int interval_ms, int count)
+{
+  _keepalive_idle_ms = idle_ms;
+  _keepalive_interval_ms = interval_ms;
+  _keepalive_count = count;
+  if (_sockfd > 0) _set_link_opts();
+}
+void Client::set_user_timeout(int timeout_ms)
+{
+  _user_timeout_ms = timeout_ms;
+  if (_sockfd > 0) _set_link_opts();
+}
+void Client::_set_link_opts()
+{
+  int on = (_keepalive_idle_ms > 0) ? 1 : 0;
+  if (setsockopt(_sockfd, SOL_SOCKET, SO_KEEPALIVE, (char *)&on, sizeof(on)) < 0) {
+    tmrl_WARN_STREAM("TM_COM: setsockopt SO_KEEPALIVE failed");
+  }
+#ifndef _WIN32
+  if (on) {
+    // whole seconds, at least 1
+    int idle = std::max(1, (_keepalive_idle_ms + 999) / 1000);
+    int intvl = std::max(1, (_keepalive_interval_ms + 999) / 1000);
+    int cnt = std::max(1, _keepalive_count);
+#if defined(TCP_KEEPIDLE)
+    setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPIDLE, (char *)&idle, sizeof(idle));
+#elif defined(TCP_KEEPALIVE)
+    setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPALIVE, (char *)&idle, sizeof(idle));
+#endif
+#ifdef TCP_KEEPINTVL
+    setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPINTVL, (char *)&intvl, sizeof(intvl));
+#endif
+#ifdef TCP_KEEPCNT
+    setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPCNT, (char *)&cnt, sizeof(cnt));
+#endif
+    (void)(idle); (void)(intvl); (void)(cnt);
+  }
+#ifdef TCP_USER_TIMEOUT
+  unsigned int uto = (unsigned int)(std::max(0, _user_timeout_ms));
+  if (setsockopt(_sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, (char *)&uto, sizeof(uto)) < 0) {
+    tmrl_WARN_STREAM("TM_COM: setsockopt TCP_USER_TIMEOUT failed");
+  }
+#endif
+#endif
+}
 int Client::_connect(int sockfd, const char *ip, unsigned short port, int timeout_ms)
 {
   int rv = 0;
   int flags = 0;
   int err = 0;
-  int err_len = 0;
+  int err_len = sizeof(err);
   sockaddr_in addr;
   timeval tv;
   fd_set wset;
+  fd_set rset;
 
   tmrl_INFO_STREAM("TM_COM: ip:=" << ip);
 
@@ -206,6 +337,8 @@ int Client::_connect(int sockfd, const char *ip, unsigned short port, int timeou
 
   FD_ZERO(&wset);
   FD_SET(sockfd, &wset);
+  FD_ZERO(&rset);
+  if (_wake.fd() >= 0) FD_SET(_wake.fd(), &rset);
 
 #ifndef _WIN32
   //Get Flag of Fcntl
@@ -213,21 +346,33 @@ int Client::_connect(int sockfd, const char *ip, unsigned short port, int timeou
     tmrl_WARN_STREAM("TM_COM: The flag of fcntl is not ok");
     return -1;
   }
+  // connect in the background, select waits for it, the timeout or a wake
+  fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
 #endif
 
   rv = connect(sockfd, (sockaddr *)&addr, 16);
   tmrl_INFO_STREAM("TM_COM: rv:=" << rv);
 
   if (rv < 0) {
-    if (errno != EINPROGRESS) return -1;
+#ifndef _WIN32
+    if (errno != EINPROGRESS) {
+      fcntl(sockfd, F_SETFL, flags);
+      return -1;
+    }
+#else
+    return -1;
+#endif
   }
   if (rv == 0) {
     tmrl_INFO_STREAM("TM_COM: Connection is ok");
-    return rv;
   }
   else {
-    //Wait for Connect OK by checking Write buffer
-    if ((rv = select(sockfd + 1, NULL, &wset, NULL, &tv)) < 0) {
+    //Wait for Connect OK by checking Write buffer, timeout_ms <= 0: no timeout
+    rv = select(std::max(sockfd, _wake.fd()) + 1, &rset, &wset, NULL, (timeout_ms > 0) ? &tv : NULL);
+#ifndef _WIN32
+    fcntl(sockfd, F_SETFL, flags);
+#endif
+    if (rv < 0) {
       return rv;
     }
     if (rv == 0) {
@@ -235,6 +380,12 @@ int Client::_connect(int sockfd, const char *ip, unsigned short port, int timeou
       //errno = ETIMEDOUT;
       return -1;
     }
+    if (_wake.fd() >= 0 && FD_ISSET(_wake.fd(), &rset)) {
+      // consumed, the next Connect waits again
+      _wake.drain();
+      tmrl_INFO_STREAM("TM_COM: Connection interrupted");
+      return -1;
+    }
     if (FD_ISSET(sockfd, &wset)) {
 #ifdef _WIN32
       if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (char*)&err, &err_len) < 0) {
@@ -255,6 +406,7 @@ int Client::_connect(int sockfd, const char *ip, unsigned short port, int timeou
       tmrl_ERROR_STREAM("TM_COM: Connection error");
       return -1;
     }
+    rv = 0;
   }
   return rv;
 }
@@ -308,6 +460,7 @@ bool Client::Connect(int timeout_ms)
     tmrl_WARN_STREAM("TM_COM: setsockopt SO_SNDTIMEO failed");
   }
 #endif
+  _set_link_opts();
 
   if (_connect(_sockfd, _ip.c_str(), _port, timeout_ms) == 0) {
     tmrl_INFO_STREAM("TM_COM: O_NONBLOCK connection is ok");
@@ -420,9 +573,13 @@ bool Client::init_receiver()
 {
   _ok_last = false;
   _incomplete_cnt = 0;
-  _recv_ready = _recv->init(_sockfd);
+  _recv_ready = _recv->init(_sockfd, _wake.fd());
   return _recv_ready;
 }
+void Client::set_capture(Capture *capture)
+{
+  _recv->set_capture(capture);
+}
 RetCode Client::receiver_spin_once(int timeval_ms, int *n)
 {
   RetCode rc = RetCode::OK;
@@ -433,6 +590,8 @@ RetCode Client::receiver_spin_once(int timeval_ms, int *n)
 
   if (n) *n = nb;
 
+  if (rc == RetCode::NOTREADY) _wake.drain();
+
   if (rc != RetCode::OK) {
     _recv_rc = rc;
     return rc;
@@ -526,7 +685,13 @@ ClientThread::~ClientThread()
 }
 bool ClientThread::start(int timeout_ms)
 {
+  if (_loop) {
+    tmrl_ERROR_STREAM(_hdr << ": served by an IoLoop, start the loop");
+    return false;
+  }
   stop();
+  _client.clear_wake();
+  _reconnect_delay_ms = 0;
   bool rb = _client.Connect(timeout_ms);
   _keep_alive = true;
   _thd = std::thread{std::bind(&ClientThread::run, this)};
@@ -539,74 +704,204 @@ bool ClientThread::start()
 void ClientThread::stop()
 {
   _keep_alive = false;
+  // out of select, the backoff or a connect
+  _client.wake();
   if (_thd.joinable())
     _thd.join();
 }
+bool ClientThread::wait_connected(int timeout_ms)
+{
+  std::unique_lock<std::mutex> lck(_conn_mtx);
+  return _conn_cv.wait_for(lck, std::chrono::milliseconds(std::max(0, timeout_ms)),
+    [this] { return _connected; });
+}
+void ClientThread::set_connected(bool connected)
+{
+  {
+    std::unique_lock<std::mutex> lck(_conn_mtx);
+    _connected = connected;
+  }
+  _conn_cv.notify_all();
+}
 void ClientThread::run()
 {
   tmrl_INFO_STREAM(_hdr << ": thread begin");
 
   while (isOk()) {
-    if (!_client.init_receiver()) {
-      tmrl_INFO_STREAM(_hdr << ": is not connected");
-    }
-    _reconnect = false;
-    RetCode rc_last = RetCode::OK;
+    session_open();
     while (isOk() && _client.is_connected()) {
-      int n;
-      auto rc = _client.receiver_spin_once(1000, &n);
-      //tmrl_DEBUG_STREAM(_hdr << ": rc: " << (int)(rc) << " n: " << n);
-      if (_reconnect ||
-          rc == RetCode::ERR ||
-          rc == RetCode::NOTREADY ||
-          rc == RetCode::NOTCONNECT) {
+      if (!session_spin(session_timeout_ms(std::chrono::steady_clock::now()))) {
         break;
       }
-      if (rc == RetCode::TIMEOUT) {
-        if (_is_cyclic && rc_last == RetCode::TIMEOUT) {
-          break;
-        }
-      }
-      if (rc == RetCode::OK) {
-        //tmrl_DEBUG_STREAM(_hdr << ": pn: " << _client.packet_vector().size());
-        if (!receive(_client.packet_vector())) {
-          break;
-        }
-      }
-      rc_last = rc;
     }
-    _client.Close();
+    session_close();
 
     reconnect();
   }
-  _client.Close();
+  session_close();
   tmrl_INFO_STREAM(_hdr << ": thread end");
 }
+void ClientThread::session_open()
+{
+  if (!_client.init_receiver()) {
+    tmrl_INFO_STREAM(_hdr << ": is not connected");
+  }
+  else {
+    set_connected(true);
+  }
+  // a wake from before (set_reconnet while waiting to reconnect) is done with,
+  // left pending it would end the first spin of the new session
+  _client.clear_wake();
+  _reconnect = false;
+  watchdog_reset();
+  _rx_last = std::chrono::steady_clock::now();
+}
+bool ClientThread::session_spin(int timeout_ms)
+{
+  int n = 0;
+  auto rc = _client.receiver_spin_once(timeout_ms, &n);
+  //tmrl_DEBUG_STREAM(_hdr << ": rc: " << (int)(rc) << " n: " << n);
+  if (_reconnect ||
+      rc == RetCode::ERR ||
+      rc == RetCode::NOTREADY ||
+      rc == RetCode::NOTCONNECT) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (n > 0) _rx_last = now;
+  if (rc == RetCode::OK) {
+    // the connection works, next reconnect right away
+    _reconnect_delay_ms = 0;
+    //tmrl_DEBUG_STREAM(_hdr << ": pn: " << _client.packet_vector().size());
+    if (!receive(_client.packet_vector())) {
+      return false;
+    }
+  }
+  return session_check(now);
+}
+bool ClientThread::session_check(std::chrono::steady_clock::time_point now)
+{
+  if (_wd_armed && watchdog_left_ms(now) <= 0) {
+    double gap = std::chrono::duration<double>(now - _wd_last).count();
+    tmrl_WARN_STREAM(_hdr << ": stream stalled, no packet for " << 1000.0 * gap
+      << " ms (period " << 1000.0 * _wd_period << " ms), reconnect");
+    if (_stallCallback) _stallCallback(gap);
+    // no backoff, the link was fine until now
+    _reconnect_delay_ms = 0;
+    return false;
+  }
+  // a cyclic stream that is silent for 2 s is gone
+  if (_is_cyclic && now - _rx_last >= std::chrono::milliseconds(2000)) {
+    return false;
+  }
+  return true;
+}
+int ClientThread::session_timeout_ms(std::chrono::steady_clock::time_point now) const
+{
+  int ms = 1000;
+  int left = watchdog_left_ms(now);
+  if (left >= 0) ms = std::min(ms, left + 1);
+  if (_is_cyclic) {
+    int silent = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now - _rx_last).count());
+    ms = std::min(ms, std::max(0, 2000 - silent) + 1);
+  }
+  return ms;
+}
+void ClientThread::session_close()
+{
+  set_connected(false);
+  _client.Close();
+}
+void ClientThread::set_stall_periods(double periods, double min_sec)
+{
+  _stall_periods = periods;
+  _stall_min = min_sec;
+  if (periods > 0.0) {
+    // until the period is known, match the 2 x 1 s fallback of run()
+    _client.set_keepalive(1000, 1000, 2);
+    _client.set_user_timeout(2000);
+  }
+  else {
+    _client.set_keepalive(0, 0, 0);
+    _client.set_user_timeout(0);
+  }
+}
+void ClientThread::watchdog_reset()
+{
+  // the period stays, the controller streams at the same rate
+  _wd_started = false;
+  _wd_armed = false;
+}
+void ClientThread::watchdog_kick(int n)
+{
+  if (_stall_periods <= 0.0 || n <= 0) return;
+
+  auto now = std::chrono::steady_clock::now();
+  // the first packet of a connection only starts the clock
+  if (_wd_started) {
+    // packets read together arrived one period apart
+    double dt = std::chrono::duration<double>(now - _wd_last).count() / n;
+    if (_wd_samples == 0) {
+      _wd_period = dt;
+      ++_wd_samples;
+    }
+    else if (_wd_samples < 8 || dt > 0.25 * _wd_period) {
+      // once learned, a backlog read packet by packet is not the rate
+      _wd_period += (dt - _wd_period) / 8.0;
+      ++_wd_samples;
+    }
+  }
+  _wd_started = true;
+  _wd_last = now;
+
+  if (!_wd_armed && _wd_samples >= 8) {
+    _wd_armed = true;
+    int to_ms = (int)(1000.0 * std::max(_stall_periods * _wd_period, _stall_min));
+    // a lost segment is retransmitted after 200 ms at the earliest
+    _client.set_user_timeout(std::max(to_ms, 500));
+    tmrl_INFO_STREAM(_hdr << ": stream period " << 1000.0 * _wd_period
+      << " ms, stall after " << to_ms << " ms");
+  }
+  if (_wd_armed) _wd_period_pub = _wd_period;
+}
+int ClientThread::watchdog_left_ms(std::chrono::steady_clock::time_point now) const
+{
+  if (!_wd_armed) return -1;
+  double to = std::max(_stall_periods * _wd_period, _stall_min);
+  double left = to - std::chrono::duration<double>(now - _wd_last).count();
+  return std::max(0, (int)(1000.0 * left));
+}
+int ClientThread::reconnect_delay()
+{
+  const int tv = _reconnect_timeval_ms;
+  if (tv < 0) return -1;
+
+  // backoff: 0, 50, 100, ... up to tv
+  const int delay = _reconnect_delay_ms;
+  _reconnect_delay_ms = (delay == 0) ? std::min(50, tv) : std::min(2 * delay, tv);
+  return delay;
+}
 void ClientThread::reconnect()
 {
   if (!isOk()) return;
 
-  const int tv = _reconnect_timeval_ms;
   const int to = _reconnect_timeout_ms;
+  const int delay = reconnect_delay();
 
-  if (tv < 0) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  if (delay < 0) {
+    _client.wait_wake(100);
     return;
   }
-  else if (tv >= 0 && tv < 100) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  }
-  tmrl_INFO_STREAM(_hdr << ": reconnect in ");
-  int cnt = 0;
-  while (isOk() && cnt < tv) {
-    if (cnt % 500 == 0) {
-      tmrl_INFO_STREAM(0.001 * (tv - cnt) << " sec...");
+  if (delay > 0) {
+    tmrl_INFO_STREAM(_hdr << ": reconnect in " << 0.001 * delay << " sec...");
+    auto t_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+    while (isOk()) {
+      int left = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(
+        t_end - std::chrono::steady_clock::now()).count());
+      if (left <= 0 || _client.wait_wake(left)) break;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    cnt += 10;
   }
-  if (isOk() && tv >= 0) {
-    tmrl_INFO_STREAM("0 sec.");
+  if (isOk()) {
     tmrl_INFO_STREAM(_hdr << ": connect( " << to << " ms )...");
     _client.Connect(to);
   }
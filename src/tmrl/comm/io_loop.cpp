@@ -0,0 +1,234 @@
+#include "tmrl/comm/io_loop.h"
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <errno.h>
+#include <sys/select.h>
+#endif
+
+namespace tmrl
+{
+namespace comm
+{
+
+using Clock = std::chrono::steady_clock;
+
+IoLoop::IoLoop()
+{
+}
+IoLoop::~IoLoop()
+{
+  stop();
+}
+
+bool IoLoop::add(ClientThread &client)
+{
+  if (_keep_alive || client._loop || client._thd.joinable()) return false;
+
+  client._loop = this;
+  _entries.emplace_back(new Entry);
+  _entries.back()->ct = &client;
+  return true;
+}
+bool IoLoop::remove(ClientThread &client)
+{
+  if (_keep_alive || client._loop != this) return false;
+
+  for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+    if ((*it)->ct == &client) {
+      _entries.erase(it);
+      client._loop = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IoLoop::start(int timeout_ms, std::vector<double> *times)
+{
+  stop();
+  tmrl_INFO_STREAM("TM_COM: io loop start, " << _entries.size() << " clients");
+
+  const auto time_start = Clock::now();
+  for (auto &pe : _entries) {
+    ClientThread &ct = *pe->ct;
+    ct._keep_alive = true;
+    ct._client.clear_wake();
+    ct._reconnect_delay_ms = 0;
+    connect(*pe, timeout_ms);
+  }
+  // all connect at once, wait for the slowest
+  bool rb = true;
+  if (times) times->assign(_entries.size(), -1.0);
+  for (std::size_t i = 0; i < _entries.size(); ++i) {
+    Entry &e = *_entries[i];
+    finish_connect(e, Clock::now());
+    if (e.state == State::OPEN) {
+      if (times) (*times)[i] = std::chrono::duration<double>(e.done_at - time_start).count();
+    }
+    else {
+      rb = false;
+    }
+  }
+  _keep_alive = true;
+  _thd = std::thread(std::bind(&IoLoop::run, this));
+  return rb;
+}
+void IoLoop::stop()
+{
+  _keep_alive = false;
+  _wake.wake();
+  if (_thd.joinable()) _thd.join();
+}
+
+void IoLoop::connect(Entry &e, int timeout_ms)
+{
+  e.state = State::CONNECTING;
+  e.done = false;
+  e.connected = false;
+  // a wake while waiting (set_reconnet) would abort the connect
+  e.ct->_client.clear_wake();
+  Entry *pe = &e;
+  e.connector = std::thread([this, pe, timeout_ms] {
+    pe->connected = pe->ct->_client.Connect(timeout_ms);
+    pe->done_at = Clock::now();
+    pe->done = true;
+    _wake.wake();
+  });
+}
+void IoLoop::finish_connect(Entry &e, Clock::time_point now)
+{
+  if (e.connector.joinable()) e.connector.join();
+
+  ClientThread &ct = *e.ct;
+  if (e.connected && ct.isOk()) {
+    ct.session_open();
+    e.state = State::OPEN;
+    return;
+  }
+  if (e.connected) ct.session_close();
+  schedule(e, now);
+}
+void IoLoop::schedule(Entry &e, Clock::time_point now)
+{
+  ClientThread &ct = *e.ct;
+  const int delay = ct.isOk() ? ct.reconnect_delay() : -1;
+  if (delay < 0) {
+    e.state = State::IDLE;
+    return;
+  }
+  if (delay > 0) {
+    tmrl_INFO_STREAM(ct._hdr << ": reconnect in " << 0.001 * delay << " sec...");
+  }
+  e.state = State::WAIT;
+  e.next = now + std::chrono::milliseconds(delay);
+}
+
+void IoLoop::run()
+{
+  tmrl_INFO_STREAM("TM_COM: io loop begin");
+
+  while (_keep_alive) {
+    auto now = Clock::now();
+    int timeout_ms = 100;
+    fd_set rset;
+    int maxfd = -1;
+    FD_ZERO(&rset);
+    auto watch = [&rset, &maxfd](int fd) {
+      if (fd < 0) return;
+      FD_SET(fd, &rset);
+      maxfd = std::max(maxfd, fd);
+    };
+    watch(_wake.fd());
+
+    for (auto &pe : _entries) {
+      Entry &e = *pe;
+      ClientThread &ct = *e.ct;
+      if (e.state == State::CONNECTING && e.done) {
+        finish_connect(e, now);
+      }
+      if (e.state == State::OPEN && !ct.isOk()) {
+        // the client was stopped
+        ct.session_close();
+        e.state = State::IDLE;
+      }
+      if (e.state == State::WAIT) {
+        if (!ct.isOk()) {
+          e.state = State::IDLE;
+        }
+        else if (now >= e.next) {
+          tmrl_INFO_STREAM(ct._hdr << ": connect( " << ct._reconnect_timeout_ms << " ms )...");
+          connect(e, ct._reconnect_timeout_ms);
+        }
+        else {
+          int left = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(e.next - now).count());
+          timeout_ms = std::min(timeout_ms, left + 1);
+        }
+      }
+      if (e.state == State::OPEN) {
+        watch(ct._client.socket_fd());
+        watch(ct._client.wake_fd());
+        timeout_ms = std::min(timeout_ms, ct.session_timeout_ms(now));
+      }
+    }
+
+    if (maxfd < 0) {
+      // no wake fd and nothing open (windows)
+      std::this_thread::sleep_for(std::chrono::milliseconds(std::min(timeout_ms, 10)));
+      continue;
+    }
+    timeval tv;
+    tv.tv_sec = (timeout_ms / 1000);
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int rv = select(maxfd + 1, &rset, NULL, NULL, &tv);
+    if (rv < 0) {
+#ifndef _WIN32
+      if (errno == EINTR) continue;
+#endif
+      tmrl_ERROR_STREAM("TM_COM: io loop select failed");
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    if (rv > 0 && _wake.fd() >= 0 && FD_ISSET(_wake.fd(), &rset)) {
+      _wake.drain();
+    }
+
+    now = Clock::now();
+    for (auto &pe : _entries) {
+      Entry &e = *pe;
+      if (e.state != State::OPEN) continue;
+
+      ClientThread &ct = *e.ct;
+      const int sfd = ct._client.socket_fd();
+      const int wfd = ct._client.wake_fd();
+      bool ready = (rv > 0) && (FD_ISSET(sfd, &rset) || (wfd >= 0 && FD_ISSET(wfd, &rset)));
+      // readable: spin_once does not wait
+      bool keep = ready ? ct.session_spin(0) : ct.session_check(now);
+      if (!keep) {
+        ct.session_close();
+        schedule(e, now);
+      }
+    }
+  }
+
+  for (auto &pe : _entries) {
+    Entry &e = *pe;
+    if (e.state == State::CONNECTING) {
+      e.ct->_client.wake();
+      e.connector.join();
+      if (e.connected) e.ct->session_close();
+    }
+    else if (e.state == State::OPEN) {
+      e.ct->session_close();
+    }
+    e.state = State::IDLE;
+  }
+  tmrl_INFO_STREAM("TM_COM: io loop end");
+}
+
+}
+}
@@ -0,0 +1,134 @@
+#include "tmrl/comm/server.h"
+#include "tmrl/utils/logger.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+namespace tmrl
+{
+namespace comm
+{
+
+Server::Server(unsigned short port)
+  : _port(port)
+{
+}
+Server::~Server()
+{
+  close();
+}
+
+bool Server::listen(const std::string &ip, int backlog)
+{
+  if (_sockfd > 0) return true;
+
+  _sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_sockfd < 0) {
+    tmrl_ERROR_STREAM("TM_COM: Error socket");
+    return false;
+  }
+  int optflag = 1;
+  if (setsockopt(_sockfd, SOL_SOCKET, SO_REUSEADDR, (char *)&optflag, sizeof(optflag)) < 0) {
+    tmrl_WARN_STREAM("TM_COM: setsockopt SO_REUSEADDR failed");
+  }
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  inet_pton(AF_INET, ip.c_str(), &(addr.sin_addr));
+
+  if (bind(_sockfd, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(_sockfd, backlog) < 0) {
+    tmrl_ERROR_STREAM("TM_COM: listen on " << ip << ":" << _port << " failed");
+    close();
+    return false;
+  }
+  tmrl_INFO_STREAM("TM_COM: listen on " << ip << ":" << _port);
+  return true;
+}
+
+void Server::close()
+{
+  if (_sockfd <= 0) return;
+  close_fd(_sockfd);
+  _sockfd = -1;
+}
+
+int Server::accept(int timeout_ms)
+{
+  if (_sockfd <= 0) return -1;
+  if (wait_readable(_sockfd, timeout_ms) <= 0) return -1;
+
+  int fd = (int)(::accept(_sockfd, NULL, NULL));
+  if (fd < 0) return -1;
+
+  int optflag = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&optflag, sizeof(optflag)) < 0) {
+    tmrl_WARN_STREAM("TM_COM: setsockopt TCP_NODELAY failed");
+  }
+  return fd;
+}
+
+int Server::wait_readable(int fd, int timeout_ms)
+{
+  fd_set rset;
+  timeval tv;
+  FD_ZERO(&rset);
+  FD_SET(fd, &rset);
+  tv.tv_sec = (timeout_ms / 1000);
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+  int rv = select(fd + 1, &rset, NULL, NULL, &tv);
+  if (rv < 0) return -1;
+  return (rv > 0 && FD_ISSET(fd, &rset)) ? 1 : 0;
+}
+
+RetCode Server::send_all(int fd, const char *bytes, size_t len)
+{
+  size_t ntotal = 0;
+  while (ntotal < len) {
+#ifdef _WIN32
+    int nb = send(fd, bytes + ntotal, (int)(len - ntotal), 0);
+#else
+    int nb = send(fd, bytes + ntotal, len - ntotal, MSG_NOSIGNAL);
+#endif
+    if (nb < 0) {
+#ifndef _WIN32
+      if (errno == EINTR) continue;
+#endif
+      return RetCode::ERR;
+    }
+    ntotal += nb;
+  }
+  return RetCode::OK;
+}
+
+int Server::recv_some(int fd, char *buf, size_t len)
+{
+  return (int)(recv(fd, buf, (int)(len), 0));
+}
+
+void Server::close_fd(int fd)
+{
+  if (fd <= 0) return;
+#ifdef _WIN32
+  closesocket((SOCKET)fd);
+#else
+  ::close(fd);
+#endif
+}
+
+}
+}
@@ -2,6 +2,9 @@
 
 #include "tmrl/utils/logger.h"
 
+#include <algorithm>
+#include <thread>
+
 namespace tmrl
 {
 namespace driver
@@ -12,21 +15,73 @@ Driver::Driver(TmsvrClient &svr, TmsctClient &sct)
   , tmsvr(svr)
   , tmsct(sct)
   , _sim_pvt(svr.robot_state)
+  , _pvt_stream(sct, svr.robot_state)
+  , _pvt_session(sct)
 {
 }
 
 bool Driver::start(bool stick_play)
 {
+  return start(stick_play, -1);
+}
+bool Driver::start(bool stick_play, int timeout_ms, StartTiming *timing)
+{
+  using clock = std::chrono::steady_clock;
+
   halt();
   tmrl_INFO_STREAM("TM_DRV: start");
-  // connect to server
-  bool rb = tmsvr.start();
+  const auto time_start = clock::now();
+  auto since = [&time_start] { return std::chrono::duration<double>(clock::now() - time_start).count(); };
+  const int sct_to = (timeout_ms < 0) ? (int)(1000.0 * tmsct.reconnect_timeout()) : timeout_ms;
+  StartTiming tm;
+
+  // connect to listen node, next to the server
+  bool sct_ok = false;
+  std::thread sct_thd([&] {
+    sct_ok = tmsct.start(sct_to);
+    if (sct_ok) tm.tmsct = since();
+  });
+  // connect to server, its thread delivers feedback from now on
+  bool svr_ok = (timeout_ms < 0) ? tmsvr.start() : tmsvr.start(timeout_ms);
+  if (svr_ok) tm.tmsvr = since();
   // send command to play project
-  if (rb && stick_play) {
+  if (svr_ok && stick_play) {
     send_stick_play();
   }
-  // connect to listen node
-  rb = tmsct.start();
+  sct_thd.join();
+
+  if (!sct_ok && svr_ok && stick_play) {
+    // the listen node may come up with the project, tmsct reconnects
+    sct_ok = tmsct.wait_connected(sct_to - (int)(1000.0 * since()));
+    if (sct_ok) tm.tmsct = since();
+  }
+  tm.total = since();
+  tmrl_INFO_STREAM("TM_DRV: start " << (sct_ok ? "ok" : "fail") << " in " << 1000.0 * tm.total
+    << " ms, tmsvr: " << 1000.0 * tm.tmsvr << " ms, tmsct: " << 1000.0 * tm.tmsct << " ms");
+  if (timing) *timing = tm;
+  return sct_ok;
+}
+bool Driver::start_all(const std::vector<Driver *> &drivers, bool stick_play, int timeout_ms,
+  std::vector<StartTiming> *timings)
+{
+  std::vector<StartTiming> tms(drivers.size());
+  std::vector<char> oks(drivers.size(), 0);
+  std::vector<std::thread> thds;
+  thds.reserve(drivers.size());
+  for (std::size_t i = 0; i < drivers.size(); ++i) {
+    thds.emplace_back([&, i] { oks[i] = drivers[i]->start(stick_play, timeout_ms, &tms[i]); });
+  }
+  for (auto &thd : thds) { thd.join(); }
+
+  bool rb = true;
+  double slowest = 0.0;
+  for (std::size_t i = 0; i < drivers.size(); ++i) {
+    rb = rb && oks[i];
+    slowest = std::max(slowest, tms[i].total);
+  }
+  tmrl_INFO_STREAM("TM_DRV: start_all " << drivers.size() << " drivers " << (rb ? "ok" : "fail")
+    << ", slowest: " << 1000.0 * slowest << " ms");
+  if (timings) *timings = tms;
   return rb;
 }
 void Driver::halt()
@@ -43,6 +98,17 @@ void Driver::halt()
   tmsvr.stop();
 }
 
+bool Driver::set_vel_mode_target(VelMode mode, const vector6d &vel, const std::string &id)
+{
+  // render() returns the template buffer, keep it until sent
+  std::unique_lock<std::mutex> lck(_vel_mtx);
+  if (_vel_tpl.field_count() == 0 || _vel_tpl_mode != mode || _vel_tpl.id() != id) {
+    _vel_tpl = cmd::vel_mode_target_template(mode, id);
+    _vel_tpl_mode = mode;
+  }
+  return tmsct.send_packed(_vel_tpl.render(vel));
+}
+
 bool Driver::run_pvt_traj(const PvtTraj &pvts)
 {
   auto time_start = std::chrono::steady_clock::now();
@@ -85,6 +151,24 @@ bool Driver::run_pvt_traj(const PvtTraj &pvts)
 void Driver::stop_pvt_traj()
 {
   _keep_pvt_running = false;
+  _pvt_stream.stop();
+  _pvt_session.stop();
+}
+
+bool Driver::stream_pvt_traj(const PvtTraj &pvts, const std::string &id)
+{
+  tmrl_INFO_STREAM("TM_DRV: traj. total time: " << pvts.total_time);
+  return _pvt_stream.run(pvts, id);
+}
+
+bool Driver::open_pvt_session(PvtMode mode, const std::string &id)
+{
+  RobotState::Ulock lck(state.mtx);
+  vectorXd start = (mode == PvtMode::Joint) ?
+    to_vectorXd(state.joint_angle()) : to_vectorXd(state.tool_pose());
+  lck.unlock();
+
+  return _pvt_session.open(mode, start, id);
 }
 
 void Driver::cubic_interp(PvtPoint &p, const PvtPoint &p0, const PvtPoint &p1, double t)
@@ -104,13 +188,17 @@ void Driver::cubic_interp(PvtPoint &p, const PvtPoint &p0, const PvtPoint &p1, d
   }
 }
 
-bool Driver::fake_run_pvt_traj(const PvtTraj &pvts)
+bool Driver::fake_run_pvt_traj(const PvtTraj &pvts, std::vector<SimSample> *samples)
 {
   const size_t dof = state.DOF;
 
-  auto time_init = std::chrono::steady_clock::now();
+  utils::Clock &clock = *_sim_clock;
+  const std::chrono::milliseconds period(1);
+
+  auto time_init = clock.now();
   auto time_start = time_init;
   auto time_now = time_init;
+  auto deadline = time_init;
 
   if (pvts.mode != PvtMode::Joint || pvts.points.size() < 2) return false;
 
@@ -127,49 +215,53 @@ bool Driver::fake_run_pvt_traj(const PvtTraj &pvts)
   p_start.velocities = to_vectorXd(state.joint_speed());
   lck.unlock();
 
-  PvtPoint &p0 = p_start;
+  // coefficients once, no division or allocation per tick
+  PvtSpline spline(p_start, pvts);
   PvtPoint point = p_start;
   vector6d zeros{0};
   size_t idx = 0;
 
   // first point
   tmrl_INFO_STREAM("TM_DRV: traj. total time: " << pvts.total_time);
-  tmrl_INFO_STREAM(cmd::pvt_point(pvts.mode, p0));
+  tmrl_INFO_STREAM(cmd::pvt_point(pvts.mode, p_start));
   tmrl_INFO_STREAM(cmd::pvt_point(pvts.mode, pvts.points[idx]));
-  point.time = pvts.points[0].time;
+  point.time = 0.0;
 
   while (_keep_pvt_running) {
-    cubic_interp(point, p0, pvts.points[idx], point.time);
+    spline.evaluate(point.time, point.positions.data(), point.velocities.data(), idx);
 
     lck.lock();
     state.set_joint_states(to_arrayd<dof>(point.positions), to_arrayd<dof>(point.velocities), zeros);
     lck.unlock();
+    if (samples) {
+      samples->push_back(SimSample{ point.time, to_arrayd<dof>(point.positions), to_arrayd<dof>(point.velocities) });
+    }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // absolute deadlines, a virtual clock does not wait at all
+    deadline += period;
+    clock.sleep_until(deadline);
 
-    time_now = std::chrono::steady_clock::now();
-    point.time = 1.0 * std::chrono::duration_cast<std::chrono::duration<double>>(time_now - time_start).count();
-    if (point.time > pvts.points[idx].time) {
-      p0 = pvts.points[idx];
-      point.time -= pvts.points[idx].time;
-      time_start = time_now;
-      ++idx;
-      if (idx == pvts.points.size()) break;
-
-      tmrl_INFO_STREAM(cmd::pvt_point(pvts.mode, pvts.points[idx]));
+    time_now = clock.now();
+    point.time = std::chrono::duration_cast<std::chrono::duration<double>>(time_now - time_start).count();
+    if (point.time > spline.duration()) break;
+
+    if (point.time > spline.end_times()[idx]) {
+      tmrl_INFO_STREAM(cmd::pvt_point(pvts.mode, pvts.points[spline.find_segment(point.time, idx)]));
     }
   }
   // last point
   if (_keep_pvt_running) {
-    idx = pvts.points.size() - 1;
-    cubic_interp(point, pvts.points[idx - 1], pvts.points[idx], pvts.points[idx].time);
+    spline.evaluate(spline.duration(), point.positions.data());
   }
 
   lck.lock();
   state.set_joint_states(to_arrayd<dof>(point.positions), zeros, zeros);
   lck.unlock();
+  if (samples) {
+    samples->push_back(SimSample{ std::min(point.time, spline.duration()), to_arrayd<dof>(point.positions), zeros });
+  }
 
-  time_now = std::chrono::steady_clock::now();
+  time_now = clock.now();
   point.time = std::chrono::duration_cast<std::chrono::duration<double>>(time_now - time_init).count();
   tmrl_INFO_STREAM("TM_DRV: traj. exec. time: " << point.time);
 
@@ -195,8 +287,7 @@ bool Driver::sim_pvt_exit()
 }
 bool Driver::sim_pvt_point(const PvtPoint &point)
 {
-  _sim_pvt.add_point(point);
-  return true;
+  return _sim_pvt.add_point(point);
 }
 bool Driver::sim_pvt_traj(const PvtTraj &pvts)
 {
@@ -205,12 +296,13 @@ bool Driver::sim_pvt_traj(const PvtTraj &pvts)
 
   _sim_pvt.enter(to_vectorXd(state.joint_angle()));
 
+  bool rb = true;
   for (auto &point : pvts.points) {
-    _sim_pvt.add_point(point);
+    if (!_sim_pvt.add_point(point)) { rb = false; break; }
   }
   _sim_pvt.exit();
 
-  return true;
+  return rb;
 }
 
 }
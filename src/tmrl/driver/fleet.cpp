@@ -0,0 +1,296 @@
+#include "tmrl/driver/fleet.h"
+
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace tmrl
+{
+namespace driver
+{
+
+using Clock = std::chrono::steady_clock;
+
+Fleet::Robot::Robot(const std::string &ip)
+  : svr(ip)
+  , sct(ip)
+  , drv(svr, sct)
+{
+}
+void *Fleet::Robot::operator new(std::size_t size)
+{
+  void *p = nullptr;
+#ifdef _WIN32
+  p = _aligned_malloc(size, alignof(Robot));
+#else
+  if (posix_memalign(&p, alignof(Robot), size) != 0) p = nullptr;
+#endif
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void Fleet::Robot::operator delete(void *p)
+{
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+Fleet::Fleet(std::size_t io_threads)
+{
+  for (std::size_t i = 0; i < std::max(io_threads, (std::size_t)(1)); ++i) {
+    _loops.emplace_back(new comm::IoLoop);
+  }
+}
+Fleet::~Fleet()
+{
+  halt();
+}
+
+bool Fleet::add(const std::string &ip)
+{
+  for (auto &loop : _loops) {
+    if (loop->is_running()) {
+      tmrl_ERROR_STREAM("TM_FLEET: add " << ip << " while started, halt first");
+      return false;
+    }
+  }
+  const std::size_t i = _robots.size();
+  std::unique_ptr<Robot> pr(new Robot(ip));
+  Robot &r = *pr;
+
+  r.svr.set_feedback_callback([this, i](const RobotState &rs) { on_feedback(i, rs); });
+  r.sct.set_tmsct_callback([this, i](const comm::TmsctPacket &pack) { on_tmsct(i, pack); });
+
+  // both clients on the loop, or none and the robot is not added
+  r.loop = i % _loops.size();
+  r.slot = _loops[r.loop]->size();
+  comm::IoLoop &loop = *_loops[r.loop];
+  if (!loop.add(r.svr)) {
+    tmrl_ERROR_STREAM("TM_FLEET: robot " << i << " (" << ip << ") is not served");
+    return false;
+  }
+  if (!loop.add(r.sct)) {
+    loop.remove(r.svr);
+    tmrl_ERROR_STREAM("TM_FLEET: robot " << i << " (" << ip << ") is not served");
+    return false;
+  }
+  _robots.push_back(std::move(pr));
+  return true;
+}
+
+bool Fleet::start(int timeout_ms, std::vector<StartTiming> *timings)
+{
+  halt();
+  tmrl_INFO_STREAM("TM_FLEET: start " << _robots.size() << " robots on " << _loops.size() << " io threads");
+
+  // the loops connect their clients at once, and all loops at once
+  const auto time_start = Clock::now();
+  std::vector<std::vector<double>> times(_loops.size());
+  std::vector<char> oks(_loops.size(), 0);
+  std::vector<std::thread> thds;
+  for (std::size_t l = 0; l < _loops.size(); ++l) {
+    thds.emplace_back([&, l] { oks[l] = _loops[l]->start(timeout_ms, &times[l]); });
+  }
+  for (auto &thd : thds) { thd.join(); }
+
+  bool rb = std::all_of(oks.begin(), oks.end(), [](char ok) { return ok != 0; });
+  std::vector<StartTiming> tms(_robots.size());
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    const Robot &r = *_robots[i];
+    tms[i].tmsvr = times[r.loop][r.slot];
+    tms[i].tmsct = times[r.loop][r.slot + 1];
+    tms[i].total = std::max(tms[i].tmsvr, tms[i].tmsct);
+  }
+  tmrl_INFO_STREAM("TM_FLEET: start " << (rb ? "ok" : "fail") << " in "
+    << 1000.0 * std::chrono::duration<double>(Clock::now() - time_start).count() << " ms");
+  if (timings) *timings = tms;
+  return rb;
+}
+void Fleet::halt()
+{
+  for (auto &pr : _robots) {
+    pr->drv.stop_pvt_traj();
+    if (pr->sct.client().is_connected()) pr->drv.set_script_exit();
+  }
+  for (auto &loop : _loops) { loop->stop(); }
+  std::unique_lock<std::mutex> lck(_mtx);
+  _staged = false;
+}
+
+Fleet::Snapshot Fleet::snapshot(std::size_t robot) const
+{
+  const Robot &r = *_robots[robot];
+  Snapshot snap;
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    snap.feedbacks = r.feedbacks;
+    snap.stamp = r.stamp;
+  }
+  snap.connected = r.svr.client().is_connected();
+
+  const RobotState &rs = r.svr.robot_state;
+  RobotState::Ulock lck(rs.mtx);
+  snap.linked = rs.is_linked();
+  snap.error = rs.has_error();
+  snap.project_running = rs.is_project_running();
+  snap.joint_angle = rs.joint_angle();
+  snap.joint_speed = rs.joint_speed();
+  snap.tool_pose = rs.tool_pose();
+  return snap;
+}
+
+void Fleet::on_feedback(std::size_t robot, const RobotState &rs)
+{
+  Robot &r = *_robots[robot];
+  const auto now = Clock::now();
+  bool moved = false;
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    ++r.feedbacks;
+    r.stamp = now;
+    if (r.watching) {
+      // this thread writes the state, no lock to read it
+      const vector6d q = rs.joint_angle();
+      for (std::size_t j = 0; j < q.size(); ++j) {
+        if (std::fabs(q[j] - r.staged[j]) > _eps) {
+          r.watching = false;
+          r.moved = true;
+          r.moved_at = now;
+          moved = true;
+          break;
+        }
+      }
+    }
+  }
+  if (moved) _cv.notify_all();
+  if (_feedbackCallback) _feedbackCallback(robot, rs);
+}
+void Fleet::on_tmsct(std::size_t robot, const comm::TmsctPacket &pack)
+{
+  if (pack.id() == "FleetStage") {
+    Robot &r = *_robots[robot];
+    {
+      std::unique_lock<std::mutex> lck(_mtx);
+      r.replied = true;
+      r.accepted = (pack.script().compare(0, 2, "OK") == 0);
+    }
+    _cv.notify_all();
+  }
+  if (_tmsctCallback) _tmsctCallback(robot, pack);
+}
+
+bool Fleet::stage(const std::vector<std::string> &scripts, int timeout_ms)
+{
+  if (scripts.size() != _robots.size()) return false;
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    _staged = false;
+    for (auto &pr : _robots) {
+      pr->replied = false;
+      pr->accepted = false;
+      pr->watching = false;
+    }
+  }
+  // the motion waits in the queue for Resume()
+  bool rb = true;
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    rb = _robots[i]->sct.send_script("FleetStage", cmd::pause() + "\n" + scripts[i], false) && rb;
+  }
+  if (!rb) return false;
+
+  std::unique_lock<std::mutex> lck(_mtx);
+  rb = _cv.wait_for(lck, std::chrono::milliseconds(timeout_ms), [this] {
+    return std::all_of(_robots.begin(), _robots.end(), [](const std::unique_ptr<Robot> &pr) { return pr->replied; });
+  });
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    if (!_robots[i]->accepted) {
+      tmrl_WARN_STREAM("TM_FLEET: robot " << i << " did not accept the staged script");
+      rb = false;
+    }
+  }
+  if (!rb) return false;
+  lck.unlock();
+
+  // pack the release now, it is only sent then
+  std::vector<vector6d> angles(_robots.size());
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    comm::TmsctPacket pack;
+    comm::vectorXbyte bytes;
+    pack.set_script("FleetGo", cmd::resume());
+    pack.pack(bytes);
+    _robots[i]->release.assign(bytes.begin(), bytes.end());
+    angles[i] = snapshot(i).joint_angle;
+  }
+  lck.lock();
+  for (std::size_t i = 0; i < _robots.size(); ++i) { _robots[i]->staged = angles[i]; }
+  _staged = true;
+  return true;
+}
+
+Fleet::SyncReport Fleet::release(int timeout_ms, double eps)
+{
+  SyncReport rep;
+  rep.start_latency.assign(_robots.size(), -1.0);
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    if (!_staged) {
+      tmrl_WARN_STREAM("TM_FLEET: release without stage");
+      return rep;
+    }
+    _staged = false;
+    _eps = eps;
+    for (auto &pr : _robots) {
+      pr->watching = true;
+      pr->moved = false;
+    }
+  }
+
+  // back to back, nothing in between
+  std::vector<Clock::time_point> sent(_robots.size());
+  std::vector<char> oks(_robots.size(), 0);
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    oks[i] = _robots[i]->sct.send_packed(_robots[i]->release);
+    sent[i] = Clock::now();
+  }
+  Clock::time_point first = Clock::time_point::max(), last = Clock::time_point::min();
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    if (!oks[i]) continue;
+    ++rep.released;
+    first = std::min(first, sent[i]);
+    last = std::max(last, sent[i]);
+  }
+  if (rep.released) rep.send_skew = std::chrono::duration<double>(last - first).count();
+
+  std::unique_lock<std::mutex> lck(_mtx);
+  bool all = _cv.wait_for(lck, std::chrono::milliseconds(timeout_ms), [this] {
+    return std::all_of(_robots.begin(), _robots.end(), [](const std::unique_ptr<Robot> &pr) { return pr->moved; });
+  });
+  first = Clock::time_point::max();
+  last = Clock::time_point::min();
+  for (std::size_t i = 0; i < _robots.size(); ++i) {
+    Robot &r = *_robots[i];
+    r.watching = false;
+    if (!r.moved) continue;
+    rep.start_latency[i] = std::chrono::duration<double>(r.moved_at - sent[i]).count();
+    first = std::min(first, r.moved_at);
+    last = std::max(last, r.moved_at);
+  }
+  if (all) rep.motion_skew = std::chrono::duration<double>(last - first).count();
+  lck.unlock();
+
+  tmrl_INFO_STREAM("TM_FLEET: released " << rep.released << " robots, send skew: "
+    << 1.0e6 * rep.send_skew << " us, motion skew: " << 1000.0 * rep.motion_skew << " ms");
+  return rep;
+}
+
+}
+}
@@ -0,0 +1,179 @@
+#include "tmrl/driver/pvt_retime.h"
+
+#include "tmrl/utils/logger.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace tmrl
+{
+namespace driver
+{
+
+static const double MIN_SEGMENT_TIME = 0.001;
+static const std::size_t SHRINK_ITERATIONS = 40;
+static const std::size_t MAX_ITERATIONS = 100;
+
+// waypoint velocities from the segment times, v[0] and v[m] are zero
+template<std::size_t N>
+void _knot_velocities(std::vector<std::array<double, N>> &v,
+  const JointPath<N> &q, const std::vector<double> &T)
+{
+  const std::size_t m = q.size() - 1;
+  v[0].fill(0.0);
+  v[m].fill(0.0);
+  for (std::size_t k = 1; k < m; ++k) {
+    const double t1 = T[k - 1];
+    const double t2 = T[k];
+    for (std::size_t j = 0; j < N; ++j) {
+      double m1 = (q[k][j] - q[k - 1][j]) / t1;
+      double m2 = (q[k + 1][j] - q[k][j]) / t2;
+      double vk = (m1 * t2 + m2 * t1) / (t1 + t2);
+      v[k][j] = (m1 * m2 > 0.0) ? vk : 0.0;
+    }
+  }
+}
+
+/*
+ * Time scale that puts the segment exactly on its tightest limit:
+ * scaling every segment time by s scales vel by 1/s, acc by 1/s^2 and jerk by 1/s^3
+ */
+template<std::size_t N>
+double _segment_scale(const std::array<double, N> &q0, const std::array<double, N> &v0,
+  const std::array<double, N> &q1, const std::array<double, N> &v1, double T, const JointLimits<N> &lim)
+{
+  std::array<double, N> sv, sa, sj;
+  for (std::size_t j = 0; j < N; ++j) {
+    const double dq = q1[j] - q0[j];
+    const double c = ((3.0 * dq / T) - 2.0 * v0[j] - v1[j]) / T;
+    const double d = ((-2.0 * dq / T) + v0[j] + v1[j]) / (T*T);
+    // velocity extremum inside the segment (clamped, so always a valid sample)
+    double ts = (d != 0.0) ? -c / (3.0 * d) : 0.0;
+    ts = std::min(std::max(ts, 0.0), T);
+    double vp = std::max(std::max(std::fabs(v0[j]), std::fabs(v1[j])),
+      std::fabs(v0[j] + 2.0 * c * ts + 3.0 * d * ts*ts));
+    double ap = std::max(std::fabs(2.0 * c), std::fabs(2.0 * c + 6.0 * d * T));
+    double jp = std::fabs(6.0 * d);
+    sv[j] = vp / lim.vel[j];
+    sa[j] = ap / lim.acc[j];
+    sj[j] = jp / lim.jerk[j];
+  }
+  double s = 0.0;
+  for (std::size_t j = 0; j < N; ++j) {
+    s = std::max(s, std::max(sv[j], std::max(std::sqrt(sa[j]), std::cbrt(sj[j]))));
+  }
+  return s;
+}
+
+template<std::size_t N>
+double _max_scale(std::vector<double> &s, const JointPath<N> &q,
+  const std::vector<std::array<double, N>> &v, const std::vector<double> &T, const JointLimits<N> &lim)
+{
+  double max_s = 0.0;
+  for (std::size_t k = 0; k < T.size(); ++k) {
+    s[k] = _segment_scale<N>(q[k], v[k], q[k + 1], v[k + 1], T[k], lim);
+    max_s = std::max(max_s, s[k]);
+  }
+  return max_s;
+}
+
+template<std::size_t N>
+PvtTraj retime_pvt_traj(const JointPath<N> &waypoints, const JointLimits<N> &limits,
+  RetimeStats *stats)
+{
+  PvtTraj rv;
+  rv.mode = PvtMode::Joint;
+  rv.total_time = 0.0;
+
+  if (waypoints.size() < 2) {
+    if (stats) *stats = RetimeStats{};
+    return rv;
+  }
+  const JointPath<N> &q = waypoints;
+  const std::size_t m = q.size() - 1;
+
+  std::vector<double> T(m), s(m);
+  std::vector<std::array<double, N>> v(m + 1);
+
+  // lower bound: every joint at its velocity limit
+  for (std::size_t k = 0; k < m; ++k) {
+    double t = MIN_SEGMENT_TIME;
+    for (std::size_t j = 0; j < N; ++j) {
+      t = std::max(t, std::fabs(q[k + 1][j] - q[k][j]) / limits.vel[j]);
+    }
+    T[k] = t;
+  }
+
+  // uniform timing: one time for every segment, exact by scaling
+  double uniform_time = 0.0;
+  {
+    std::vector<double> Tu(m, *std::max_element(T.begin(), T.end()));
+    _knot_velocities<N>(v, q, Tu);
+    double su = _max_scale<N>(s, q, v, Tu, limits);
+    uniform_time = (double)(m) * Tu[0] * std::max(su, 1.0e-9);
+  }
+
+  // per segment: move each time towards its own limit, then only grow
+  std::size_t it = 0;
+  double max_s = 0.0;
+  for (; it < MAX_ITERATIONS; ++it) {
+    _knot_velocities<N>(v, q, T);
+    max_s = _max_scale<N>(s, q, v, T, limits);
+
+    if (it < SHRINK_ITERATIONS) {
+      for (std::size_t k = 0; k < m; ++k) {
+        T[k] = std::max(MIN_SEGMENT_TIME, T[k] * std::min(std::max(s[k], 0.7), 2.0));
+      }
+    }
+    else {
+      if (max_s <= 1.0) break;
+      for (std::size_t k = 0; k < m; ++k) {
+        if (s[k] > 1.0) T[k] *= 1.001 * std::min(s[k], 2.0);
+      }
+    }
+  }
+  if (max_s > 1.0) {
+    // not converged, scaling every segment by max_s is exact
+    for (auto &t : T) { t *= max_s; }
+    _knot_velocities<N>(v, q, T);
+  }
+
+  rv.points.resize(m);
+  for (std::size_t k = 0; k < m; ++k) {
+    PvtPoint &p = rv.points[k];
+    p.time = T[k];
+    p.positions.assign(q[k + 1].begin(), q[k + 1].end());
+    p.velocities.assign(v[k + 1].begin(), v[k + 1].end());
+    rv.total_time += T[k];
+  }
+  if (stats) {
+    stats->iterations = it;
+    stats->retimed_time = rv.total_time;
+    stats->uniform_time = uniform_time;
+  }
+  return rv;
+}
+
+template<std::size_t N>
+std::vector<PvtTraj> retime_pvt_trajs(const std::vector<JointPath<N>> &paths,
+  const JointLimits<N> &limits, utils::ThreadPool &pool, std::vector<RetimeStats> *stats)
+{
+  std::vector<PvtTraj> rv(paths.size());
+  if (stats) stats->resize(paths.size());
+
+  pool.parallel_for(paths.size(), [&](std::size_t i)
+  {
+    rv[i] = retime_pvt_traj<N>(paths[i], limits, stats ? &((*stats)[i]) : nullptr);
+  });
+  return rv;
+}
+
+template PvtTraj retime_pvt_traj<6>(const JointPath<6> &, const JointLimits<6> &, RetimeStats *);
+template PvtTraj retime_pvt_traj<7>(const JointPath<7> &, const JointLimits<7> &, RetimeStats *);
+template std::vector<PvtTraj> retime_pvt_trajs<6>(const std::vector<JointPath<6>> &,
+  const JointLimits<6> &, utils::ThreadPool &, std::vector<RetimeStats> *);
+template std::vector<PvtTraj> retime_pvt_trajs<7>(const std::vector<JointPath<7>> &,
+  const JointLimits<7> &, utils::ThreadPool &, std::vector<RetimeStats> *);
+
+}
+}
@@ -0,0 +1,245 @@
+#include "tmrl/driver/pvt_session.h"
+
+#include "tmrl/utils/logger.h"
+
+#include <cmath>
+
+namespace tmrl
+{
+namespace driver
+{
+
+inline double _sec_since(const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - t0).count();
+}
+
+PvtSession::PvtSession(TmsctClient &sct)
+  : _sct(sct)
+{
+}
+
+bool PvtSession::open(PvtMode mode, const vectorXd &start_positions, const std::string &id)
+{
+  stop();
+
+  std::unique_lock<std::mutex> lck(_mtx);
+  _id = id;
+  _mode = mode;
+  _end.time = 0.0;
+  _end.positions = start_positions;
+  _end.velocities = vectorXd(start_positions.size(), 0.0);
+  _queue.clear();
+  _sent_time = 0.0;
+  _stats = Stats{};
+  _exit_requested = false;
+  _entered = false;
+  _keep_alive = true;
+  lck.unlock();
+
+  _thd = std::thread(std::bind(&PvtSession::run, this));
+  return true;
+}
+
+bool PvtSession::check_boundary(const PvtPoint &point) const
+{
+  if (point.positions.size() != _end.positions.size() ||
+      point.velocities.size() != _end.velocities.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < point.positions.size(); ++i) {
+    if (std::fabs(point.positions[i] - _end.positions[i]) > _pos_tol) return false;
+    if (std::fabs(point.velocities[i] - _end.velocities[i]) > _vel_tol) return false;
+  }
+  return true;
+}
+
+bool PvtSession::append(const PvtTraj &pvts)
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+
+  if (!_keep_alive || _exit_requested) return false;
+
+  if (pvts.mode != _mode || pvts.points.empty()) {
+    ++_stats.rejected_count;
+    return false;
+  }
+  // without its start state the boundary can not be checked
+  if (pvts.points[0].time >= 1.0e-6) {
+    tmrl_ERROR_STREAM("TM_DRV: pvt session. no start point with zero time");
+    ++_stats.rejected_count;
+    return false;
+  }
+  if (!check_boundary(pvts.points[0])) {
+    tmrl_ERROR_STREAM("TM_DRV: pvt session. start point does not match the end of the queue");
+    ++_stats.rejected_count;
+    return false;
+  }
+  const size_t begin = 1;
+  for (size_t k = begin; k < pvts.points.size(); ++k) {
+    if (pvts.points[k].time <= 0.0) {
+      tmrl_ERROR_STREAM("TM_DRV: pvt session. point " << k << " has no duration");
+      ++_stats.rejected_count;
+      return false;
+    }
+  }
+  for (size_t k = begin; k < pvts.points.size(); ++k) {
+    _queue.push_back(pvts.points[k]);
+    _stats.motion_time += pvts.points[k].time;
+  }
+  _end = pvts.points.back();
+  ++_stats.traj_count;
+
+  lck.unlock();
+  _cv.notify_one();
+  return true;
+}
+
+void PvtSession::close()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  if (!_keep_alive) return;
+  _exit_requested = true;
+  lck.unlock();
+  _cv.notify_one();
+
+  if (_thd.joinable()) _thd.join();
+}
+
+void PvtSession::stop()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  _keep_alive = false;
+  _queue.clear();
+  lck.unlock();
+  _cv.notify_one();
+
+  if (_thd.joinable()) _thd.join();
+
+  // after the join, a PVTEnter in flight during stop() counts too
+  if (_entered) {
+    _sct.send_script("Stop", cmd::stop());
+  }
+  _entered = false;
+}
+
+PvtSession::Stats PvtSession::stats() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  Stats stats = _stats;
+  if (stats.traj_count > stats.enter_count) {
+    stats.nominal_saved_time = _stop_restart_time * (stats.traj_count - stats.enter_count);
+  }
+  return stats;
+}
+
+PvtTraj PvtSession::take_chunk(double queued_time)
+{
+  PvtTraj chunk;
+  chunk.mode = _mode;
+  chunk.total_time = 0.0;
+
+  // at least one point, at least chunk_time, and fill up the lookahead
+  double target = _lookahead - queued_time;
+  if (target < _chunk_time) target = _chunk_time;
+
+  while (!_queue.empty() && (chunk.points.empty() || chunk.total_time < target)) {
+    chunk.total_time += _queue.front().time;
+    chunk.points.push_back(std::move(_queue.front()));
+    _queue.pop_front();
+  }
+  return chunk;
+}
+
+void PvtSession::run()
+{
+  tmrl_INFO_STREAM("TM_DRV: pvt session begin");
+
+  std::unique_lock<std::mutex> lck(_mtx);
+
+  while (_keep_alive) {
+    double queued_time = 0.0;
+    if (_entered) {
+      queued_time = _sent_time - _sec_since(_time_enter);
+      if (queued_time < 0.0) queued_time = 0.0;
+    }
+
+    // top up
+    if (!_queue.empty() && queued_time < _lookahead) {
+      const bool enter = !_entered;
+      PvtTraj chunk = take_chunk(queued_time);
+      const bool exit = _exit_requested && _queue.empty();
+      lck.unlock();
+
+      std::string script;
+      if (enter) {
+        script = cmd::pvt_enter((int)(_mode)) + "\r\n";
+      }
+      script += cmd::pvt_points(chunk, 0, chunk.points.size());
+      if (exit) {
+        script += cmd::pvt_exit();
+      }
+      else {
+        script.resize(script.size() - 2); // "\r\n"
+      }
+      bool rb = _sct.send_script(_id, script, comm::Client::LOG_NOTHING);
+
+      lck.lock();
+      if (!rb) {
+        tmrl_ERROR_STREAM("TM_DRV: pvt session. send failed");
+        _queue.clear();
+        _keep_alive = false;
+        break;
+      }
+      if (enter) {
+        _entered = true;
+        _time_enter = std::chrono::steady_clock::now();
+        _sent_time = 0.0;
+        ++_stats.enter_count;
+      }
+      _sent_time += chunk.total_time;
+      if (exit) {
+        _entered = false;
+        break;
+      }
+      continue;
+    }
+
+    if (_queue.empty()) {
+      // exit on request, or when the queued motion is done
+      if (_entered && (_exit_requested || (_auto_exit && queued_time <= 0.0))) {
+        for (auto &v : _end.velocities) {
+          if (std::fabs(v) > _vel_tol) {
+            tmrl_WARN_STREAM("TM_DRV: pvt session. queue ends with speed");
+            break;
+          }
+        }
+        lck.unlock();
+        bool rb = _sct.send_script(_id, cmd::pvt_exit());
+        lck.lock();
+        _entered = false;
+        if (!rb || _exit_requested) break;
+        continue;
+      }
+      if (!_entered && _exit_requested) break;
+      if (!_entered) {
+        _cv.wait(lck);
+        continue;
+      }
+    }
+    // wait for playback or new points
+    _cv.wait_for(lck, std::chrono::milliseconds(1));
+  }
+  _keep_alive = false;
+  lck.unlock();
+
+  Stats st = stats();
+  tmrl_INFO_STREAM("TM_DRV: pvt session end. trajs: " << st.traj_count
+    << ", enter: " << st.enter_count
+    << ", motion time: " << st.motion_time
+    << ", nominal saved: " << st.nominal_saved_time);
+}
+
+}
+}
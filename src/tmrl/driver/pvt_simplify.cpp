@@ -0,0 +1,133 @@
+#include "tmrl/driver/pvt_simplify.h"
+
+#include "tmrl/utils/logger.h"
+
+#include <cmath>
+
+namespace tmrl
+{
+namespace driver
+{
+
+void estimate_pvt_velocities(PvtTraj &pvts)
+{
+  auto &pts = pvts.points;
+  const size_t n = pts.size();
+
+  for (size_t k = 0; k < n; ++k) {
+    auto &p = pts[k];
+    if (p.velocities.size() == p.positions.size()) continue;
+
+    const size_t dof = p.positions.size();
+    p.velocities.assign(dof, 0.0);
+
+    const bool has_prev = (k > 0 && p.time > 0.0);
+    const bool has_next = (k + 1 < n && pts[k + 1].time > 0.0);
+    const double h1 = p.time;
+    const double h2 = has_next ? pts[k + 1].time : 0.0;
+
+    for (size_t i = 0; i < dof; ++i) {
+      double d1 = has_prev ? (p.positions[i] - pts[k - 1].positions[i]) / h1 : 0.0;
+      double d2 = has_next ? (pts[k + 1].positions[i] - p.positions[i]) / h2 : 0.0;
+      if (has_prev && has_next) {
+        // non-uniform central difference
+        p.velocities[i] = (d1 * h2 + d2 * h1) / (h1 + h2);
+      }
+      else if (has_prev) {
+        p.velocities[i] = d1;
+      }
+      else if (has_next) {
+        p.velocities[i] = d2;
+      }
+    }
+  }
+}
+
+// largest deviation of pts(a, e) from the Hermite segment a -> e
+inline double _segment_error(const std::vector<PvtPoint> &pts,
+  const std::vector<double> &cum, size_t a, size_t e, double tol)
+{
+  const PvtPoint &p0 = pts[a];
+  const PvtPoint &p1 = pts[e];
+  const size_t dof = p0.positions.size();
+  const double T = cum[e] - cum[a];
+  double err = 0.0;
+
+  if (T <= 0.0) return (e == a + 1) ? 0.0 : tol + 1.0;
+
+  for (size_t i = 0; i < dof; ++i) {
+    const double x0 = p0.positions[i];
+    const double v0 = p0.velocities[i];
+    const double c = ((3.0 * (p1.positions[i] - x0) / T) - 2.0 * v0 - p1.velocities[i]) / T;
+    const double d = ((2.0 * (x0 - p1.positions[i]) / T) + v0 + p1.velocities[i]) / (T*T);
+
+    // the newest inner point fails most often, check it first
+    for (size_t k = e - 1; k > a; --k) {
+      const double t = cum[k] - cum[a];
+      const double x = x0 + v0 * t + c * t*t + d * t*t*t;
+      const double dx = std::fabs(x - pts[k].positions[i]);
+      if (dx > err) {
+        err = dx;
+        if (err > tol) return err;
+      }
+    }
+  }
+  return err;
+}
+
+PvtTraj simplify_pvt_traj(const PvtTraj &pvts, double tol,
+  PvtSimplifyStats *stats, std::size_t max_span)
+{
+  PvtTraj rv;
+  rv.mode = pvts.mode;
+  rv.total_time = pvts.total_time;
+
+  const auto &pts = pvts.points;
+  const size_t n = pts.size();
+  double max_error = 0.0;
+
+  if (max_span < 1) max_span = 1;
+
+  if (n <= 2) {
+    rv.points = pts;
+  }
+  else {
+    // time of each point from the first one
+    std::vector<double> cum(n);
+    cum[0] = 0.0;
+    for (size_t k = 1; k < n; ++k) { cum[k] = cum[k - 1] + pts[k].time; }
+
+    rv.points.reserve(n / 4 + 2);
+    rv.points.push_back(pts[0]);
+
+    size_t a = 0;
+    while (a + 1 < n) {
+      size_t best = a + 1;
+      double best_err = 0.0;
+      const size_t last = (a + max_span < n - 1) ? a + max_span : n - 1;
+      for (size_t e = a + 2; e <= last; ++e) {
+        double err = _segment_error(pts, cum, a, e, tol);
+        if (err > tol) break;
+        best = e;
+        best_err = err;
+      }
+      if (best_err > max_error) max_error = best_err;
+
+      rv.points.push_back(pts[best]);
+      rv.points.back().time = cum[best] - cum[a];
+      a = best;
+    }
+  }
+
+  if (stats) {
+    stats->input_points = n;
+    stats->output_points = rv.points.size();
+    stats->max_error = max_error;
+  }
+  tmrl_DEBUG_STREAM("TM_DRV: pvt simplify. " << n << " -> " << rv.points.size()
+    << " points, max error: " << max_error);
+  return rv;
+}
+
+}
+}
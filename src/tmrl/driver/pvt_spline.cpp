@@ -0,0 +1,187 @@
+#include "tmrl/driver/pvt_spline.h"
+
+#include <algorithm>
+
+namespace tmrl
+{
+namespace driver
+{
+
+void PvtSpline::build(const PvtTraj &pvts)
+{
+  _ends.clear();
+  _coef.clear();
+  _dof = 0;
+  if (pvts.points.empty()) return;
+
+  const auto &pts = pvts.points;
+  _dof = pts[0].positions.size();
+  if (pts.size() == 1) {
+    hold(pts[0]);
+    return;
+  }
+  _ends.resize(pts.size() - 1);
+  _coef.resize(4 * _dof * _ends.size());
+
+  double t = 0.0;
+  for (std::size_t k = 1; k < pts.size(); ++k) {
+    t += pts[k].time;
+    _ends[k - 1] = t;
+    add_segment(pts[k - 1], pts[k], k - 1);
+  }
+}
+
+void PvtSpline::build(const PvtPoint &start, const PvtTraj &pvts)
+{
+  _ends.clear();
+  _coef.clear();
+  _dof = start.positions.size();
+
+  const auto &pts = pvts.points;
+  if (pts.empty()) {
+    hold(start);
+    return;
+  }
+  _ends.resize(pts.size());
+  _coef.resize(4 * _dof * _ends.size());
+
+  double t = 0.0;
+  for (std::size_t k = 0; k < pts.size(); ++k) {
+    t += pts[k].time;
+    _ends[k] = t;
+    add_segment(k ? pts[k - 1] : start, pts[k], k);
+  }
+}
+
+void PvtSpline::add_segment(const PvtPoint &p0, const PvtPoint &p1, std::size_t k)
+{
+  const std::size_t n = _dof;
+  double *a = _coef.data() + 4 * n * k;
+  double *b = a + n;
+  double *c = b + n;
+  double *d = c + n;
+  const double T = p1.time;
+
+  for (std::size_t i = 0; i < n; ++i) {
+    const double v0 = (i < p0.velocities.size()) ? p0.velocities[i] : 0.0;
+    const double v1 = (i < p1.velocities.size()) ? p1.velocities[i] : 0.0;
+    if (T > 0.0) {
+      a[i] = p0.positions[i];
+      b[i] = v0;
+      c[i] = ((3.0 * (p1.positions[i] - p0.positions[i]) / T) - 2.0 * v0 - v1) / T;
+      d[i] = ((2.0 * (p0.positions[i] - p1.positions[i]) / T) + v0 + v1) / (T*T);
+    }
+    else {
+      // zero time, jump to p1
+      a[i] = p1.positions[i];
+      b[i] = v1;
+      c[i] = 0.0;
+      d[i] = 0.0;
+    }
+  }
+}
+
+void PvtSpline::hold(const PvtPoint &p)
+{
+  // one segment of zero time, at p and standing
+  _ends.assign(1, 0.0);
+  _coef.assign(4 * _dof, 0.0);
+  std::copy(p.positions.begin(), p.positions.begin() + _dof, _coef.begin());
+}
+
+std::size_t PvtSpline::find_segment(double t) const
+{
+  if (_ends.empty()) return 0;
+  std::size_t k = std::lower_bound(_ends.begin(), _ends.end(), t) - _ends.begin();
+  return (k < _ends.size()) ? k : _ends.size() - 1;
+}
+
+std::size_t PvtSpline::find_segment(double t, std::size_t hint) const
+{
+  const std::size_t n = _ends.size();
+  if (hint < n && t <= _ends[hint]) {
+    if (hint == 0 || t > _ends[hint - 1]) return hint;
+  }
+  else if (hint + 1 < n && t <= _ends[hint + 1] && t > _ends[hint]) {
+    return hint + 1;
+  }
+  return find_segment(t);
+}
+
+inline void PvtSpline::eval_segment(std::size_t k, double t, double *pos, double *vel) const
+{
+  const std::size_t n = _dof;
+  const double *a = coef(k);
+  const double *b = a + n;
+  const double *c = b + n;
+  const double *d = c + n;
+  const double t2 = t * t;
+  const double t3 = t2 * t;
+
+  for (std::size_t i = 0; i < n; ++i) {
+    pos[i] = a[i] + b[i] * t + c[i] * t2 + d[i] * t3;
+  }
+  if (vel) {
+    for (std::size_t i = 0; i < n; ++i) {
+      vel[i] = b[i] + 2.0 * c[i] * t + 3.0 * d[i] * t2;
+    }
+  }
+}
+
+void PvtSpline::evaluate(double t, double *pos, double *vel, std::size_t &hint) const
+{
+  if (_ends.empty()) return;
+
+  if (t < 0.0) t = 0.0;
+  else if (t > _ends.back()) t = _ends.back();
+
+  hint = find_segment(t, hint);
+  const double t0 = hint ? _ends[hint - 1] : 0.0;
+  eval_segment(hint, t - t0, pos, vel);
+}
+
+void PvtSpline::evaluate(const double *times, std::size_t count, double *pos, double *vel) const
+{
+  if (_ends.empty()) return;
+
+  const std::size_t n = _dof;
+  const double t_end = _ends.back();
+  std::size_t k = 0;
+  std::size_t s = 0;
+  while (s < count) {
+    // the segment of times[s], then the run of samples that stay in it
+    double t = std::min(std::max(times[s], 0.0), t_end);
+    k = find_segment(t, k);
+    const double t0 = k ? _ends[k - 1] : 0.0;
+    const double t1 = (k + 1 < _ends.size()) ? _ends[k] : t_end;
+    std::size_t e = s + 1;
+    while (e < count) {
+      t = std::min(std::max(times[e], 0.0), t_end);
+      if (t > t1 || (k && t <= t0)) break;
+      ++e;
+    }
+
+    const double *a = coef(k);
+    const double *b = a + n;
+    const double *c = b + n;
+    const double *d = c + n;
+    for (; s < e; ++s) {
+      const double u = std::min(std::max(times[s], 0.0), t_end) - t0;
+      const double u2 = u * u;
+      const double u3 = u2 * u;
+      double *p = pos + s * n;
+      for (std::size_t i = 0; i < n; ++i) {
+        p[i] = a[i] + b[i] * u + c[i] * u2 + d[i] * u3;
+      }
+      if (vel) {
+        double *v = vel + s * n;
+        for (std::size_t i = 0; i < n; ++i) {
+          v[i] = b[i] + 2.0 * c[i] * u + 3.0 * d[i] * u2;
+        }
+      }
+    }
+  }
+}
+
+}
+}
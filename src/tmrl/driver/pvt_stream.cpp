@@ -0,0 +1,174 @@
+#include "tmrl/driver/pvt_stream.h"
+
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tmrl
+{
+namespace driver
+{
+
+inline double _sec_since(const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - t0).count();
+}
+
+PvtStream::PvtStream(TmsctClient &sct, RobotState &state)
+  : _sct(sct)
+  , _rs(state)
+{
+}
+
+std::size_t PvtStream::chunk_end(const PvtTraj &pvts, std::size_t begin, double sec, double &chunk_time) const
+{
+  std::size_t end = begin;
+  chunk_time = 0.0;
+  // at least one point per chunk
+  while (end < pvts.points.size() && (end == begin || chunk_time < sec)) {
+    chunk_time += pvts.points[end].time;
+    ++end;
+  }
+  return end;
+}
+
+bool PvtStream::has_moved(const vector6d &angle_start)
+{
+  RobotState::Ulock lck(_rs.mtx);
+  auto angle = _rs.joint_angle();
+  auto speed = _rs.joint_speed();
+  lck.unlock();
+
+  for (size_t i = 0; i < angle.size(); ++i) {
+    if (std::fabs(speed[i]) > 1.0e-4 || std::fabs(angle[i] - angle_start[i]) > 1.0e-4) {
+      return true;
+    }
+  }
+  return false;
+}
+
+double PvtStream::played_time(const PvtTraj &pvts, std::size_t sent_end, const vector6d &angle_start)
+{
+  if (_time_to_first_motion < 0.0) {
+    if (!has_moved(angle_start)) {
+      // the clock waits for the motion, unless it does not show up
+      return std::max(0.0, _sec_since(_time_send) - _start_timeout);
+    }
+    _time_motion = std::chrono::steady_clock::now();
+    _time_to_first_motion = _sec_since(_time_init);
+  }
+  double played = _sec_since(_time_motion);
+  // tool poses are not compared against the joint feedback
+  if (pvts.mode != PvtMode::Joint) return played;
+
+  RobotState::Ulock lck(_rs.mtx);
+  auto angle = _rs.joint_angle();
+  lck.unlock();
+
+  // forward only, over the points sent
+  std::size_t best = _fb_idx;
+  double best_dist = -1.0;
+  for (std::size_t i = _fb_idx; i < sent_end; ++i) {
+    const auto &pos = pvts.points[i].positions;
+    double dist = 0.0;
+    for (std::size_t j = 0; j < angle.size() && j < pos.size(); ++j) {
+      dist = std::max(dist, std::fabs(angle[j] - pos[j]));
+    }
+    if (best_dist < 0.0 || dist < best_dist) {
+      best = i;
+      best_dist = dist;
+    }
+  }
+  _fb_idx = best;
+  // a slow robot keeps the clock, more is queued then and it does not run dry
+  return std::max(played, _point_end[_fb_idx] - pvts.points[_fb_idx].time);
+}
+
+bool PvtStream::run(const PvtTraj &pvts, const std::string &id)
+{
+  _time_init = std::chrono::steady_clock::now();
+  _time_send = _time_init;
+
+  _time_to_first_send = 0.0;
+  _time_to_first_motion = -1.0;
+  _chunk_count = 0;
+  _fb_idx = 0;
+
+  if (pvts.points.size() == 0) return false;
+
+  if (!_sct.client().is_connected()) return false;
+
+  RobotState::Ulock lck(_rs.mtx);
+  auto angle_start = _rs.joint_angle();
+  lck.unlock();
+
+  _keep_running = true;
+
+  const std::size_t size = pvts.points.size();
+  _point_end.resize(size);
+  double end_time = 0.0;
+  for (std::size_t i = 0; i < size; ++i) {
+    end_time += pvts.points[i].time;
+    _point_end[i] = end_time;
+  }
+  std::size_t idx = 0;
+  double sent_time = 0.0;
+  double chunk_time = 0.0;
+  bool ok = true;
+
+  while (_keep_running && idx < size) {
+    double time = (_chunk_count == 0) ? 0.0 : played_time(pvts, idx, angle_start);
+
+    if (_chunk_count != 0 && sent_time - time >= _lookahead) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    std::size_t end = chunk_end(pvts, idx,
+      (_chunk_count == 0) ? _first_chunk_time : _chunk_time, chunk_time);
+
+    std::string script;
+    if (_chunk_count == 0) {
+      script = cmd::pvt_enter((int)(pvts.mode)) + "\r\n";
+    }
+    script += cmd::pvt_points(pvts, idx, end);
+    if (end == size) {
+      script += cmd::pvt_exit();
+    }
+    else {
+      script.resize(script.size() - 2); // "\r\n"
+    }
+    if (!_sct.send_script(id, script, comm::Client::LOG_NOTHING)) {
+      tmrl_ERROR_STREAM("TM_DRV: pvt stream. send chunk " << _chunk_count << " failed");
+      ok = false;
+      break;
+    }
+    if (_chunk_count == 0) {
+      _time_send = std::chrono::steady_clock::now();
+      _time_to_first_send = _sec_since(_time_init);
+    }
+    ++_chunk_count;
+    sent_time += chunk_time;
+    idx = end;
+  }
+
+  // wait for the queued motion
+  while (ok && _keep_running && played_time(pvts, idx, angle_start) < sent_time) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (!ok || !_keep_running) {
+    _sct.send_script("Stop", cmd::stop());
+  }
+  tmrl_INFO_STREAM("TM_DRV: pvt stream. points: " << idx << "/" << size
+    << ", chunks: " << _chunk_count
+    << ", first send: " << _time_to_first_send
+    << ", first motion: " << _time_to_first_motion);
+
+  _keep_running = false;
+  return ok;
+}
+
+}
+}
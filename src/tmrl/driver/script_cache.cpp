@@ -0,0 +1,194 @@
+#include "tmrl/driver/script_cache.h"
+
+#include "tmrl/comm/packet.h"
+
+#include <cstring>
+
+namespace tmrl
+{
+namespace driver
+{
+
+inline std::uint64_t _mix(std::uint64_t h, std::uint64_t v)
+{
+  // FNV-1a over 64-bit words
+  return (h ^ v) * 0x100000001b3ull;
+}
+inline std::uint64_t _mix(std::uint64_t h, double v)
+{
+  std::uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return _mix(h, bits);
+}
+inline bool _same_bits(const vectorXd &a, const vectorXd &b)
+{
+  return a.size() == b.size() &&
+    (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0);
+}
+
+ScriptCache::ScriptCache(std::size_t capacity_bytes)
+  : _capacity(capacity_bytes)
+{
+}
+
+std::uint64_t ScriptCache::hash(const PvtTraj &pvts, int precision)
+{
+  std::uint64_t h = 0xcbf29ce484222325ull;
+  h = _mix(h, (std::uint64_t)(pvts.mode));
+  h = _mix(h, (std::uint64_t)(precision));
+  h = _mix(h, (std::uint64_t)(pvts.points.size()));
+  for (auto &point : pvts.points) {
+    h = _mix(h, point.time);
+    h = _mix(h, (std::uint64_t)(point.positions.size()));
+    for (auto &value : point.positions) { h = _mix(h, value); }
+    h = _mix(h, (std::uint64_t)(point.velocities.size()));
+    for (auto &value : point.velocities) { h = _mix(h, value); }
+  }
+  return h;
+}
+
+bool ScriptCache::same_traj(const PvtTraj &a, const PvtTraj &b)
+{
+  if (a.mode != b.mode || a.points.size() != b.points.size()) return false;
+  for (size_t k = 0; k < a.points.size(); ++k) {
+    auto &pa = a.points[k];
+    auto &pb = b.points[k];
+    // bitwise, -0.0 and 0.0 are not the same text
+    if (memcmp(&pa.time, &pb.time, sizeof(double)) != 0 ||
+        !_same_bits(pa.positions, pb.positions) ||
+        !_same_bits(pa.velocities, pb.velocities)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::size_t ScriptCache::traj_bytes(const PvtTraj &pvts)
+{
+  std::size_t bytes = sizeof(PvtTraj);
+  for (auto &point : pvts.points) {
+    bytes += sizeof(PvtPoint) + sizeof(double) * (point.positions.size() + point.velocities.size());
+  }
+  return bytes;
+}
+
+ScriptCache::PacketPtr ScriptCache::pvt_traj_packet(const PvtTraj &pvts, const std::string &id,
+  utils::ThreadPool *pool, int precision)
+{
+  const std::uint64_t key = hash(pvts, precision);
+
+  std::unique_lock<std::mutex> lck(_mtx);
+  auto found = find(key, pvts, id, precision);
+  if (found != _lru.end()) {
+    _lru.splice(_lru.begin(), _lru, found);
+    ++_hits;
+    return found->packet;
+  }
+  ++_misses;
+  lck.unlock();
+
+  // format and pack without holding the lock
+  comm::TmsctPacket tmsct;
+  tmsct.set_script(id, pool ? cmd::pvt_traj(pvts, *pool, precision) : cmd::pvt_traj(pvts, precision));
+  comm::vectorXbyte bytes;
+  tmsct.pack(bytes);
+  PacketPtr packet = std::make_shared<const std::string>(bytes.begin(), bytes.end());
+
+  const std::size_t entry_bytes = packet->size() + traj_bytes(pvts) + id.size() + sizeof(Entry);
+
+  lck.lock();
+  // a concurrent miss of the same trajectory may have inserted it meanwhile
+  found = find(key, pvts, id, precision);
+  if (found != _lru.end()) {
+    _lru.splice(_lru.begin(), _lru, found);
+    return found->packet;
+  }
+  // set_capacity may have changed it meanwhile
+  if (entry_bytes > _capacity) {
+    // too large to keep
+    return packet;
+  }
+  evict(_capacity - entry_bytes);
+  _lru.push_front(Entry{ key, id, precision, pvts, packet, entry_bytes });
+  _map.insert(std::make_pair(key, _lru.begin()));
+  _bytes += entry_bytes;
+  return packet;
+}
+
+ScriptCache::EntryList::iterator ScriptCache::find(std::uint64_t key, const PvtTraj &pvts,
+  const std::string &id, int precision)
+{
+  auto range = _map.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    Entry &entry = *(it->second);
+    if (entry.precision == precision && entry.id == id && same_traj(entry.pvts, pvts)) {
+      return it->second;
+    }
+  }
+  return _lru.end();
+}
+
+void ScriptCache::evict(std::size_t capacity)
+{
+  while (_bytes > capacity && !_lru.empty()) {
+    auto last = std::prev(_lru.end());
+    auto range = _map.equal_range(last->key);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == last) {
+        _map.erase(it);
+        break;
+      }
+    }
+    _bytes -= last->bytes;
+    _lru.erase(last);
+    ++_evictions;
+  }
+}
+
+void ScriptCache::set_capacity(std::size_t capacity_bytes)
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  _capacity = capacity_bytes;
+  evict(_capacity);
+}
+void ScriptCache::clear()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  _map.clear();
+  _lru.clear();
+  _bytes = 0;
+}
+
+std::size_t ScriptCache::capacity() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _capacity;
+}
+std::size_t ScriptCache::size_bytes() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _bytes;
+}
+std::size_t ScriptCache::entry_count() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _lru.size();
+}
+std::size_t ScriptCache::hits() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _hits;
+}
+std::size_t ScriptCache::misses() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _misses;
+}
+std::size_t ScriptCache::evictions() const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _evictions;
+}
+
+}
+}
@@ -1,73 +1,164 @@
 #include "tmrl/driver/script_commands.h"
 #include "tmrl/utils/conversions.h"
 
-#include <iomanip>
-
 namespace tmrl
 {
 namespace driver
 {
 
+//
+// CommandTemplate
+//
+
+inline char _xor(const std::string &s)
+{
+  char cs = 0;
+  for (auto c : s) { cs ^= c; }
+  return cs;
+}
+
+CommandTemplate::CommandTemplate(const std::string &id)
+  : _id(id)
+{
+  // TMSCT,<len>,id,<script>,
+  _const_cs = _xor("TMSCT,") ^ ',' ^ _xor(_id) ^ ',' ^ ',';
+}
+CommandTemplate & CommandTemplate::text(const std::string &s)
+{
+  _suffix += s;
+  _const_cs ^= _xor(s);
+  return *this;
+}
+CommandTemplate & CommandTemplate::field(Field kind, int precision, double scale)
+{
+  FieldSpec spec;
+  spec.prefix.swap(_suffix);
+  spec.kind = kind;
+  spec.precision = precision;
+  spec.scale = scale;
+  _fields.push_back(spec);
+  return *this;
+}
+CommandTemplate & CommandTemplate::fixed(int precision, double scale)
+{
+  return field(Field::FIXED, precision, scale);
+}
+CommandTemplate & CommandTemplate::integer()
+{
+  return field(Field::INT, 0, 1.0);
+}
+CommandTemplate & CommandTemplate::digital()
+{
+  return field(Field::DIGITAL, 0, 1.0);
+}
+const std::string & CommandTemplate::render(const double *values)
+{
+  static const char hex[] = "0123456789abcdef";
+  char buf[64];
+  std::size_t len = 0;
+  char cs = _const_cs;
+
+  _body.clear();
+  for (std::size_t i = 0; i < _fields.size(); ++i) {
+    const FieldSpec &spec = _fields[i];
+    _body.append(spec.prefix);
+    switch (spec.kind) {
+    case Field::FIXED:
+      len = utils::format_fixed(buf, sizeof(buf), spec.scale * values[i], spec.precision);
+      if (len >= sizeof(buf)) {
+        // out of range for a script anyway
+        len = utils::format_int(buf, 0);
+      }
+      break;
+    case Field::INT:
+      len = utils::format_int(buf, (long long)(values[i]));
+      break;
+    case Field::DIGITAL:
+      buf[0] = (values[i] == 0.0) ? '0' : '1';
+      len = 1;
+      break;
+    }
+    for (std::size_t k = 0; k < len; ++k) { cs ^= buf[k]; }
+    _body.append(buf, len);
+  }
+  _body.append(_suffix);
+
+  len = utils::format_int(buf, (long long)(_id.size() + 1 + _body.size()));
+  for (std::size_t k = 0; k < len; ++k) { cs ^= buf[k]; }
+
+  _packet.clear();
+  _packet.append("$TMSCT,", 7);
+  _packet.append(buf, len);
+  _packet.push_back(',');
+  _packet.append(_id);
+  _packet.push_back(',');
+  _packet.append(_body);
+  _packet.append(",*", 2);
+  _packet.push_back(hex[(unsigned char)(cs) >> 4]);
+  _packet.push_back(hex[(unsigned char)(cs) & 0x0f]);
+  _packet.append("\r\n", 2);
+  return _packet;
+}
+
 namespace cmd
 {
 
 std::string queue_tag(int tag, int wait)
 {
-  std::stringstream ss;
-  ss << "QueueTag(" << tag << "," << wait << ")";
-  return ss.str();
+  utils::StrBuilder sb(32);
+  sb.append("QueueTag(").append_int(tag).append(',').append_int(wait).append(')');
+  return sb.release();
 }
 std::string wait_queue_tag(int tag, int timeout_ms)
 {
-  std::stringstream ss;
-  ss << "WaitQueueTag(" << tag << "," << timeout_ms << ")";
-  return ss.str();
+  utils::StrBuilder sb(32);
+  sb.append("WaitQueueTag(").append_int(tag).append(',').append_int(timeout_ms).append(')');
+  return sb.release();
 }
 std::string IO(IOModule module, IOType type, int pin, float state)
 {
   static std::string io_module_name[] = { "ControlBox", "EndModule" };
   static std::string io_type_name[] = { "DI", "DO", "InstantDO", "AI", "AO", "InstantAO" };
 
-  std::string script =
-    "IO[" + io_module_name[(int)(module)]
-    + "]." + io_type_name[(int)(type)]
-    + "[" + std::to_string(pin) + "]=";
+  utils::StrBuilder sb(48);
+  sb.append("IO[").append(io_module_name[(int)(module)])
+    .append("].").append(io_type_name[(int)(type)])
+    .append('[').append_int(pin).append("]=");
   if (type == IOType::DI || type == IOType::DO || type == IOType::InstantDO) {
     if (state == 0.0f)
-      script += "0";
+      sb.append('0');
     else
-      script += "1";
+      sb.append('1');
   }
   else {
-    script += std::to_string(state);
+    // as std::to_string
+    sb.append_fixed(state, 6);
   }
-  return script;
+  return sb.release();
+}
+static std::string _motion(const char *head, const PoseEular &values,
+  int vel, int acct_ms, int blend_percent, bool fine_goal, int precision)
+{
+  utils::StrBuilder sb(128);
+  sb.append(head);
+  for (auto &value : values) { sb.append_fixed(value, precision).append(','); }
+  sb.append_int(vel).append(',').append_int(acct_ms).append(',').append_int(blend_percent).append(',');
+  sb.append_bool(fine_goal).append(')');
+  return sb.release();
 }
 std::string PTP_J(const vector6d &angs,
   int vel_percent, double acc_time, int blend_percent, bool fine_goal, int precision)
 {
   auto angs_deg = utils::degs(angs);
   int acct_ms = (int)(1000.0 * acc_time);
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(precision);
-  ss << "PTP(\"JPP\",";
-  for (auto &value : angs_deg) { ss << value << ","; }
-  ss << vel_percent << "," << acct_ms << "," << blend_percent << ",";
-  ss << std::boolalpha << fine_goal << ")";
-  return ss.str();
+  return _motion("PTP(\"JPP\",", angs_deg, vel_percent, acct_ms, blend_percent, fine_goal, precision);
 }
 std::string PTP_T(const PoseEular &pose,
   int vel_percent, double acc_time, int blend_percent, bool fine_goal, int precision)
 {
   auto pose_mmdeg = utils::mmdeg(pose);
   int acct_ms = (int)(1000.0 * acc_time);
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(precision);
-  ss << "PTP(\"CPP\",";
-  for (auto &value : pose_mmdeg) { ss << value << ","; }
-  ss << vel_percent << "," << acct_ms << "," << blend_percent << ",";
-  ss << std::boolalpha << fine_goal << ")";
-  return ss.str();
+  return _motion("PTP(\"CPP\",", pose_mmdeg, vel_percent, acct_ms, blend_percent, fine_goal, precision);
 }
 std::string Line_T(const PoseEular &pose,
   double vel, double acc_time, int blend_percent, bool fine_goal, int precision)
@@ -75,59 +166,148 @@ std::string Line_T(const PoseEular &pose,
   auto pose_mmdeg = utils::mmdeg(pose);
   int vel_mm = (int)(1000.0 * vel);
   int acct_ms = (int)(1000.0 * acc_time);
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(precision);
-  ss << "Line(\"CAP\",";
-  for (auto &value : pose_mmdeg) { ss << value << ","; }
-  ss << vel_mm << "," << acct_ms << "," << blend_percent << ",";
-  ss << std::boolalpha <<fine_goal << ")";
-  return ss.str();
+  return _motion("Line(\"CAP\",", pose_mmdeg, vel_mm, acct_ms, blend_percent, fine_goal, precision);
 }
-std::string pvt_point(PvtMode mode,
-  double t, const vectorXd &pos, const vectorXd &vel, int precision)
+struct _FixedPrecision {
+  int precision;
+  void operator()(utils::StrBuilder &sb, double value, double /*tol*/) const
+  {
+    sb.append_fixed(value, precision);
+  }
+};
+struct _WithinTolerance {
+  void operator()(utils::StrBuilder &sb, double value, double tol) const
+  {
+    sb.append_shortest(value, tol);
+  }
+};
+template<typename Format>
+void _append_pvt_point(utils::StrBuilder &sb, PvtMode mode,
+  double t, const vectorXd &pos, const vectorXd &vel, const Tolerance &tol, const Format &fmt)
 {
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(precision);
-  ss << "PVTPoint(";
+  sb.append("PVTPoint(");
   if (mode == PvtMode::Joint) {
-    for (auto &value : pos) { ss << utils::deg(value) << ","; }
-    for (auto &value : vel) { ss << utils::deg(value) << ","; }
+    for (auto &value : pos) { fmt(sb, utils::deg(value), tol.deg); sb.append(','); }
+    for (auto &value : vel) { fmt(sb, utils::deg(value), tol.deg); sb.append(','); }
   }
   else {
     auto pv = utils::mmdeg(to_arrayd<6>(pos));
-    for (auto &value : pv) { ss << value << ","; }
+    for (size_t i = 0; i < 6; ++i) { fmt(sb, pv[i], (i < 3) ? tol.mm : tol.deg); sb.append(','); }
     auto vv = utils::mmdeg(to_arrayd<6>(vel));
-    for (auto &value : vv) { ss << value << ","; }
+    for (size_t i = 0; i < 6; ++i) { fmt(sb, vv[i], (i < 3) ? tol.mm : tol.deg); sb.append(','); }
   }
-  ss << t << ")";
-  return ss.str();
+  fmt(sb, t, tol.sec);
+  sb.append(')');
+}
+void append_pvt_point(utils::StrBuilder &sb, PvtMode mode,
+  double t, const vectorXd &pos, const vectorXd &vel, int precision)
+{
+  _append_pvt_point(sb, mode, t, pos, vel, Tolerance{}, _FixedPrecision{ precision });
+}
+void append_pvt_point(utils::StrBuilder &sb, PvtMode mode,
+  double t, const vectorXd &pos, const vectorXd &vel, const Tolerance &tol)
+{
+  _append_pvt_point(sb, mode, t, pos, vel, tol, _WithinTolerance{});
+}
+std::string pvt_point(PvtMode mode,
+  double t, const vectorXd &pos, const vectorXd &vel, int precision)
+{
+  utils::StrBuilder sb(160);
+  append_pvt_point(sb, mode, t, pos, vel, precision);
+  return sb.release();
 }
 std::string pvt_traj(const PvtTraj &pvts, int precision)
 {
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(precision);
-  if (pvts.mode == PvtMode::Joint) {
-    ss << "PVTEnter(0)\r\n";
-    for (auto &point : pvts.points) {
-      ss << "PVTPoint(";
-      for (auto &value : point.positions) { ss << utils::deg(value) << ","; }
-      for (auto &value : point.velocities) { ss << utils::deg(value) << ","; }
-      ss << point.time << ")\r\n";
-    }
+  utils::StrBuilder sb(32 + 160 * pvts.points.size());
+  sb.append((pvts.mode == PvtMode::Joint) ? "PVTEnter(0)\r\n" : "PVTEnter(1)\r\n");
+  append_pvt_points(sb, pvts, 0, pvts.points.size(), precision);
+  sb.append("PVTExit()");
+  return sb.release();
+}
+std::string pvt_points(const PvtTraj &pvts, size_t begin, size_t end, int precision)
+{
+  if (end > pvts.points.size()) end = pvts.points.size();
+  utils::StrBuilder sb((end > begin) ? 160 * (end - begin) : 0);
+  append_pvt_points(sb, pvts, begin, end, precision);
+  return sb.release();
+}
+void append_pvt_points(utils::StrBuilder &sb,
+  const PvtTraj &pvts, size_t begin, size_t end, int precision)
+{
+  if (end > pvts.points.size()) end = pvts.points.size();
+  for (size_t k = begin; k < end; ++k) {
+    append_pvt_point(sb, pvts.mode, pvts.points[k], precision);
+    sb.append("\r\n", 2);
   }
-  else {
-    ss << "PVTEnter(1)\r\n";
-    for (auto &point : pvts.points) {
-      ss << "PVTPoint(";
-      auto pv = utils::mmdeg(to_arrayd<6>(point.positions));
-      for (auto &value : pv) { ss << value << ","; }
-      auto vv = utils::mmdeg(to_arrayd<6>(point.velocities));
-      for (auto &value : vv) { ss << value << ","; }
-      ss << point.time << ")\r\n";
-    }
+}
+
+std::string pvt_point(PvtMode mode, const PvtPoint &point, const Tolerance &tol)
+{
+  utils::StrBuilder sb(128);
+  append_pvt_point(sb, mode, point, tol);
+  return sb.release();
+}
+std::string pvt_traj(const PvtTraj &pvts, const Tolerance &tol)
+{
+  utils::StrBuilder sb(32 + 128 * pvts.points.size());
+  sb.append((pvts.mode == PvtMode::Joint) ? "PVTEnter(0)\r\n" : "PVTEnter(1)\r\n");
+  append_pvt_points(sb, pvts, 0, pvts.points.size(), tol);
+  sb.append("PVTExit()");
+  return sb.release();
+}
+std::string pvt_points(const PvtTraj &pvts, size_t begin, size_t end, const Tolerance &tol)
+{
+  if (end > pvts.points.size()) end = pvts.points.size();
+  utils::StrBuilder sb((end > begin) ? 128 * (end - begin) : 0);
+  append_pvt_points(sb, pvts, begin, end, tol);
+  return sb.release();
+}
+void append_pvt_points(utils::StrBuilder &sb,
+  const PvtTraj &pvts, size_t begin, size_t end, const Tolerance &tol)
+{
+  if (end > pvts.points.size()) end = pvts.points.size();
+  for (size_t k = begin; k < end; ++k) {
+    append_pvt_point(sb, pvts.mode, pvts.points[k], tol);
+    sb.append("\r\n", 2);
+  }
+}
+std::vector<std::string> pvt_point_chunks(const PvtTraj &pvts,
+  std::size_t chunk_size, utils::ThreadPool &pool, int precision)
+{
+  const std::size_t size = pvts.points.size();
+  if (chunk_size == 0) chunk_size = 1;
+  std::vector<std::string> chunks((size + chunk_size - 1) / chunk_size);
+
+  pool.parallel_for(chunks.size(), [&](std::size_t k)
+  {
+    std::size_t begin = k * chunk_size;
+    std::size_t end = (begin + chunk_size < size) ? begin + chunk_size : size;
+    utils::StrBuilder sb(160 * (end - begin));
+    append_pvt_points(sb, pvts, begin, end, precision);
+    chunks[k] = sb.release();
+  });
+  return chunks;
+}
+std::string pvt_traj(const PvtTraj &pvts, utils::ThreadPool &pool, int precision)
+{
+  // below a few thousand points the hand-off costs more than it saves
+  const std::size_t size = pvts.points.size();
+  if (size < 4096 || pool.size() == 0) {
+    return pvt_traj(pvts, precision);
   }
-  ss << "PVTExit()";
-  return ss.str();
+  std::size_t chunk_count = 4 * (pool.size() + 1);
+  std::size_t chunk_size = (size + chunk_count - 1) / chunk_count;
+  if (chunk_size < 1024) chunk_size = 1024;
+
+  auto chunks = pvt_point_chunks(pvts, chunk_size, pool, precision);
+
+  std::size_t len = 32;
+  for (auto &chunk : chunks) { len += chunk.size(); }
+  utils::StrBuilder sb(len);
+  sb.append((pvts.mode == PvtMode::Joint) ? "PVTEnter(0)\r\n" : "PVTEnter(1)\r\n");
+  for (auto &chunk : chunks) { sb.append(chunk); }
+  sb.append("PVTExit()");
+  return sb.release();
 }
 
 
@@ -144,36 +324,83 @@ std::string vel_mode_start(VelMode mode, double timeout_zero_vel, double timeout
 }
 std::string vel_mode_target(VelMode mode, const vector6d &vel, int precision)
 {
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(precision);
+  utils::StrBuilder sb(128);
   if (mode == VelMode::Joint) {
-    ss << "SetContinueVJog(";
+    sb.append("SetContinueVJog(");
     if (vel.size() > 0) {
       size_t i = 0;
       for (; i < vel.size() - 1; ++i) {
-        ss << utils::deg(vel[i]) << ",";
+        sb.append_fixed(utils::deg(vel[i]), precision).append(',');
       }
-      ss << utils::deg(vel[i]);
+      sb.append_fixed(utils::deg(vel[i]), precision);
     }
-    ss << ")";
+    sb.append(')');
   }
   else {
-    ss << "SetContinueVLine(";
+    sb.append("SetContinueVLine(");
     if (vel.size() >= 3) {
       size_t i = 0;
       for (; i < 3; ++i) {
-        ss << (1000.0 * vel[i]) << ",";
+        sb.append_fixed(1000.0 * vel[i], precision).append(',');
       }
       for (; i < vel.size() - 1; ++i) {
-        ss << utils::deg(vel[i]) << ",";
+        sb.append_fixed(utils::deg(vel[i]), precision).append(',');
       }
-      ss << utils::deg(vel[i]);
+      sb.append_fixed(utils::deg(vel[i]), precision);
     }
-    ss << ")";
+    sb.append(')');
   }
-  return ss.str();
+  return sb.release();
 }
 
+CommandTemplate vel_mode_target_template(VelMode mode, const std::string &id, int precision)
+{
+  const double deg = utils::deg(1.0);
+  CommandTemplate tpl(id);
+  if (mode == VelMode::Joint) {
+    tpl.text("SetContinueVJog(");
+    for (size_t i = 0; i < 6; ++i) {
+      if (i) tpl.text(",");
+      tpl.fixed(precision, deg);
+    }
+  }
+  else {
+    tpl.text("SetContinueVLine(");
+    for (size_t i = 0; i < 6; ++i) {
+      if (i) tpl.text(",");
+      tpl.fixed(precision, (i < 3) ? 1000.0 : deg);
+    }
+  }
+  tpl.text(")");
+  return tpl;
+}
+CommandTemplate pvt_point_template(PvtMode mode, const std::string &id, int precision, std::size_t dof)
+{
+  const double deg = utils::deg(1.0);
+  CommandTemplate tpl(id);
+  tpl.text("PVTPoint(");
+  for (size_t k = 0; k < 2; ++k) {
+    for (size_t i = 0; i < dof; ++i) {
+      tpl.fixed(precision, (mode == PvtMode::Tool && i < 3) ? 1000.0 : deg).text(",");
+    }
+  }
+  tpl.fixed(precision).text(")");
+  return tpl;
+}
+CommandTemplate IO_template(IOModule module, IOType type, int pin, const std::string &id)
+{
+  // IO(module, type, pin, 0.0f) is "IO[...].XX[pin]=0"
+  std::string script = IO(module, type, pin, 0.0f);
+  CommandTemplate tpl(id);
+  if (type == IOType::DI || type == IOType::DO || type == IOType::InstantDO) {
+    tpl.text(script.substr(0, script.size() - 1)).digital();
+  }
+  else {
+    tpl.text(script.substr(0, script.find('=') + 1)).fixed(6);
+  }
+  return tpl;
+}
+
+}
 }
 }
-}
\ No newline at end of file
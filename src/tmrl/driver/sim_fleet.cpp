@@ -0,0 +1,129 @@
+#include "tmrl/driver/sim_fleet.h"
+
+namespace tmrl
+{
+namespace driver
+{
+
+SimFleet::SimFleet(std::size_t robots, utils::WorkStealingPool *pool)
+  : _tracks(robots)
+  , _pool(pool)
+{
+  for (std::size_t j = 0; j < DOF; ++j) {
+    _pos[j].assign(robots, 0.0);
+    _vel[j].assign(robots, 0.0);
+  }
+  for (auto &tr : _tracks) {
+    tr.curr.time = 0.0;
+    tr.curr.positions.fill(0.0);
+    tr.curr.velocities.fill(0.0);
+  }
+}
+
+void SimFleet::set_joint_angle(std::size_t robot, const vector6d &positions)
+{
+  Track &tr = _tracks[robot];
+  tr.points.clear();
+  tr.next = 0;
+  tr.moving = false;
+  tr.curr.positions = positions;
+  tr.curr.velocities.fill(0.0);
+  for (std::size_t j = 0; j < DOF; ++j) {
+    _pos[j][robot] = positions[j];
+    _vel[j][robot] = 0.0;
+  }
+}
+
+bool SimFleet::add_point(std::size_t robot, const PvtPoint &point)
+{
+  if (robot >= _tracks.size()) return false;
+  _tracks[robot].points.push_back(to_pvt_point<DOF>(point));
+  return true;
+}
+bool SimFleet::add_traj(std::size_t robot, const PvtTraj &pvts)
+{
+  if (robot >= _tracks.size() || pvts.mode != PvtMode::Joint) return false;
+  auto &points = _tracks[robot].points;
+  points.reserve(points.size() + pvts.points.size());
+  for (auto &point : pvts.points) { points.push_back(to_pvt_point<DOF>(point)); }
+  return true;
+}
+
+void SimFleet::tick(std::size_t begin, std::size_t end)
+{
+  for (std::size_t r = begin; r < end; ++r) {
+    Track &tr = _tracks[r];
+    if (!tr.moving) {
+      if (tr.next >= tr.points.size()) continue;
+      tr.moving = true;
+      tr.seg_time = 0.0;
+    }
+    else {
+      tr.seg_time += _period;
+    }
+
+    // segments ending before this tick, times chain without drift
+    while (tr.next < tr.points.size() && tr.seg_time >= tr.points[tr.next].time) {
+      tr.seg_time -= tr.points[tr.next].time;
+      tr.curr = tr.points[tr.next];
+      ++tr.next;
+    }
+
+    std::array<double, DOF> pos, vel;
+    if (tr.next < tr.points.size()) {
+      cubic_interp<DOF>(pos, vel, tr.curr, tr.points[tr.next], tr.seg_time);
+    }
+    else {
+      // end of the queue, stop there
+      tr.curr.velocities.fill(0.0);
+      pos = tr.curr.positions;
+      vel = tr.curr.velocities;
+      tr.points.clear();
+      tr.next = 0;
+      tr.moving = false;
+    }
+    for (std::size_t j = 0; j < DOF; ++j) {
+      _pos[j][r] = pos[j];
+      _vel[j][r] = vel[j];
+    }
+  }
+}
+
+void SimFleet::step(std::size_t ticks)
+{
+  const auto period = std::chrono::duration_cast<utils::Clock::duration>(
+    std::chrono::duration<double>(_period));
+
+  for (std::size_t k = 0; k < ticks; ++k) {
+    if (_pool) {
+      _pool->parallel_for(_tracks.size(), _grain, [this](std::size_t b, std::size_t e) { tick(b, e); });
+    }
+    else {
+      tick(0, _tracks.size());
+    }
+    _clock.advance(period);
+  }
+}
+
+vector6d SimFleet::joint_angle(std::size_t robot) const
+{
+  vector6d rv;
+  for (std::size_t j = 0; j < DOF; ++j) { rv[j] = _pos[j][robot]; }
+  return rv;
+}
+vector6d SimFleet::joint_speed(std::size_t robot) const
+{
+  vector6d rv;
+  for (std::size_t j = 0; j < DOF; ++j) { rv[j] = _vel[j][robot]; }
+  return rv;
+}
+
+std::size_t SimFleet::moving_count() const
+{
+  std::size_t n = 0;
+  for (auto &tr : _tracks) { if (tr.moving) ++n; }
+  return n;
+}
+
+}
+}
@@ -2,29 +2,37 @@
 
 #include "tmrl/utils/logger.h"
 
+#include <algorithm>
+
 namespace tmrl
 {
 namespace driver
 {
 
-SimPvtMotion::SimPvtMotion(RobotState &state)
+SimPvtMotion::SimPvtMotion(RobotState &state, utils::Clock &clock, std::size_t capacity)
   : rs_(state)
+  , clock_(clock)
+  , pvt_buffer_(capacity)
 {
-  remaining_time_ = 0.0;
-  pvt_count_ = 0;
-  pvt_buffer_.clear();
 
-  pvt_curr_.positions = to_vectorXd(rs_.joint_angle());
-  pvt_curr_.velocities = std::vector<double>(rs_.DOF, 0.0);
+  pvt_curr_.time = 0.0;
+  pvt_curr_.positions = rs_.joint_angle();
+  pvt_curr_.velocities.fill(0.0);
   pvt_trgt_ = pvt_curr_;
 
   keep_alive_ = true;
-  pvt_thread_ = std::thread(std::bind(&SimPvtMotion::run, this));
+  if (!clock_.is_virtual()) {
+    pvt_thread_ = std::thread(std::bind(&SimPvtMotion::run, this));
+  }
 }
 
 void SimPvtMotion::stop()
 {
-  keep_alive_ = enabled = false;
+  {
+    std::unique_lock<std::mutex> lck(pvt_mtx_);
+    keep_alive_ = enabled = false;
+  }
+  pvt_cv_.notify_all();
   if (pvt_thread_.joinable()) pvt_thread_.join();
 }
 
@@ -37,7 +45,9 @@ void SimPvtMotion::enter(const vectorXd &init_joint_angle)
 
   const size_t dof = rs_.DOF;
   const vector6d zeros{0};
+  RobotState::Ulock lck(rs_.mtx);
   rs_.set_joint_states(to_arrayd<dof>(init_joint_angle), zeros, zeros);
+  lck.unlock();
 
   //pvt_thread_ = std::thread(std::bind(&SimPvtMotion::run, this));
   // std::thread(std::bind(&SimPvtMotion::run, this)).detach();
@@ -47,40 +57,60 @@ void SimPvtMotion::exit()
   enabled = false;
 }
 
-void SimPvtMotion::add_point(const PvtPoint &p)
+bool SimPvtMotion::add_point(const PvtPoint &p)
 {
-  if (!enabled) return;
- 
-  double rt;
-  size_t cnt;
-  std::unique_lock<std::mutex> lck(pvt_mtx_);
+  if (!enabled) return false;
 
-  pvt_buffer_.push_back(p);
-  cnt = pvt_count_ = pvt_buffer_.size();
-  remaining_time_ += p.time;
-  rt = remaining_time_;
+  if (!pvt_buffer_.push(to_pvt_point<RobotState::DOF>(p))) {
+    tmrl_WARN_STREAM("SimPvtMotion: pvt buffer full");
+    return false;
+  }
+  remaining_ns_ += (long long)(p.time * 1.0e9);
 
-  // lck.unlock();
+  // wake the thread if it sleeps on an empty buffer
+  { std::unique_lock<std::mutex> lck(pvt_mtx_); }
+  pvt_cv_.notify_one();
 
-  // tmrl_INFO_STREAM("++pvt, count: " << cnt << ", remaining_time: " << rt);
+  // tmrl_INFO_STREAM("++pvt, count: " << point_count() << ", remaining_time: " << remaining_time());
+  return true;
+}
+
+void SimPvtMotion::clear()
+{
+  clear_req_ = true;
+  { std::unique_lock<std::mutex> lck(pvt_mtx_); }
+  pvt_cv_.notify_one();
+}
+void SimPvtMotion::clear_buffer()
+{
+  while (pvt_buffer_.front()) { pvt_buffer_.pop(); }
+  remaining_ns_ = 0;
+
+  pvt_curr_.time = 0.0;
+  pvt_curr_.positions = rs_.joint_angle();
+  pvt_curr_.velocities.fill(0.0);
+  pvt_trgt_ = pvt_curr_;
+  {
+    RobotState::Ulock lck(rs_.mtx);
+    rs_.set_joint_states(pvt_curr_.positions, pvt_curr_.velocities, vector6d{0});
+  }
+
+  state_ = IDLE;
+  clear_req_ = false;
 }
 
 SimPvtMotion::State SimPvtMotion::idle()
 {
   State state = IDLE;
-  std::unique_lock<std::mutex> lck(pvt_mtx_);
-
-  if (pvt_buffer_.size() > 0) {
-    pvt_trgt_ = pvt_buffer_.front();
+  const Point *front = pvt_buffer_.front();
 
-    lck.unlock();
+  if (front) {
+    pvt_trgt_ = *front;
 
     pvt_curr_.time = 0.0;
-
-    tmrl_INFO_STREAM("moving...");
     state = MOVING;
 
-    t_start_ = std::chrono::steady_clock::now();
+    t_start_ = clock_.now();
     t_last_ = t_start_;
   }
   return state;
@@ -89,7 +119,7 @@ SimPvtMotion::State SimPvtMotion::moving()
 {
   State state = MOVING;
 
-  auto check_is_zeros = [](const std::vector<double> &vec)
+  auto check_is_zeros = [](const vector6d &vec)
   {
     bool is_zeros = true;
     for (auto &v : vec) {
@@ -99,108 +129,160 @@ SimPvtMotion::State SimPvtMotion::moving()
   };
 
   // time
-  auto t_curr = std::chrono::steady_clock::now();
+  auto t_curr = clock_.now();
   double t    = std::chrono::duration_cast<std::chrono::duration<double> >(t_curr - t_start_).count();
-  double dur  = std::chrono::duration_cast<std::chrono::duration<double> >(t_curr - t_last_).count();
+  long long dur_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t_curr - t_last_).count();
   t_last_ = t_curr;
 
   // interp
-  PvtPoint p;
-  p.positions.resize(pvt_curr_.positions.size());
-  p.velocities.resize(pvt_curr_.velocities.size());
-  interp(p, pvt_curr_, pvt_trgt_, t);
+  vector6d pos, vel;
+  cubic_interp(pos, vel, pvt_curr_, pvt_trgt_, t);
 
-  // remaining time
-  pvt_mtx_.lock();
-  remaining_time_ -= dur;
-  if (remaining_time_ < 0.0) { remaining_time_ = 0.0; }
-  pvt_mtx_.unlock();
+  // remaining time, not below 0
+  long long rt = remaining_ns_.load();
+  while (!remaining_ns_.compare_exchange_weak(rt, (rt > dur_ns) ? rt - dur_ns : 0)) {}
 
   // next point
   if (t >= pvt_trgt_.time) {
-    t_start_ = t_curr;
+    // the next segment starts where this one ended, not at this tick
+    t_start_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(pvt_trgt_.time));
     pvt_curr_ = pvt_trgt_;
 
-    double rt;
-    std::size_t cnt;
-    std::unique_lock<std::mutex> lck(pvt_mtx_);
-    //pvt_buffer_.erase(pvt_buffer_.begin());
-    pvt_buffer_.pop_front();
-    cnt = pvt_count_ = pvt_buffer_.size();
-    rt = remaining_time_;
+    pvt_buffer_.pop();
+    const Point *next = pvt_buffer_.front();
 
-    if (cnt > 0) {
-      pvt_trgt_ = pvt_buffer_.front();
+    if (next) {
+      pvt_trgt_ = *next;
 
-      lck.unlock();
-
-      // tmrl_INFO_STREAM("--pvt, count: " << cnt << ", remaining_time: " << rt);
+      // tmrl_INFO_STREAM("--pvt, count: " << point_count() << ", remaining_time: " << remaining_time());
     }
     else {
-      rt = remaining_time_ = 0.0;
-
-      lck.unlock();
-
       // check zeros
       if (!check_is_zeros(pvt_curr_.velocities)) {
         tmrl_WARN_STREAM("pvt end point has speed");
       }
-      pvt_curr_.velocities = std::vector<double>(pvt_curr_.positions.size(), 0.0);
-      p.positions = pvt_curr_.positions;
-      p.velocities = pvt_curr_.velocities;
-
-      // tmrl_INFO_STREAM("--pvt, count: " << cnt << ", remaining_time: " << rt);
-      tmrl_INFO_STREAM("idle...");
+      pvt_curr_.velocities.fill(0.0);
+      pos = pvt_curr_.positions;
+      vel = pvt_curr_.velocities;
       state = IDLE;
     }
   }
 
-  // update joint state
-  const size_t dof = rs_.DOF;
-  rs_.set_joint_states(to_arrayd<dof>(p.positions), to_arrayd<dof>(p.velocities), vector6d{0});
+  // update joint state, readers on other threads take the lock
+  RobotState::Ulock lck(rs_.mtx);
+  rs_.set_joint_states(pos, vel, vector6d{0});
+  lck.unlock();
 
   return state;
 }
 
+void SimPvtMotion::set_period(double period)
+{
+  if (period <= 0.0) return;
+  period_ns_ = (long long)(period * 1.0e9 + 0.5);
+}
+
+SimPvtMotion::Timing SimPvtMotion::timing() const
+{
+  Timing rv;
+  rv.ticks = ticks_;
+  rv.overruns = overruns_;
+  rv.period = period();
+
+  std::size_t n = std::min<std::size_t>(jitter_count_, JITTER_SAMPLES);
+  if (n == 0) return rv;
+
+  std::vector<long long> samples(n);
+  for (std::size_t i = 0; i < n; ++i) { samples[i] = jitter_ns_[i].load(std::memory_order_relaxed); }
+
+  auto percentile = [&samples](double q)
+  {
+    std::size_t k = (std::size_t)(q * (double)(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return 1.0e-9 * (double)(samples[k]);
+  };
+  rv.jitter_p50 = percentile(0.5);
+  rv.jitter_p99 = percentile(0.99);
+  rv.jitter_p999 = percentile(0.999);
+  rv.jitter_max = 1.0e-9 * (double)(*std::max_element(samples.begin(), samples.end()));
+  return rv;
+}
+
+void SimPvtMotion::reset_timing()
+{
+  ticks_ = 0;
+  overruns_ = 0;
+  jitter_count_ = 0;
+}
+
+SimPvtMotion::State SimPvtMotion::tick()
+{
+  if (clear_req_) clear_buffer();
+
+  // a point found while idle is started in the same tick
+  if (state_ == IDLE) state_ = state_func[IDLE]();
+  if (state_ == MOVING) state_ = state_func[MOVING]();
+  return state_;
+}
+
+std::size_t SimPvtMotion::step(std::size_t ticks, std::vector<SimSample> *samples)
+{
+  if (!clock_.is_virtual()) {
+    tmrl_WARN_STREAM("SimPvtMotion: step needs a virtual clock");
+    return 0;
+  }
+  if (samples) samples->reserve(samples->size() + ticks);
+
+  const std::chrono::nanoseconds period(period_ns_);
+  for (std::size_t i = 0; i < ticks; ++i) {
+    tick();
+    if (samples) {
+      samples->push_back(SimSample{ clock_.seconds(clock_.now()), rs_.joint_angle(), rs_.joint_speed() });
+    }
+    clock_.sleep_until(clock_.now() + period);
+  }
+  ticks_ += ticks;
+  return ticks;
+}
+
 void SimPvtMotion::run()
 {
   tmrl_INFO_STREAM("pvt thread begin");
 
-  State state = IDLE;
-
-  size_t cnt_pb = 0;
-  size_t cnt_ct = 0;
-  auto t0 = std::chrono::steady_clock::now();
+  utils::Clock::time_point deadline;
 
   while (keep_alive_)
   {
-    // if (!enabled && pvt_count_ == 0) break;
-    while (enabled || pvt_count_ != 0)
-    {
-    state = state_func[state]();
-
-    // update joint state every 50ms
-    if (cnt_pb == 0) {
-      // ...
+    if (state_ == IDLE) {
+      // wait for points instead of polling
+      std::unique_lock<std::mutex> lck(pvt_mtx_);
+      pvt_cv_.wait(lck, [this] { return !keep_alive_ || clear_req_ || !pvt_buffer_.empty(); });
+      if (!keep_alive_) break;
+      lck.unlock();
+
+      deadline = clock_.now();
     }
-    cnt_pb = (cnt_pb + 1) % 50;
-
-    // check and fix timer every 100ms
-    bool slp = true;
-    if (cnt_ct == 0) {
-      // check timer
-      auto t1 = std::chrono::steady_clock::now();
-      auto dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-      t0 = t1;
-      if (dur_ms > 100) {
-        slp = false;
-      }
+    tick();
+
+    // next absolute deadline
+    const std::chrono::nanoseconds period(period_ns_);
+    deadline += period;
+    clock_.sleep_until(deadline);
+
+    auto late = clock_.now() - deadline;
+    long long late_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(late).count();
+    std::size_t missed = 0;
+    if (late >= period) {
+      // skip the missed ticks, keep the phase
+      missed = (std::size_t)(late / period);
+      deadline += missed * period;
     }
-    cnt_ct = (cnt_ct + 1) % 100;
 
-    if (slp) std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ++ticks_;
+    overruns_ += missed;
+    jitter_ns_[jitter_count_ % JITTER_SAMPLES].store(late_ns, std::memory_order_relaxed);
+    ++jitter_count_;
   }
   tmrl_INFO_STREAM("pvt thread end");
 }
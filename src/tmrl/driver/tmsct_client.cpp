@@ -50,6 +50,17 @@ bool TmsctClient::send_sta_request(const std::string &subcmd, const std::string
     set_reconnet();
   return (rc == comm::RetCode::OK);
 }
+bool TmsctClient::send_packed(const char *bytes, std::size_t len)
+{
+  int n = 0;
+  comm::RetCode rc = _client.send_bytes(bytes, (int)(len), &n);
+  if (rc == comm::RetCode::NOTSENDALL) {
+    rc = _client.send_bytes_all(bytes + n, (int)(len) - n);
+  }
+  if (rc == comm::RetCode::ERR)
+    set_reconnet();
+  return (rc == comm::RetCode::OK);
+}
 
 bool TmsctClient::receive(const std::vector<comm::Packet> &pack_vec)
 {
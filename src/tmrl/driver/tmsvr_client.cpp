@@ -45,7 +45,7 @@ bool TmsvrClient::receive(const std::vector<comm::Packet> &pack_vec)
   using namespace comm;
   TmsvrPacket tmsvr;
   CperrPacket cperr;
-  bool fb = false;
+  int fb = 0;
 
   for (auto &pack : pack_vec) {
     if (pack.header() == Packet::Header::TMSVR) {
@@ -60,7 +60,7 @@ bool TmsvrClient::receive(const std::vector<comm::Packet> &pack_vec)
         tmsvr.unpack_content(pack.data().data(), pack.data().size());
         // parse robot state
         robot_state.deserialize_with_lock(tmsvr.content().data(), tmsvr.content().size());
-        fb = true;
+        ++fb;
         break;
       case TmsvrPacket::Mode::READ_STRING:
       case TmsvrPacket::Mode::READ_JSON:
@@ -84,6 +84,7 @@ bool TmsvrClient::receive(const std::vector<comm::Packet> &pack_vec)
     }
   }
   if (fb) {
+    watchdog_kick(fb);
     _feedbackCallback(robot_state);
   }
   return true;
@@ -0,0 +1,344 @@
+#include "tmrl/mock/impair_proxy.h"
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+namespace tmrl
+{
+namespace mock
+{
+
+ImpairProxy::ImpairProxy(const Config &config)
+  : _config(config)
+  , _server(config.listen_port)
+  , _rng(config.seed)
+{
+}
+ImpairProxy::~ImpairProxy()
+{
+  stop();
+}
+
+bool ImpairProxy::start()
+{
+  if (_keep_alive) return true;
+  if (!_server.listen(_config.listen_ip)) return false;
+
+  _t0 = std::chrono::steady_clock::now();
+  _keep_alive = true;
+  _thd = std::thread(std::bind(&ImpairProxy::run, this));
+  return true;
+}
+void ImpairProxy::stop()
+{
+  _keep_alive = false;
+  if (_thd.joinable()) _thd.join();
+  _server.close();
+}
+
+double ImpairProxy::now() const
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - _t0).count();
+}
+
+void ImpairProxy::set_impairment(Direction dir, const Impairment &imp)
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  if (dir != Direction::DOWN) _up = imp;
+  if (dir != Direction::UP) _down = imp;
+}
+Impairment ImpairProxy::impairment(Direction dir) const
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return (dir == Direction::UP) ? _up : _down;
+}
+void ImpairProxy::clear()
+{
+  set_impairment(Direction::BOTH, Impairment());
+  _stall = false;
+  _refuse = false;
+}
+
+void ImpairProxy::stall(bool on)
+{
+  _stall = on;
+}
+void ImpairProxy::drop()
+{
+  _drop_req = true;
+}
+void ImpairProxy::refuse(bool on)
+{
+  _refuse = on;
+}
+
+ImpairProxy::Stats ImpairProxy::stats() const
+{
+  Stats rv;
+  rv.connections = _connections;
+  rv.drops = _drops;
+  rv.refused = _refused;
+  rv.bytes_up = _bytes_up;
+  rv.bytes_down = _bytes_down;
+  std::unique_lock<std::mutex> lck(_mtx);
+  rv.max_gap = _max_gap;
+  rv.recover = _recover;
+  return rv;
+}
+void ImpairProxy::reset_stats()
+{
+  _connections = 0;
+  _drops = 0;
+  _refused = 0;
+  _bytes_up = 0;
+  _bytes_down = 0;
+  std::unique_lock<std::mutex> lck(_mtx);
+  _max_gap = 0.0;
+}
+
+int ImpairProxy::connect_to(const std::string &ip, unsigned short port, int timeout_ms)
+{
+  int fd = (int)(socket(AF_INET, SOCK_STREAM, 0));
+  if (fd < 0) return -1;
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, ip.c_str(), &(addr.sin_addr));
+
+  // non-blocking connect, an unreachable controller does not hang the proxy
+#ifdef _WIN32
+  u_long mode = 1;
+  ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+#else
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+  int rv = connect(fd, (sockaddr *)&addr, sizeof(addr));
+  if (rv < 0) {
+    fd_set wset;
+    timeval tv;
+    FD_ZERO(&wset);
+    FD_SET(fd, &wset);
+    tv.tv_sec = (timeout_ms / 1000);
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (select(fd + 1, NULL, &wset, NULL, &tv) <= 0 ||
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0 || err != 0) {
+      comm::Server::close_fd(fd);
+      return -1;
+    }
+  }
+#ifdef _WIN32
+  mode = 0;
+  ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+#else
+  fcntl(fd, F_SETFL, flags);
+#endif
+
+  int optflag = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&optflag, sizeof(optflag)) < 0) {
+    tmrl_WARN_STREAM("TM_COM: setsockopt TCP_NODELAY failed");
+  }
+  return fd;
+}
+
+void ImpairProxy::reset_fd(int fd)
+{
+  // close with RST instead of FIN
+  linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, (char *)&lg, sizeof(lg));
+  comm::Server::close_fd(fd);
+}
+
+void ImpairProxy::run()
+{
+  tmrl_INFO_STREAM("MOCK_PROXY: " << _config.listen_ip << ":" << _config.listen_port
+    << " -> " << _config.target_ip << ":" << _config.target_port);
+
+  int fd = -1;
+  while (_keep_alive) {
+    if (fd < 0) fd = _server.accept(100);
+    if (fd < 0) continue;
+
+    if (_refuse) {
+      ++_refused;
+      reset_fd(fd);
+      fd = -1;
+      continue;
+    }
+    int target_fd = connect_to(_config.target_ip, _config.target_port, 1000);
+    if (target_fd < 0) {
+      tmrl_WARN_STREAM("MOCK_PROXY: can not connect to " << _config.target_ip << ":" << _config.target_port);
+      ++_refused;
+      reset_fd(fd);
+      fd = -1;
+      continue;
+    }
+    ++_connections;
+    tmrl_INFO_STREAM("MOCK_PROXY: client connected");
+    // a drop before the connection is for no one
+    _drop_req = false;
+
+    fd = serve(fd, target_fd);
+  }
+  if (fd >= 0) comm::Server::close_fd(fd);
+  tmrl_INFO_STREAM("MOCK_PROXY: thread end");
+}
+
+int ImpairProxy::serve(int client_fd, int target_fd)
+{
+  Pipe up, down;
+  up.dir = Direction::UP;
+  up.src = client_fd;
+  up.dst = target_fd;
+  down.dir = Direction::DOWN;
+  down.src = target_fd;
+  down.dst = client_fd;
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    _last_down = -1.0;
+  }
+  int next_fd = -1;
+  bool reset = false;
+
+  while (_keep_alive) {
+    if (_drop_req.exchange(false)) {
+      tmrl_INFO_STREAM("MOCK_PROXY: drop connection");
+      ++_drops;
+      std::unique_lock<std::mutex> lck(_mtx);
+      _drop_time = now();
+      reset = true;
+      break;
+    }
+    // a new client replaces this connection
+    next_fd = _server.accept(0);
+    if (next_fd >= 0) {
+      tmrl_INFO_STREAM("MOCK_PROXY: new client, close connection");
+      break;
+    }
+
+    double t = now();
+    double wake = t + 0.01;
+    if (!forward(up, t, wake) || !forward(down, t, wake)) break;
+
+    fd_set rset;
+    FD_ZERO(&rset);
+    FD_SET(client_fd, &rset);
+    FD_SET(target_fd, &rset);
+    double wait = std::max(0.0, wake - t);
+    timeval tv;
+    tv.tv_sec = (long)(wait);
+    tv.tv_usec = (long)(1.0e6 * (wait - (double)(tv.tv_sec)));
+    int rv = select(std::max(client_fd, target_fd) + 1, &rset, NULL, NULL, &tv);
+    if (rv < 0) break;
+    if (rv == 0) continue;
+
+    t = now();
+    if (FD_ISSET(client_fd, &rset) && !receive(up, t)) break;
+    if (FD_ISSET(target_fd, &rset) && !receive(down, t)) break;
+  }
+  if (reset) {
+    reset_fd(client_fd);
+    reset_fd(target_fd);
+  }
+  else {
+    comm::Server::close_fd(client_fd);
+    comm::Server::close_fd(target_fd);
+  }
+  tmrl_INFO_STREAM("MOCK_PROXY: connection closed");
+  return next_fd;
+}
+
+bool ImpairProxy::receive(Pipe &pipe, double t)
+{
+  char buf[0x10000];
+  int n = comm::Server::recv_some(pipe.src, buf, sizeof(buf));
+  if (n <= 0) return false;
+
+  double latency = 0.0;
+  {
+    std::unique_lock<std::mutex> lck(_mtx);
+    const Impairment &imp = (pipe.dir == Direction::UP) ? _up : _down;
+    latency = imp.latency;
+    if (imp.jitter > 0.0) latency += std::uniform_real_distribution<double>(0.0, imp.jitter)(_rng);
+  }
+  // tcp keeps the order, a chunk never overtakes the one before
+  Chunk chunk;
+  chunk.due = std::max(t + latency, pipe.last_due);
+  chunk.bytes.assign(buf, n);
+  pipe.last_due = chunk.due;
+  pipe.queue.push_back(std::move(chunk));
+  return true;
+}
+
+bool ImpairProxy::forward(Pipe &pipe, double t, double &wake)
+{
+  if (_stall) return true;
+
+  const Impairment imp = impairment(pipe.dir);
+  while (!pipe.queue.empty()) {
+    Chunk &chunk = pipe.queue.front();
+    if (chunk.due > t) {
+      wake = std::min(wake, chunk.due);
+      break;
+    }
+    if (imp.bandwidth > 0.0 && pipe.next_send > t) {
+      wake = std::min(wake, pipe.next_send);
+      break;
+    }
+    std::size_t n = chunk.bytes.size();
+    if (imp.segment > 0) n = std::min(n, imp.segment);
+    // at most 10 ms of bytes at a time
+    if (imp.bandwidth > 0.0) n = std::min(n, std::max((std::size_t)(1), (std::size_t)(0.01 * imp.bandwidth)));
+
+    if (comm::Server::send_all(pipe.dst, chunk.bytes.data(), n) != comm::RetCode::OK) return false;
+
+    if (pipe.dir == Direction::UP) {
+      _bytes_up += n;
+    }
+    else {
+      _bytes_down += n;
+      on_down_send(t);
+    }
+    if (imp.bandwidth > 0.0) pipe.next_send = std::max(t, pipe.next_send) + (double)(n) / imp.bandwidth;
+
+    if (n == chunk.bytes.size()) pipe.queue.pop_front();
+    else chunk.bytes.erase(0, n);
+  }
+  return true;
+}
+
+void ImpairProxy::on_down_send(double t)
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  if (_last_down >= 0.0) _max_gap = std::max(_max_gap, t - _last_down);
+  _last_down = t;
+  if (_drop_time >= 0.0) {
+    _recover = t - _drop_time;
+    _drop_time = -1.0;
+  }
+}
+
+}
+}
@@ -0,0 +1,294 @@
+#include "tmrl/mock/impair_proxy.h"
+#include "tmrl/mock/mock_tmsvr.h"
+#include "tmrl/mock/mock_tmsct.h"
+#include "tmrl/driver/tmsvr_client.h"
+#include "tmrl/utils/logger.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <cstdlib>
+#include <csignal>
+
+/*
+ * TCP proxy that impairs the connection to a TM controller
+ *
+ * tmr_impair_proxy [--listen 127.0.0.2] [--target 127.0.0.1] [--ports 5890,5891]
+ *   [--latency ms] [--jitter ms] [--bandwidth bytes/s] [--segment n]
+ *   [--script file] [--mock] [--client] [--reconnect sec] [--watchdog periods]
+ *   [--duration sec]
+ *
+ * The driver connects to the listen ip instead of the controller.
+ * --mock runs the mock controller on the target ip, --client a TmsvrClient
+ * through the proxy whose feedback gaps are reported too.
+ *
+ * Script, one command per line, t in s from start, latency and jitter in ms:
+ *   <t> set [up|down|both] [latency=20] [jitter=5] [bandwidth=100000] [segment=7]
+ *   <t> clear
+ *   <t> stall on|off
+ *   <t> drop
+ *   <t> refuse on|off
+ *   <t> quit
+ * port=<n> at the end of a line limits it to one port. # starts a comment.
+ *
+ * Every second, per port: bytes, the longest gap of bytes to the client (ms)
+ * and after a drop the time until bytes reached the client again (s).
+ * With --client also the longest gap between its feedback callbacks, which
+ * spans a whole drop and reconnect. --watchdog sets its stall periods, the
+ * stalls it detects are counted with the time they took to detect (ms).
+ */
+
+using namespace tmrl;
+
+static volatile std::sig_atomic_t g_quit = 0;
+static void on_signal(int) { g_quit = 1; }
+
+namespace
+{
+
+struct Command {
+  double t = 0.0;
+  std::string name;
+  std::string dir = "both";
+  std::string arg;
+  std::map<std::string, double> values;
+  int port = 0;
+  int line = 0;
+};
+
+std::vector<std::string> split(const std::string &s, char sep)
+{
+  std::vector<std::string> rv;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, sep)) { if (!item.empty()) rv.push_back(item); }
+  return rv;
+}
+
+bool load_script(const std::string &path, std::vector<Command> &cmds)
+{
+  std::ifstream ifs(path);
+  if (!ifs) {
+    std::cout << "can not open " << path << "\n";
+    return false;
+  }
+  std::string line;
+  int line_no = 0;
+  while (std::getline(ifs, line)) {
+    ++line_no;
+    std::size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    std::stringstream ss(line);
+    Command cmd;
+    cmd.line = line_no;
+    if (!(ss >> cmd.t >> cmd.name)) continue;
+
+    std::string word;
+    while (ss >> word) {
+      std::size_t eq = word.find('=');
+      if (eq == std::string::npos) {
+        if (word == "up" || word == "down" || word == "both") cmd.dir = word;
+        else cmd.arg = word;
+      }
+      else if (word.substr(0, eq) == "port") {
+        cmd.port = atoi(word.c_str() + eq + 1);
+      }
+      else {
+        cmd.values[word.substr(0, eq)] = atof(word.c_str() + eq + 1);
+      }
+    }
+    static const std::vector<std::string> names = { "set", "clear", "stall", "drop", "refuse", "quit" };
+    if (std::find(names.begin(), names.end(), cmd.name) == names.end()) {
+      std::cout << path << ":" << line_no << ": unknown command " << cmd.name << "\n";
+      return false;
+    }
+    cmds.push_back(cmd);
+  }
+  std::stable_sort(cmds.begin(), cmds.end(), [](const Command &a, const Command &b) { return a.t < b.t; });
+  return true;
+}
+
+// feedback callbacks of a TmsvrClient behind the proxy
+struct ClientProbe {
+  std::mutex mtx;
+  std::chrono::steady_clock::time_point last;
+  bool has_last = false;
+  double max_gap = 0.0;
+  std::size_t callbacks = 0;
+  std::size_t stalls = 0;
+  double stall_gap = 0.0;
+
+  void on_feedback()
+  {
+    auto t = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lck(mtx);
+    if (has_last) max_gap = std::max(max_gap, std::chrono::duration<double>(t - last).count());
+    last = t;
+    has_last = true;
+    ++callbacks;
+  }
+  void on_stall(double gap)
+  {
+    std::unique_lock<std::mutex> lck(mtx);
+    ++stalls;
+    stall_gap = gap;
+  }
+};
+
+}
+
+int main(int argc, char **argv)
+{
+  std::string listen_ip = "127.0.0.2";
+  std::string target_ip = "127.0.0.1";
+  std::vector<unsigned short> ports = { 5890, 5891 };
+  mock::Impairment imp;
+  std::string script;
+  bool with_mock = false;
+  bool with_client = false;
+  double reconnect = -1.0;
+  double watchdog = 0.0;
+  double duration = 0.0;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string val = (i + 1 < argc) ? argv[i + 1] : "";
+    if (arg == "--listen") { listen_ip = val; ++i; }
+    else if (arg == "--target") { target_ip = val; ++i; }
+    else if (arg == "--ports") {
+      ports.clear();
+      for (auto &s : split(val, ',')) { ports.push_back((unsigned short)(atoi(s.c_str()))); }
+      ++i;
+    }
+    else if (arg == "--latency") { imp.latency = 0.001 * atof(val.c_str()); ++i; }
+    else if (arg == "--jitter") { imp.jitter = 0.001 * atof(val.c_str()); ++i; }
+    else if (arg == "--bandwidth") { imp.bandwidth = atof(val.c_str()); ++i; }
+    else if (arg == "--segment") { imp.segment = (size_t)(atoi(val.c_str())); ++i; }
+    else if (arg == "--script") { script = val; ++i; }
+    else if (arg == "--mock") { with_mock = true; }
+    else if (arg == "--client") { with_client = true; }
+    else if (arg == "--reconnect") { reconnect = atof(val.c_str()); ++i; }
+    else if (arg == "--watchdog") { watchdog = atof(val.c_str()); ++i; }
+    else if (arg == "--duration") { duration = atof(val.c_str()); ++i; }
+    else {
+      std::cout << "usage: " << argv[0] << " [--listen ip] [--target ip] [--ports n,n,...]"
+        " [--latency ms] [--jitter ms] [--bandwidth bytes/s] [--segment n]"
+        " [--script file] [--mock] [--client] [--reconnect sec] [--watchdog periods]"
+        " [--duration sec]\n";
+      return 1;
+    }
+  }
+  std::vector<Command> cmds;
+  if (!script.empty() && !load_script(script, cmds)) return 1;
+  std::signal(SIGINT, on_signal);
+
+  // the mock only listens once started
+  mock::MockTmsvr::Config svr_config;
+  svr_config.ip = target_ip;
+  mock::MockTmsvr mock_svr(svr_config);
+  mock::MockTmsct::Config sct_config;
+  sct_config.ip = target_ip;
+  mock::MockTmsct mock_sct(sct_config, &mock_svr);
+  if (with_mock && (!mock_svr.start() || !mock_sct.start())) return 1;
+
+  std::vector<std::unique_ptr<mock::ImpairProxy>> proxies;
+  for (auto port : ports) {
+    mock::ImpairProxy::Config config;
+    config.listen_ip = listen_ip;
+    config.listen_port = port;
+    config.target_ip = target_ip;
+    config.target_port = port;
+    config.seed = port;
+    proxies.emplace_back(new mock::ImpairProxy(config));
+    proxies.back()->set_impairment(mock::ImpairProxy::Direction::BOTH, imp);
+    if (!proxies.back()->start()) return 1;
+  }
+
+  ClientProbe probe;
+  std::unique_ptr<driver::TmsvrClient> client;
+  if (with_client) {
+    client.reset(new driver::TmsvrClient(listen_ip));
+    if (reconnect >= 0.0) client->set_reconnect_timeval(reconnect);
+    client->set_feedback_callback([&probe](const driver::RobotState &) { probe.on_feedback(); });
+    client->set_stall_periods(watchdog);
+    client->set_stall_callback([&probe](double gap) { probe.on_stall(gap); });
+    client->start(1000);
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  auto elapsed = [&t0] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(); };
+  std::size_t next_cmd = 0;
+  double next_report = 1.0;
+  std::vector<double> recover_last(proxies.size(), -1.0);
+
+  while (!g_quit) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const double t = elapsed();
+
+    for (; next_cmd < cmds.size() && cmds[next_cmd].t <= t; ++next_cmd) {
+      const Command &cmd = cmds[next_cmd];
+      std::cout << "t: " << t << " s, script line " << cmd.line << ": " << cmd.name << std::endl;
+      if (cmd.name == "quit") {
+        g_quit = 1;
+        break;
+      }
+      for (std::size_t i = 0; i < proxies.size(); ++i) {
+        if (cmd.port && ports[i] != cmd.port) continue;
+        mock::ImpairProxy &proxy = *proxies[i];
+        if (cmd.name == "set") {
+          auto dir = (cmd.dir == "up") ? mock::ImpairProxy::Direction::UP :
+            (cmd.dir == "down") ? mock::ImpairProxy::Direction::DOWN : mock::ImpairProxy::Direction::BOTH;
+          // keys not given keep their value
+          mock::Impairment cur = proxy.impairment(dir == mock::ImpairProxy::Direction::UP ?
+            mock::ImpairProxy::Direction::UP : mock::ImpairProxy::Direction::DOWN);
+          for (auto &kv : cmd.values) {
+            if (kv.first == "latency") cur.latency = 0.001 * kv.second;
+            else if (kv.first == "jitter") cur.jitter = 0.001 * kv.second;
+            else if (kv.first == "bandwidth") cur.bandwidth = kv.second;
+            else if (kv.first == "segment") cur.segment = (std::size_t)(kv.second);
+          }
+          proxy.set_impairment(dir, cur);
+        }
+        else if (cmd.name == "clear") proxy.clear();
+        else if (cmd.name == "stall") proxy.stall(cmd.arg != "off");
+        else if (cmd.name == "refuse") proxy.refuse(cmd.arg != "off");
+        else if (cmd.name == "drop") proxy.drop();
+      }
+    }
+
+    if (t >= next_report) {
+      next_report += 1.0;
+      std::cout << "t: " << (int)(t + 0.5) << " s";
+      for (std::size_t i = 0; i < proxies.size(); ++i) {
+        auto st = proxies[i]->stats();
+        proxies[i]->reset_stats();
+        std::cout << " | " << ports[i] << " conn: " << st.connections << ", drops: " << st.drops
+          << ", refused: " << st.refused << ", up: " << st.bytes_up << ", down: " << st.bytes_down
+          << ", gap: " << 1.0e3 * st.max_gap << " ms";
+        if (st.recover >= 0.0 && st.recover != recover_last[i]) {
+          std::cout << ", recover: " << st.recover << " s";
+          recover_last[i] = st.recover;
+        }
+      }
+      if (client) {
+        std::unique_lock<std::mutex> lck(probe.mtx);
+        std::cout << " | client feedback: " << probe.callbacks << ", gap: " << 1.0e3 * probe.max_gap << " ms";
+        if (probe.stalls) std::cout << ", stalls: " << probe.stalls << " (" << 1.0e3 * probe.stall_gap << " ms)";
+        probe.callbacks = 0;
+        probe.max_gap = 0.0;
+        probe.stalls = 0;
+      }
+      std::cout << std::endl;
+    }
+    if (duration > 0.0 && t >= duration) break;
+  }
+
+  if (client) client->stop();
+  for (auto &proxy : proxies) { proxy->stop(); }
+  // the stream reads the joint states of sct
+  mock_svr.stop();
+  mock_sct.stop();
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include "tmrl/mock/mock_tmsvr.h"
+#include "tmrl/mock/mock_tmsct.h"
+#include "tmrl/driver/tmsvr_client.h"
+#include "tmrl/utils/logger.h"
+
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+
+/*
+ * Local mock TM controller
+ *
+ * tmr_mock_controller [--ip 127.0.0.1] [--rate 100] [--segments 7,64,...]
+ *   [--coalesce 1] [--items Joint_Angle,Joint_Speed,...] [--duration sec] [--client]
+ *
+ * Scripts sent to port 5890 move the simulated joints streamed on port 5891.
+ * --client also runs a TmsvrClient in this process and counts its feedback callbacks
+ * (one per received batch of frames).
+ */
+
+static volatile std::sig_atomic_t g_quit = 0;
+static void on_signal(int) { g_quit = 1; }
+
+static std::vector<std::string> split(const std::string &s, char sep)
+{
+  std::vector<std::string> rv;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, sep)) { if (!item.empty()) rv.push_back(item); }
+  return rv;
+}
+
+int main(int argc, char **argv)
+{
+  tmrl::mock::MockTmsvr::Config config;
+  double duration = 0.0;
+  bool with_client = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string val = (i + 1 < argc) ? argv[i + 1] : "";
+    if (arg == "--ip") { config.ip = val; ++i; }
+    else if (arg == "--rate") { config.rate = atof(val.c_str()); ++i; }
+    else if (arg == "--coalesce") { config.coalesce = (size_t)(atoi(val.c_str())); ++i; }
+    else if (arg == "--duration") { duration = atof(val.c_str()); ++i; }
+    else if (arg == "--segments") {
+      for (auto &s : split(val, ',')) { config.segments.push_back((size_t)(atoi(s.c_str()))); }
+      ++i;
+    }
+    else if (arg == "--items") {
+      for (auto &s : split(val, ',')) { config.items.push_back({ s, 0 }); }
+      ++i;
+    }
+    else if (arg == "--client") { with_client = true; }
+    else {
+      std::cout << "usage: " << argv[0] << " [--ip ip] [--rate hz] [--segments n,n,...]"
+        " [--coalesce n] [--items name,...] [--duration sec] [--client]\n";
+      return 1;
+    }
+  }
+  std::signal(SIGINT, on_signal);
+
+  tmrl::mock::MockTmsvr svr(config);
+  tmrl::mock::MockTmsct::Config sct_config;
+  sct_config.ip = config.ip;
+  tmrl::mock::MockTmsct sct(sct_config, &svr);
+  if (!svr.start() || !sct.start()) return 1;
+
+  std::atomic<size_t> feedback(0);
+  std::unique_ptr<tmrl::driver::TmsvrClient> client;
+  if (with_client) {
+    client.reset(new tmrl::driver::TmsvrClient(config.ip));
+    client->set_feedback_callback([&feedback](const tmrl::driver::RobotState &) { ++feedback; });
+    client->start(1000);
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  size_t frames_last = 0, feedback_last = 0;
+  while (!g_quit) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    auto st = svr.stats();
+    std::cout << "t: " << t << " s, frames: " << st.frames << " (" << st.frames - frames_last << "/s)"
+      << ", bytes: " << st.bytes << ", frame size: " << st.frame_size
+      << ", clients: " << st.clients << ", send errors: " << st.send_errors;
+    if (client) {
+      size_t n = feedback;
+      std::cout << ", feedback: " << n << " (" << n - feedback_last << "/s)";
+      feedback_last = n;
+    }
+    auto sst = sct.stats();
+    std::cout << ", scripts: " << sst.scripts << " (errors: " << sst.errors << "), points: " << sst.points;
+    std::cout << std::endl;
+    frames_last = st.frames;
+
+    if (duration > 0.0 && t >= duration) break;
+  }
+  if (client) client->stop();
+  // the stream reads the joint states of sct
+  svr.stop();
+  sct.stop();
+  return 0;
+}
@@ -0,0 +1,459 @@
+#include "tmrl/mock/mock_tmsct.h"
+
+#include "tmrl/utils/conversions.h"
+#include "tmrl/utils/logger.h"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace tmrl
+{
+namespace mock
+{
+
+MockTmsct::MockTmsct(const Config &config, MockTmsvr *feedback)
+  : _config(config)
+  , _feedback(feedback)
+  , _server(config.port)
+  , _sim(_rs)
+{
+  if (_config.joint_speed <= 0.0) _config.joint_speed = 180.0;
+  if (_config.vjog_step <= 0.0) _config.vjog_step = 0.01;
+
+  _sim.enter(to_vectorXd(_config.joint_angle));
+  _end_pos = _config.joint_angle;
+  _end_vel.fill(0.0);
+  _vjog_vel.fill(0.0);
+
+  if (_feedback) {
+    _feedback->set_joint_states(_config.joint_angle, _end_vel);
+    _feedback->set_frame_callback([this]
+    {
+      // the sim thread writes _rs
+      driver::RobotState::Ulock lck(_rs.mtx);
+      const vector6d pos = _rs.joint_angle();
+      const vector6d vel = _rs.joint_speed();
+      lck.unlock();
+      _feedback->set_joint_states(pos, vel);
+    });
+  }
+}
+MockTmsct::~MockTmsct()
+{
+  stop();
+}
+
+bool MockTmsct::start()
+{
+  if (_keep_alive) return true;
+  if (!_server.listen(_config.ip)) return false;
+
+  _keep_alive = true;
+  _thd = std::thread(std::bind(&MockTmsct::run, this));
+  return true;
+}
+void MockTmsct::stop()
+{
+  _keep_alive = false;
+  if (_thd.joinable()) _thd.join();
+  _server.close();
+}
+
+MockTmsct::Stats MockTmsct::stats() const
+{
+  Stats rv;
+  rv.clients = _clients;
+  rv.scripts = _scripts;
+  rv.errors = _errors;
+  rv.points = _points;
+  return rv;
+}
+
+bool MockTmsct::parse_line(const std::string &line, Call &call)
+{
+  call.name.clear();
+  call.args.clear();
+  call.values.clear();
+
+  std::size_t lp = line.find('(');
+  std::size_t rp = line.rfind(')');
+  if (lp == std::string::npos || rp == std::string::npos || rp < lp) return false;
+
+  std::size_t b = line.find_first_not_of(' ');
+  call.name = line.substr(b, line.find_last_not_of(' ', lp - 1) + 1 - b);
+  if (line.find_first_not_of(' ', rp + 1) != std::string::npos) return false;
+
+  // split at commas outside quotes
+  std::string inner = line.substr(lp + 1, rp - lp - 1);
+  if (inner.find_first_not_of(' ') != std::string::npos) {
+    std::string arg;
+    bool quoted = false;
+    for (std::size_t i = 0; i <= inner.size(); ++i) {
+      if (i < inner.size() && (quoted || inner[i] != ',')) {
+        if (inner[i] == '"') quoted = !quoted;
+        else if (quoted || inner[i] != ' ') arg.push_back(inner[i]);
+        continue;
+      }
+      call.args.push_back(arg);
+      arg.clear();
+    }
+    if (quoted) return false;
+  }
+
+  // numbers, quoted text stays 0
+  call.values.resize(call.args.size(), 0.0);
+  for (std::size_t i = 0; i < call.args.size(); ++i) {
+    const std::string &s = call.args[i];
+    if (s.empty()) return false;
+    char *end = nullptr;
+    double v = strtod(s.c_str(), &end);
+    if (*end == '\0') call.values[i] = v;
+  }
+  return true;
+}
+
+bool MockTmsct::check(const Call &call, bool &pvt, bool &vjog) const
+{
+  const std::string &name = call.name;
+  const std::size_t n = call.args.size();
+
+  if (name == "ScriptExit" || name == "StopAndClearBuffer" || name == "Pause" || name == "Resume") {
+    return (n == 0);
+  }
+  else if (name == "QueueTag") {
+    return (n == 1 || n == 2);
+  }
+  else if (name == "PVTEnter") {
+    if (n != 1 || pvt || vjog) return false;
+    if (call.values[0] != 0.0) {
+      tmrl_WARN_STREAM("MOCK_SCT: PVTEnter(" << call.args[0] << "), only joint mode is simulated");
+      return false;
+    }
+    pvt = true;
+    return true;
+  }
+  else if (name == "PVTPoint") {
+    return (pvt && n == 13 && call.values[12] > 0.0);
+  }
+  else if (name == "PVTExit") {
+    if (n != 0 || !pvt) return false;
+    pvt = false;
+    return true;
+  }
+  else if (name == "PTP") {
+    if (n != 11 || pvt || vjog) return false;
+    if (call.args[0] != "JPP") {
+      tmrl_WARN_STREAM("MOCK_SCT: PTP(\"" << call.args[0] << "\"), only joint targets are simulated");
+      return false;
+    }
+    return (call.values[7] > 0.0 && call.values[7] <= 100.0);
+  }
+  else if (name == "ContinueVJog") {
+    if (n != 0 || pvt || vjog) return false;
+    vjog = true;
+    return true;
+  }
+  else if (name == "SetContinueVJog") {
+    return (vjog && n == 6);
+  }
+  else if (name == "StopContinueVmode") {
+    if (n != 0 || !vjog) return false;
+    vjog = false;
+    return true;
+  }
+  tmrl_WARN_STREAM("MOCK_SCT: " << name << " is not simulated");
+  return false;
+}
+
+void MockTmsct::apply(const Call &call, const std::string &id, bool &reply)
+{
+  const std::string &name = call.name;
+  const auto &v = call.values;
+
+  if (name == "PVTEnter") {
+    _pvt = true;
+  }
+  else if (name == "PVTExit") {
+    _pvt = false;
+  }
+  else if (name == "PVTPoint") {
+    vector6d pos, vel;
+    for (std::size_t i = 0; i < 6; ++i) {
+      pos[i] = utils::rad(v[i]);
+      vel[i] = utils::rad(v[6 + i]);
+    }
+    push(pos, vel, v[12]);
+  }
+  else if (name == "PTP") {
+    vector6d pos, vel;
+    vel.fill(0.0);
+    double dist = 0.0;
+    for (std::size_t i = 0; i < 6; ++i) {
+      pos[i] = utils::rad(v[1 + i]);
+      dist = std::max(dist, std::fabs(pos[i] - _end_pos[i]));
+    }
+    if (dist > 0.0) {
+      // a cubic peaks at 1.5 times the mean speed
+      const double speed = utils::rad(_config.joint_speed) * 0.01 * v[7];
+      const double acc_time = 0.001 * v[8];
+      push(pos, vel, std::max(1.5 * dist / speed, dist / speed + acc_time));
+    }
+  }
+  else if (name == "QueueTag") {
+    int tag = (int)(v[0]);
+    bool wait = (call.args.size() == 2 && v[1] != 0.0);
+    _tags.push_back(Tag{ tag, _pushed, wait ? id : std::string() });
+    _tag_done[tag] = false;
+    if (wait) reply = false;
+  }
+  else if (name == "StopAndClearBuffer") {
+    clear();
+  }
+  else if (name == "Pause") {
+    _paused = true;
+  }
+  else if (name == "Resume") {
+    _paused = false;
+    for (auto &p : _held) { _sim.add_point(p); }
+    _held.clear();
+  }
+  else if (name == "ContinueVJog") {
+    _vjog = true;
+    _vjog_vel.fill(0.0);
+    _vjog_stamp = std::chrono::steady_clock::now();
+  }
+  else if (name == "SetContinueVJog") {
+    for (std::size_t i = 0; i < 6; ++i) { _vjog_vel[i] = utils::rad(v[i]); }
+    _vjog_stamp = std::chrono::steady_clock::now();
+  }
+  else if (name == "StopContinueVmode") {
+    stop_vjog();
+  }
+}
+
+bool MockTmsct::push(const vector6d &pos, const vector6d &vel, double t)
+{
+  driver::PvtPoint p{ t, to_vectorXd(pos), to_vectorXd(vel) };
+  if (_paused) _held.push_back(p);
+  else if (!_sim.add_point(p)) return false;
+  _end_pos = pos;
+  _end_vel = vel;
+  ++_pushed;
+  ++_points;
+  return true;
+}
+
+void MockTmsct::clear()
+{
+  _held.clear();
+  _sim.clear();
+  for (int i = 0; i < 1000 && _sim.clear_pending(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  driver::RobotState::Ulock lck(_rs.mtx);
+  _end_pos = _rs.joint_angle();
+  lck.unlock();
+  _end_vel.fill(0.0);
+  _vjog_vel.fill(0.0);
+}
+
+void MockTmsct::stop_vjog()
+{
+  _vjog = false;
+  _vjog_vel.fill(0.0);
+  if (_end_vel == vector6d{}) return;
+
+  // ramp down in one segment
+  const double dt = _config.vjog_step;
+  vector6d pos;
+  for (std::size_t i = 0; i < 6; ++i) { pos[i] = _end_pos[i] + 0.5 * _end_vel[i] * dt; }
+  push(pos, _vjog_vel, dt);
+}
+
+void MockTmsct::update(int fd)
+{
+  // vjog, keep two segments queued, ramping to the target velocity
+  if (_vjog && (_vjog_vel != vector6d{} || _end_vel != vector6d{})) {
+    const double dt = _config.vjog_step;
+    if (_vjog && std::chrono::steady_clock::now() - _vjog_stamp >
+      std::chrono::duration<double>(_config.vjog_timeout)) {
+      tmrl_WARN_STREAM("MOCK_SCT: no vjog target, stop");
+      _vjog_vel.fill(0.0);
+    }
+    while (_sim.remaining_time() < 2.0 * dt) {
+      vector6d pos;
+      for (std::size_t i = 0; i < 6; ++i) { pos[i] = _end_pos[i] + 0.5 * (_end_vel[i] + _vjog_vel[i]) * dt; }
+      if (!push(pos, _vjog_vel, dt)) break;
+      if (_vjog_vel == vector6d{}) break;
+    }
+  }
+
+  // queue tags whose motion is done
+  const std::size_t done = _pushed - _sim.point_count() - _held.size();
+  while (!_tags.empty() && _tags.front().pushed <= done) {
+    const Tag &tag = _tags.front();
+    _tag_done[tag.tag] = true;
+    if (!tag.wait_id.empty() && fd >= 0) reply_tmsct(fd, tag.wait_id, "OK");
+    _tags.pop_front();
+  }
+}
+
+void MockTmsct::execute(int fd, const std::string &id, const std::string &script)
+{
+  ++_scripts;
+
+  std::vector<Call> calls;
+  std::size_t b = 0;
+  bool pvt = _pvt;
+  bool vjog = _vjog;
+  int line_no = 0;
+  while (b <= script.size()) {
+    std::size_t e = script.find('\n', b);
+    if (e == std::string::npos) e = script.size();
+    std::string line = script.substr(b, e - b);
+    b = e + 1;
+    ++line_no;
+
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.find_first_not_of(' ') == std::string::npos) continue;
+
+    Call call;
+    if (!parse_line(line, call) || !check(call, pvt, vjog)) {
+      tmrl_WARN_STREAM("MOCK_SCT: id: " << id << ", line " << line_no << ": " << line);
+      ++_errors;
+      reply_tmsct(fd, id, "ERROR");
+      return;
+    }
+    calls.push_back(std::move(call));
+  }
+
+  bool reply = true;
+  for (auto &call : calls) { apply(call, id, reply); }
+  if (reply) reply_tmsct(fd, id, "OK");
+}
+
+void MockTmsct::reply_tmsct(int fd, const std::string &id, const std::string &script)
+{
+  comm::TmsctPacket tmsct;
+  comm::vectorXbyte bytes;
+  tmsct.set_script(id, script);
+  tmsct.pack(bytes);
+  comm::Server::send_all(fd, bytes.data(), bytes.size());
+}
+void MockTmsct::reply_tmsta(int fd, const std::string &subcmd, const std::string &subdata)
+{
+  comm::TmstaPacket tmsta;
+  comm::vectorXbyte bytes;
+  tmsta.set_subdata(subcmd, subdata);
+  tmsta.pack(bytes);
+  comm::Server::send_all(fd, bytes.data(), bytes.size());
+}
+
+void MockTmsct::handle(int fd, const comm::Packet &pack)
+{
+  using namespace comm;
+
+  switch (pack.header()) {
+  case Packet::Header::TMSCT: {
+    TmsctPacket tmsct;
+    tmsct.unpack_script(pack.data().data(), pack.data().size());
+    execute(fd, tmsct.id(), tmsct.script());
+    break;
+  }
+  case Packet::Header::TMSTA: {
+    TmstaPacket tmsta;
+    tmsta.unpack_subdata(pack.data().data(), pack.data().size());
+    if (tmsta.subcmd() == "00") {
+      // in listen node
+      reply_tmsta(fd, "00", "true,");
+    }
+    else if (tmsta.subcmd() == "01") {
+      auto iter = _tag_done.find(atoi(tmsta.subdata().c_str()));
+      std::string state = (iter == _tag_done.end()) ? "none" : (iter->second ? "true" : "false");
+      reply_tmsta(fd, "01", tmsta.subdata() + "," + state);
+    }
+    break;
+  }
+  default: {
+    CperrPacket cperr;
+    vectorXbyte bytes;
+    cperr.set_errcode(CperrPacket::ErrCode::HeaderErr);
+    cperr.pack(bytes);
+    Server::send_all(fd, bytes.data(), bytes.size());
+    break;
+  }
+  }
+}
+
+void MockTmsct::serve(int fd)
+{
+  std::string buf;
+  char rbuf[0x1000];
+
+  while (_keep_alive) {
+    update(fd);
+
+    int rv = comm::Server::wait_readable(fd, 2);
+    if (rv < 0) break;
+    if (rv == 0) continue;
+
+    int nb = comm::Server::recv_some(fd, rbuf, sizeof(rbuf));
+    if (nb <= 0) break;
+    buf.append(rbuf, nb);
+
+    while (!buf.empty()) {
+      // resync on the next header
+      if (buf[0] != comm::Packet::P_HEAD) {
+        std::size_t p = buf.find(comm::Packet::P_HEAD);
+        buf.erase(0, (p == std::string::npos) ? buf.size() : p);
+        continue;
+      }
+      comm::Packet pack;
+      std::size_t len = pack.unpack(buf.data(), buf.size());
+      if (pack.is_valid()) {
+        handle(fd, pack);
+        buf.erase(0, len);
+      }
+      else if (pack.is_checksum_error()) {
+        tmrl_WARN_STREAM("MOCK_SCT: checksum error");
+        comm::CperrPacket cperr;
+        comm::vectorXbyte bytes;
+        cperr.set_errcode(comm::CperrPacket::ErrCode::ChecksumErr);
+        cperr.pack(bytes);
+        comm::Server::send_all(fd, bytes.data(), bytes.size());
+        buf.erase(0, len);
+      }
+      else {
+        // incomplete
+        break;
+      }
+    }
+  }
+}
+
+void MockTmsct::run()
+{
+  tmrl_INFO_STREAM("MOCK_SCT: thread begin");
+
+  while (_keep_alive) {
+    int fd = _server.accept(10);
+    if (fd < 0) {
+      update(-1);
+      continue;
+    }
+    ++_clients;
+    tmrl_INFO_STREAM("MOCK_SCT: client connected");
+
+    serve(fd);
+
+    comm::Server::close_fd(fd);
+    tmrl_INFO_STREAM("MOCK_SCT: client disconnected");
+
+    // a lost client does not leave the robot jogging
+    if (_vjog) stop_vjog();
+  }
+  tmrl_INFO_STREAM("MOCK_SCT: thread end");
+}
+
+}
+}
@@ -0,0 +1,221 @@
+#include "tmrl/mock/mock_tmsvr.h"
+
+#include "tmrl/comm/packet.h"
+#include "tmrl/utils/clock.h"
+#include "tmrl/utils/conversions.h"
+#include "tmrl/utils/logger.h"
+
+#include <cstring>
+
+namespace tmrl
+{
+namespace mock
+{
+
+const std::vector<TmsvrItem> &MockTmsvr::data_table()
+{
+  static const std::vector<TmsvrItem> table = []
+  {
+    std::vector<TmsvrItem> t = {
+      { "Robot_Link", 1 }, { "Robot_Error", 1 }, { "Project_Run", 1 }, { "Project_Pause", 1 },
+      { "Safeguard_A", 1 }, { "ESTOP", 1 }, { "Camera_Light", 1 }, { "Error_Code", 4 },
+      { "Joint_Angle", 24 }, { "Coord_Robot_Flange", 24 }, { "Coord_Robot_Tool", 24 },
+      { "TCP_Force", 12 }, { "TCP_Force3D", 4 }, { "TCP_Speed", 24 }, { "TCP_Speed3D", 4 },
+      { "Joint_Speed", 24 }, { "Joint_Torque", 24 },
+      { "Project_Speed", 4 }, { "MA_Mode", 4 }, { "Robot_Light", 4 }
+    };
+    for (int i = 0; i < 16; ++i) { t.push_back({ "Ctrl_DO" + std::to_string(i), 1 }); }
+    for (int i = 0; i < 16; ++i) { t.push_back({ "Ctrl_DI" + std::to_string(i), 1 }); }
+    for (int i = 0; i < 2; ++i) { t.push_back({ "Ctrl_AO" + std::to_string(i), 4 }); }
+    for (int i = 0; i < 2; ++i) { t.push_back({ "Ctrl_AI" + std::to_string(i), 4 }); }
+    for (int i = 0; i < 4; ++i) { t.push_back({ "End_DO" + std::to_string(i), 1 }); }
+    for (int i = 0; i < 4; ++i) { t.push_back({ "End_DI" + std::to_string(i), 1 }); }
+    for (int i = 0; i < 2; ++i) { t.push_back({ "End_AO" + std::to_string(i), 4 }); }
+    for (int i = 0; i < 2; ++i) { t.push_back({ "End_AI" + std::to_string(i), 4 }); }
+    return t;
+  }();
+  return table;
+}
+
+MockTmsvr::MockTmsvr(const Config &config)
+  : _config(config)
+  , _server(config.port)
+{
+  if (_config.items.empty()) _config.items = data_table();
+  if (_config.rate <= 0.0) _config.rate = 100.0;
+  if (_config.coalesce == 0) _config.coalesce = 1;
+
+  // name length, name, value length, value
+  for (auto &item : _config.items) {
+    std::size_t size = item.size;
+    if (size == 0) {
+      for (auto &known : data_table()) {
+        if (known.name == item.name) { size = known.size; break; }
+      }
+      if (size == 0) size = 4;
+    }
+    unsigned short uslen = (unsigned short)(item.name.size());
+    _content.append((const char *)&uslen, 2);
+    _content.append(item.name);
+    uslen = (unsigned short)(size);
+    _content.append((const char *)&uslen, 2);
+    _values[item.name] = std::make_pair(_content.size(), size);
+    _content.append(size, '\0');
+  }
+
+  unsigned char linked = 1;
+  set_item("Robot_Link", &linked, 1);
+  int speed = 100;
+  set_item("Project_Speed", &speed, 4);
+}
+MockTmsvr::~MockTmsvr()
+{
+  stop();
+}
+
+bool MockTmsvr::start()
+{
+  if (_keep_alive) return true;
+  if (!_server.listen(_config.ip)) return false;
+
+  _keep_alive = true;
+  _thd = std::thread(std::bind(&MockTmsvr::run, this));
+  return true;
+}
+void MockTmsvr::stop()
+{
+  _keep_alive = false;
+  if (_thd.joinable()) _thd.join();
+  _server.close();
+}
+
+bool MockTmsvr::set_item(const std::string &name, const void *data, std::size_t size)
+{
+  auto iter = _values.find(name);
+  if (iter == _values.end() || iter->second.second != size) return false;
+
+  std::unique_lock<std::mutex> lck(_mtx);
+  memcpy(&_content[iter->second.first], data, size);
+  return true;
+}
+
+void MockTmsvr::set_joint_states(const vector6d &pos, const vector6d &vel)
+{
+  // the controller sends degrees as float
+  float fpos[6], fvel[6];
+  for (std::size_t i = 0; i < 6; ++i) {
+    fpos[i] = (float)(utils::deg(pos[i]));
+    fvel[i] = (float)(utils::deg(vel[i]));
+  }
+  set_item("Joint_Angle", fpos, sizeof(fpos));
+  set_item("Joint_Speed", fvel, sizeof(fvel));
+}
+
+std::string MockTmsvr::content()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  return _content;
+}
+
+MockTmsvr::Stats MockTmsvr::stats() const
+{
+  Stats rv;
+  rv.clients = _clients;
+  rv.frames = _frames;
+  rv.bytes = _bytes;
+  rv.send_errors = _send_errors;
+  rv.frame_size = _frame_size;
+  return rv;
+}
+void MockTmsvr::reset_stats()
+{
+  _frames = 0;
+  _bytes = 0;
+  _send_errors = 0;
+}
+
+bool MockTmsvr::send_segmented(int fd, const char *bytes, std::size_t len)
+{
+  const auto &segs = _config.segments;
+  if (segs.empty()) {
+    return (comm::Server::send_all(fd, bytes, len) == comm::RetCode::OK);
+  }
+  std::size_t off = 0;
+  while (off < len) {
+    if (_seg_left == 0) {
+      _seg_left = segs[_seg_idx] ? segs[_seg_idx] : 1;
+      _seg_idx = (_seg_idx + 1) % segs.size();
+    }
+    std::size_t n = (len - off < _seg_left) ? len - off : _seg_left;
+    if (comm::Server::send_all(fd, bytes + off, n) != comm::RetCode::OK) return false;
+    off += n;
+    _seg_left -= n;
+  }
+  return true;
+}
+
+void MockTmsvr::run()
+{
+  tmrl_INFO_STREAM("MOCK_SVR: thread begin");
+
+  utils::SteadyClock &clock = utils::SteadyClock::instance();
+  const auto period = std::chrono::duration_cast<utils::Clock::duration>(
+    std::chrono::duration<double>(1.0 / _config.rate));
+
+  comm::TmsvrPacket tmsvr;
+  comm::vectorXbyte frame;
+  std::string batch;
+  std::size_t batch_frames = 0;
+  char rbuf[0x1000];
+
+  while (_keep_alive) {
+    int fd = _server.accept(100);
+    if (fd < 0) continue;
+
+    ++_clients;
+    tmrl_INFO_STREAM("MOCK_SVR: client connected");
+    _seg_idx = 0;
+    _seg_left = 0;
+    batch.clear();
+    batch_frames = 0;
+    auto deadline = clock.now();
+
+    while (_keep_alive) {
+      if (_frame_cb) _frame_cb();
+      {
+        std::unique_lock<std::mutex> lck(_mtx);
+        tmsvr.set_content("Mock", comm::TmsvrPacket::Mode::BINARY, _content);
+      }
+      tmsvr.pack(frame);
+      _frame_size = frame.size();
+      batch.append(frame.data(), frame.size());
+
+      if (++batch_frames == _config.coalesce) {
+        if (!send_segmented(fd, batch.data(), batch.size())) {
+          ++_send_errors;
+          break;
+        }
+        _frames += batch_frames;
+        _bytes += batch.size();
+        batch.clear();
+        batch_frames = 0;
+      }
+
+      // drop whatever the client sends, notice a close
+      bool closed = false;
+      while (comm::Server::wait_readable(fd, 0) > 0) {
+        if (comm::Server::recv_some(fd, rbuf, sizeof(rbuf)) <= 0) { closed = true; break; }
+      }
+      if (closed) break;
+
+      deadline += period;
+      clock.sleep_until(deadline);
+    }
+    comm::Server::close_fd(fd);
+    tmrl_INFO_STREAM("MOCK_SVR: client disconnected");
+  }
+  tmrl_INFO_STREAM("MOCK_SVR: thread end");
+}
+
+}
+}
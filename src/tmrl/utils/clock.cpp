@@ -0,0 +1,43 @@
+#include "tmrl/utils/clock.h"
+
+#include <thread>
+
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#endif
+
+namespace tmrl
+{
+namespace utils
+{
+
+void SteadyClock::sleep_until(const time_point &t)
+{
+#ifdef _WIN32
+  std::this_thread::sleep_until(t);
+#else
+  // steady_clock is CLOCK_MONOTONIC, sleep to the absolute deadline so nothing drifts
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+  struct timespec ts;
+  ts.tv_sec = (time_t)(ns / 1000000000LL);
+  ts.tv_nsec = (long)(ns % 1000000000LL);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+#endif
+}
+
+SteadyClock &SteadyClock::instance()
+{
+  static SteadyClock clock;
+  return clock;
+}
+
+void VirtualClock::sleep_until(const time_point &t)
+{
+  duration::rep target = t.time_since_epoch().count();
+  duration::rep curr = _now.load();
+  while (curr < target && !_now.compare_exchange_weak(curr, target)) {}
+}
+
+}
+}
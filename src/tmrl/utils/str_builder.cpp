@@ -0,0 +1,129 @@
+#include "tmrl/utils/str_builder.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace tmrl
+{
+namespace utils
+{
+
+static const double _pow10d[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+static const unsigned long long _pow10u[] = {
+  1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull,
+  1000000ull, 10000000ull, 100000000ull, 1000000000ull
+};
+
+inline std::size_t _format_uint(char *buf, unsigned long long v)
+{
+  char tmp[24];
+  std::size_t n = 0;
+  do {
+    tmp[n++] = (char)('0' + (v % 10));
+    v /= 10;
+  } while (v);
+  for (std::size_t i = 0; i < n; ++i) { buf[i] = tmp[n - 1 - i]; }
+  return n;
+}
+
+std::size_t format_int(char *buf, long long v)
+{
+  if (v < 0) {
+    buf[0] = '-';
+    // negate in unsigned to keep LLONG_MIN
+    return 1 + _format_uint(buf + 1, 0ull - (unsigned long long)(v));
+  }
+  return _format_uint(buf, (unsigned long long)(v));
+}
+
+std::size_t format_fixed(char *buf, std::size_t size, double v, int precision)
+{
+  if (precision < 0) precision = 6; // as printf
+
+  // fast path: a * 10^p below 2^40 is within 2^-14 of the exact product,
+  // so only fractions very close to one half can round differently
+  const double a = std::fabs(v);
+  if (precision <= 9 && size >= 32) {
+    const double scaled = a * _pow10d[precision];
+    if (scaled < 1099511627776.0) {
+      double ip = std::floor(scaled);
+      double frac = scaled - ip;
+      if (std::fabs(frac - 0.5) > 1.0e-4) {
+        unsigned long long n = (unsigned long long)(ip) + (frac > 0.5 ? 1 : 0);
+        unsigned long long p10 = _pow10u[precision];
+        std::size_t len = 0;
+        if (std::signbit(v)) buf[len++] = '-';
+        len += _format_uint(buf + len, n / p10);
+        if (precision > 0) {
+          buf[len++] = '.';
+          unsigned long long f = n % p10;
+          for (int i = precision - 1; i >= 0; --i) {
+            buf[len + i] = (char)('0' + (f % 10));
+            f /= 10;
+          }
+          len += precision;
+        }
+        return len;
+      }
+    }
+  }
+  // ties, large values, inf and nan
+  char tmp[64];
+  int len = snprintf(tmp, sizeof(tmp), "%.*f", precision, v);
+  if (len < 0) return 0;
+  if ((std::size_t)(len) < size && (std::size_t)(len) < sizeof(tmp)) {
+    memcpy(buf, tmp, len);
+  }
+  return (std::size_t)(len);
+}
+
+std::size_t format_shortest(char *buf, std::size_t size, double v, double tol, int max_precision)
+{
+  if (max_precision > 9) max_precision = 9;
+  if (max_precision < 0) max_precision = 0;
+
+  int precision = max_precision;
+  if (std::isfinite(v)) {
+    const double a = std::fabs(v);
+    for (int p = 0; p < max_precision; ++p) {
+      // error of rounding to p digits
+      double scaled = a * _pow10d[p];
+      double err = std::fabs(scaled - std::floor(scaled + 0.5)) / _pow10d[p];
+      if (err <= tol) {
+        precision = p;
+        break;
+      }
+    }
+  }
+  std::size_t len = format_fixed(buf, size, v, precision);
+  if (len >= size) return len;
+
+  // strip trailing zeros (and the point)
+  if (precision > 0) {
+    while (buf[len - 1] == '0') { --len; }
+    if (buf[len - 1] == '.') { --len; }
+  }
+  // -0 reads back as 0
+  if (len == 2 && buf[0] == '-' && buf[1] == '0') {
+    buf[0] = '0';
+    len = 1;
+  }
+  return len;
+}
+
+StrBuilder & StrBuilder::append_fixed_long(double v, int precision)
+{
+  int len = snprintf(NULL, 0, "%.*f", precision, v);
+  if (len <= 0) return *this;
+  std::vector<char> buf(len + 1);
+  snprintf(buf.data(), buf.size(), "%.*f", precision, v);
+  _str.append(buf.data(), len);
+  return *this;
+}
+
+}
+}
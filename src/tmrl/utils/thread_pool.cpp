@@ -0,0 +1,91 @@
+#include "tmrl/utils/thread_pool.h"
+
+#include <atomic>
+
+namespace tmrl
+{
+namespace utils
+{
+
+ThreadPool::ThreadPool(std::size_t threads)
+{
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  for (std::size_t i = 0; i < threads; ++i) {
+    _workers.push_back(std::thread(std::bind(&ThreadPool::run, this)));
+  }
+}
+ThreadPool::~ThreadPool()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  _keep_alive = false;
+  lck.unlock();
+  _cv.notify_all();
+
+  for (auto &thd : _workers) {
+    if (thd.joinable()) thd.join();
+  }
+}
+
+void ThreadPool::post(Task task)
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  _tasks.push_back(std::move(task));
+  lck.unlock();
+  _cv.notify_one();
+}
+
+void ThreadPool::parallel_for(std::size_t count, const std::function<void(std::size_t)> &f)
+{
+  if (count == 0) return;
+
+  std::atomic<std::size_t> next(0);
+  auto loop = [&next, count, &f]
+  {
+    std::size_t i;
+    while ((i = next.fetch_add(1)) < count) { f(i); }
+  };
+
+  std::size_t helpers = (count - 1 < size()) ? count - 1 : size();
+  std::size_t done = 0;
+  std::mutex done_mtx;
+  std::condition_variable done_cv;
+
+  for (std::size_t k = 0; k < helpers; ++k) {
+    post([&loop, &done, &done_mtx, &done_cv]
+    {
+      loop();
+      // notify under the lock, the caller returns and destroys done_cv
+      // once it sees the count
+      std::unique_lock<std::mutex> lck(done_mtx);
+      ++done;
+      done_cv.notify_one();
+    });
+  }
+  loop();
+
+  // helpers still hold references to this frame
+  std::unique_lock<std::mutex> lck(done_mtx);
+  while (done < helpers) { done_cv.wait(lck); }
+}
+
+void ThreadPool::run()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  while (true) {
+    while (_keep_alive && _tasks.empty()) { _cv.wait(lck); }
+    if (_tasks.empty()) break;
+
+    Task task = std::move(_tasks.front());
+    _tasks.pop_front();
+    lck.unlock();
+
+    task();
+
+    lck.lock();
+  }
+}
+
+}
+}
@@ -0,0 +1,136 @@
+#include "tmrl/utils/work_stealing_pool.h"
+
+namespace tmrl
+{
+namespace utils
+{
+
+WorkStealingPool::WorkStealingPool(std::size_t threads)
+{
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  _slots.reset(new Slot[threads]);
+  for (std::size_t i = 1; i < threads; ++i) {
+    _workers.push_back(std::thread(std::bind(&WorkStealingPool::run, this, i)));
+  }
+}
+WorkStealingPool::~WorkStealingPool()
+{
+  std::unique_lock<std::mutex> lck(_mtx);
+  _keep_alive = false;
+  lck.unlock();
+  _cv.notify_all();
+
+  for (auto &thd : _workers) {
+    if (thd.joinable()) thd.join();
+  }
+}
+
+void WorkStealingPool::parallel_for(std::size_t count, std::size_t grain, const RangeFunc &f)
+{
+  if (count == 0) return;
+  if (grain == 0) grain = 1;
+
+  // small loops are not worth waking anyone
+  if (count <= grain || _workers.empty()) {
+    for (std::size_t b = 0; b < count; b += grain) { f(b, (b + grain < count) ? b + grain : count); }
+    return;
+  }
+
+  // one block per participant
+  const std::size_t n = size();
+  for (std::size_t i = 0; i < n; ++i) {
+    std::unique_lock<std::mutex> lck(_slots[i].mtx);
+    _slots[i].begin = count * i / n;
+    _slots[i].end = count * (i + 1) / n;
+  }
+
+  std::unique_lock<std::mutex> lck(_mtx);
+  _func = &f;
+  _grain = grain;
+  _busy = _workers.size();
+  ++_generation;
+  lck.unlock();
+  _cv.notify_all();
+
+  work(0);
+
+  // workers still hold f
+  lck.lock();
+  while (_busy > 0) { _done_cv.wait(lck); }
+  _func = nullptr;
+}
+
+bool WorkStealingPool::take(std::size_t self, std::size_t &begin, std::size_t &end)
+{
+  Slot &slot = _slots[self];
+  std::unique_lock<std::mutex> lck(slot.mtx);
+  if (slot.begin >= slot.end) return false;
+  begin = slot.begin;
+  end = (slot.end - begin > _grain) ? begin + _grain : slot.end;
+  slot.begin = end;
+  return true;
+}
+
+bool WorkStealingPool::steal(std::size_t self)
+{
+  const std::size_t n = size();
+  for (std::size_t k = 1; k < n; ++k) {
+    Slot &victim = _slots[(self + k) % n];
+    std::unique_lock<std::mutex> lck(victim.mtx);
+    if (victim.begin >= victim.end) continue;
+
+    // back half, the owner keeps working on the front
+    std::size_t mid = victim.begin + (victim.end - victim.begin) / 2;
+    std::size_t end = victim.end;
+    victim.end = mid;
+    lck.unlock();
+
+    Slot &slot = _slots[self];
+    std::unique_lock<std::mutex> own(slot.mtx);
+    slot.begin = mid;
+    slot.end = end;
+    own.unlock();
+
+    std::unique_lock<std::mutex> stat(_mtx);
+    ++_steals;
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::work(std::size_t self)
+{
+  const RangeFunc &f = *_func;
+  std::size_t begin, end;
+  while (true) {
+    if (take(self, begin, end)) {
+      f(begin, end);
+    }
+    else if (!steal(self)) {
+      // every block is empty, what is left is already running
+      break;
+    }
+  }
+}
+
+void WorkStealingPool::run(std::size_t self)
+{
+  std::size_t generation = 0;
+  std::unique_lock<std::mutex> lck(_mtx);
+  while (true) {
+    while (_keep_alive && _generation == generation) { _cv.wait(lck); }
+    if (!_keep_alive) break;
+    generation = _generation;
+    lck.unlock();
+
+    work(self);
+
+    lck.lock();
+    if (--_busy == 0) _done_cv.notify_one();
+  }
+}
+
+}
+}
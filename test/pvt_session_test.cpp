@@ -0,0 +1,98 @@
+#include "tmrl/driver/pvt_session.h"
+#include "tmrl/mock/mock_tmsct.h"
+#include "tmrl/utils/logger.h"
+
+#include <cstdio>
+
+/*
+ * PvtSession::append boundary checks against the loopback MockTmsct.
+ */
+
+using namespace tmrl;
+using namespace tmrl::driver;
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool cond, const char *what)
+{
+  if (!cond) {
+    std::printf("FAIL: %s\n", what);
+    ++failures;
+  }
+}
+
+PvtPoint point(double time, double pos, double vel)
+{
+  PvtPoint p;
+  p.time = time;
+  p.positions = vectorXd(6, 0.0);
+  p.velocities = vectorXd(6, 0.0);
+  p.positions[0] = pos;
+  p.velocities[0] = vel;
+  return p;
+}
+
+PvtTraj traj(std::initializer_list<PvtPoint> points)
+{
+  PvtTraj t;
+  t.mode = PvtMode::Joint;
+  t.points = points;
+  t.total_time = 0.0;
+  for (const PvtPoint &p : t.points) { t.total_time += p.time; }
+  return t;
+}
+
+}
+
+int main()
+{
+  utils::get_logger().set_level(utils::logger::FATAL);
+
+  mock::MockTmsct::Config config;
+  config.ip = "127.0.0.50";
+  mock::MockTmsct mock(config);
+  if (!mock.start()) {
+    std::printf("FAIL: can not start the mock on %s\n", config.ip.c_str());
+    return 1;
+  }
+  TmsctClient sct(config.ip);
+  if (!sct.start(1000)) {
+    std::printf("FAIL: can not connect to the mock on %s\n", config.ip.c_str());
+    return 1;
+  }
+
+  PvtSession session(sct);
+  session.set_auto_exit(false);
+  check(session.open(PvtMode::Joint, vectorXd(6, 0.0)), "open");
+
+  check(session.append(traj({ point(0.0, 0.0, 0.0), point(0.05, 0.01, 0.0) })),
+    "accepts a start point at the open position");
+  check(!session.append(traj({ point(0.05, 0.02, 0.0) })),
+    "rejects a trajectory without a zero time start point");
+  check(!session.append(traj({ point(0.0, 0.5, 0.0), point(0.05, 0.02, 0.0) })),
+    "rejects a start position off the end of the queue");
+  check(!session.append(traj({ point(0.0, 0.01, 0.5), point(0.05, 0.02, 0.0) })),
+    "rejects a start velocity off the end of the queue");
+  check(session.append(traj({ point(0.0, 0.01, 0.0), point(0.05, 0.0, 0.0) })),
+    "accepts a start point at the end of the queue");
+
+  PvtSession::Stats st = session.stats();
+  check(st.traj_count == 2, "two trajectories queued");
+  check(st.rejected_count == 3, "three trajectories rejected");
+
+  session.close();
+  check(!session.is_open() && !session.is_entered(), "closed");
+
+  sct.stop();
+  mock.stop();
+
+  if (failures) {
+    std::printf("%d failed\n", failures);
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include "tmrl/driver/pvt_spline.h"
+
+#include <cmath>
+#include <cstdio>
+
+/*
+ * PvtSpline: a single point holds still, the batched evaluation matches
+ * the scalar one on sorted and unsorted times.
+ */
+
+using namespace tmrl;
+using namespace tmrl::driver;
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool cond, const char *what)
+{
+  if (!cond) {
+    std::printf("FAIL: %s\n", what);
+    ++failures;
+  }
+}
+
+PvtPoint point(double time, double pos, double vel)
+{
+  PvtPoint p;
+  p.time = time;
+  p.positions = vectorXd(6, pos);
+  p.velocities = vectorXd(6, vel);
+  return p;
+}
+
+}
+
+int main()
+{
+  PvtTraj one;
+  one.mode = PvtMode::Joint;
+  one.points.push_back(point(0.0, 0.3, 0.5));
+  one.total_time = 0.0;
+
+  PvtSpline spline(one);
+  check(!spline.empty() && spline.duration() == 0.0, "one point, one segment of zero time");
+  double pos[6] = {}, vel[6] = {};
+  for (auto &v : vel) { v = 1.0; }
+  spline.evaluate(0.1, pos, vel);
+  check(pos[0] == 0.3 && pos[5] == 0.3, "one point, holds its position");
+  check(vel[0] == 0.0 && vel[5] == 0.0, "one point, stands");
+
+  PvtSpline held(point(0.0, -0.2, 0.0), PvtTraj());
+  held.evaluate(1.0, pos, vel);
+  check(!held.empty() && pos[0] == -0.2 && vel[0] == 0.0, "start without points holds the start");
+
+  PvtSpline none(PvtTraj{});
+  check(none.empty(), "no points, empty");
+
+  PvtTraj traj;
+  traj.mode = PvtMode::Joint;
+  traj.total_time = 0.0;
+  traj.points.push_back(point(0.0, 0.0, 0.0));
+  for (int k = 1; k <= 50; ++k) {
+    traj.points.push_back(point(0.004 * (1 + k % 3), std::sin(0.1 * k), (k == 50) ? 0.0 : std::cos(0.1 * k)));
+    traj.total_time += traj.points.back().time;
+  }
+  spline.build(traj);
+
+  // sorted with repeats and out of range, then shuffled
+  std::vector<double> times;
+  for (int s = -5; s < 400; ++s) { times.push_back(0.0005 * s); }
+  times.push_back(times.back());
+  times.push_back(10.0);
+  for (std::size_t s = 0; s < 20; ++s) { times.push_back(times[(s * 97) % times.size()]); }
+
+  const std::size_t n = times.size();
+  std::vector<double> bpos(6 * n), bvel(6 * n);
+  spline.evaluate(times.data(), n, bpos.data(), bvel.data());
+  bool same = true;
+  for (std::size_t s = 0; s < n; ++s) {
+    spline.evaluate(times[s], pos, vel);
+    for (std::size_t i = 0; i < 6; ++i) {
+      same = same && std::fabs(bpos[6 * s + i] - pos[i]) < 1.0e-12 && std::fabs(bvel[6 * s + i] - vel[i]) < 1.0e-12;
+    }
+  }
+  check(same, "batched evaluation matches the scalar one");
+
+  if (failures) {
+    std::printf("%d failed\n", failures);
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}